@@ -1,10 +1,19 @@
 #include "../kit_server/http/http_server.h"
+#include "../kit_server/http/servlet.h"
 #include "../kit_server/Log.h"
 
 
 static kit_server::Logger::ptr g_logger = KIT_LOG_ROOT();
 static kit_server::Logger::ptr g_logger2 = KIT_LOG_NAME("system");
 
+/*
+ * 压测响应的发送路径:
+ *   ab -k -n 200000 -c 100 http://127.0.0.1:8888/hello     小报文 主要是首部序列化的开销
+ *   ab -k -n 50000 -c 100 http://127.0.0.1:8888/blob       64KB报文 主体共享 发送时不拷贝
+ *   wrk -t4 -c100 -d10s http://127.0.0.1:8888/hello -s ab_example/pipeline.lua -- 16   流水线 多个响应一次writev
+ *   ab -k -n 50000 -c 100 http://127.0.0.1:8888/static/index.html     静态文件 sendfile发送 句柄缓存
+ */
+
 void run()
 {
 
@@ -16,8 +25,27 @@ void run()
     }
 
     kit_server::http::HttpServer::ptr server(new kit_server::http::HttpServer(true));
+
+    //所有响应共用同一块报文主体
+    std::shared_ptr<const std::string> blob = std::make_shared<const std::string>(64 * 1024, 'k');
+
+    auto sd = server->getServletDispatch();
+    sd->addServlet("/hello", [](kit_server::http::HttpRequest::ptr req, kit_server::http::HttpResponse::ptr rsp,
+        kit_server::http::HttpSession::ptr session){
+        rsp->setBody("hello kit!");
+        return 0;
+    });
+    sd->addServlet("/blob", [blob](kit_server::http::HttpRequest::ptr req, kit_server::http::HttpResponse::ptr rsp,
+        kit_server::http::HttpSession::ptr session){
+        rsp->setSharedBody(blob);
+        return 0;
+    });
+    //当前目录下的文件
+    sd->addGlobServlet("/static/*", kit_server::http::StaticFileServlet::ptr(
+        new kit_server::http::StaticFileServlet(".", "/static/")));
+
     while(!server->bind(addr))
-    {   
+    {
         sleep(1);
     }
 
@@ -34,4 +62,4 @@ int main(int argc, char* argv[])
 
 
     return 0;
-}
\ No newline at end of file
+}
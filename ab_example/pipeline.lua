@@ -0,0 +1,16 @@
+-- wrk流水线压测脚本 每次发送把depth个请求拼在一起写出去
+-- 用法: wrk -t4 -c100 -d10s http://127.0.0.1:8888/hello -s ab_example/pipeline.lua -- 16
+-- 参数是流水线深度 不给默认16 请求路径取命令行里的url
+
+init = function(args)
+    local depth = tonumber(args[1]) or 16
+    local r = {}
+    for i = 1, depth do
+        r[i] = wrk.format(nil, wrk.path)
+    end
+    req = table.concat(r)
+end
+
+request = function()
+    return req
+end
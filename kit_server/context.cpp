@@ -0,0 +1,154 @@
+#include "context.h"
+
+#include <stdint.h>
+
+
+//汇编实现的上下文切换函数
+//from: 保存当前栈顶指针的位置  to: 目标上下文的栈顶指针
+extern "C" void kit_swap_context(void **from, void *to);
+
+#if defined(__x86_64__)
+//System V ABI 被调用者保存寄存器: rbx rbp r12-r15 以及 MXCSR/x87控制字
+//栈布局(从低到高): mxcsr|fpucw r12 r13 r14 r15 rbx rbp 返回地址
+__asm__(
+    ".text\n"
+    ".globl kit_swap_context\n"
+    ".hidden kit_swap_context\n"
+    ".type kit_swap_context,@function\n"
+    ".align 16\n"
+"kit_swap_context:\n"
+    "pushq %rbp\n"
+    "pushq %rbx\n"
+    "pushq %r15\n"
+    "pushq %r14\n"
+    "pushq %r13\n"
+    "pushq %r12\n"
+    "subq $8, %rsp\n"
+    "stmxcsr (%rsp)\n"
+    "fnstcw 4(%rsp)\n"
+    "movq %rsp, (%rdi)\n"
+    "movq %rsi, %rsp\n"
+    "ldmxcsr (%rsp)\n"
+    "fldcw 4(%rsp)\n"
+    "addq $8, %rsp\n"
+    "popq %r12\n"
+    "popq %r13\n"
+    "popq %r14\n"
+    "popq %r15\n"
+    "popq %rbx\n"
+    "popq %rbp\n"
+    "ret\n"
+    ".size kit_swap_context,.-kit_swap_context\n"
+);
+#elif defined(__aarch64__)
+//AAPCS64 被调用者保存寄存器: x19-x28 x29(fp) x30(lr) d8-d15
+//ret通过x30返回 新上下文的x30就是入口函数
+__asm__(
+    ".text\n"
+    ".globl kit_swap_context\n"
+    ".hidden kit_swap_context\n"
+    ".type kit_swap_context,%function\n"
+    ".align 4\n"
+"kit_swap_context:\n"
+    "sub sp, sp, #160\n"
+    "stp x19, x20, [sp, #0]\n"
+    "stp x21, x22, [sp, #16]\n"
+    "stp x23, x24, [sp, #32]\n"
+    "stp x25, x26, [sp, #48]\n"
+    "stp x27, x28, [sp, #64]\n"
+    "stp x29, x30, [sp, #80]\n"
+    "stp d8, d9, [sp, #96]\n"
+    "stp d10, d11, [sp, #112]\n"
+    "stp d12, d13, [sp, #128]\n"
+    "stp d14, d15, [sp, #144]\n"
+    "mov x9, sp\n"
+    "str x9, [x0]\n"
+    "mov sp, x1\n"
+    "ldp x19, x20, [sp, #0]\n"
+    "ldp x21, x22, [sp, #16]\n"
+    "ldp x23, x24, [sp, #32]\n"
+    "ldp x25, x26, [sp, #48]\n"
+    "ldp x27, x28, [sp, #64]\n"
+    "ldp x29, x30, [sp, #80]\n"
+    "ldp d8, d9, [sp, #96]\n"
+    "ldp d10, d11, [sp, #112]\n"
+    "ldp d12, d13, [sp, #128]\n"
+    "ldp d14, d15, [sp, #144]\n"
+    "add sp, sp, #160\n"
+    "ret\n"
+    ".size kit_swap_context,.-kit_swap_context\n"
+);
+#endif
+
+
+namespace kit_server
+{
+
+bool UContext::make(void *stack, size_t size, Entry entry)
+{
+    if(getcontext(&m_ctx) < 0)
+        return false;
+
+    //指定代码序列执行完毕后 自动跳转到的指定地方
+    m_ctx.uc_link = nullptr;
+    m_ctx.uc_stack.ss_sp = stack;
+    m_ctx.uc_stack.ss_size = size;
+    makecontext(&m_ctx, entry, 0);
+
+    return true;
+}
+
+bool UContext::swapTo(UContext &to)
+{
+    return swapcontext(&m_ctx, &to.m_ctx) == 0;
+}
+
+void* UContext::stackPointer() const
+{
+#if defined(__x86_64__)
+    return (void *)m_ctx.uc_mcontext.gregs[REG_RSP];
+#elif defined(__aarch64__)
+    return (void *)m_ctx.uc_mcontext.sp;
+#else
+    return nullptr;
+#endif
+}
+
+#if KIT_CONTEXT_HAS_ASM
+bool AsmContext::make(void *stack, size_t size, Entry entry)
+{
+    //栈顶16字节对齐
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+
+#if defined(__x86_64__)
+    //ret进入entry后 rsp按照"刚被call"的状态对齐到 16n+8
+    void **sp = (void **)(top - 72);
+    sp[8] = nullptr;                    //entry的返回地址 entry不允许返回
+    sp[7] = (void *)entry;              //kit_swap_context的ret目标
+    sp[6] = nullptr;                    //rbp
+    sp[5] = nullptr;                    //rbx
+    sp[4] = nullptr;                    //r15
+    sp[3] = nullptr;                    //r14
+    sp[2] = nullptr;                    //r13
+    sp[1] = nullptr;                    //r12
+    ((uint32_t *)sp)[0] = 0x1F80;       //MXCSR默认值
+    ((uint32_t *)sp)[1] = 0x037F;       //x87控制字默认值
+#else
+    void **sp = (void **)(top - 160);
+    for(int i = 0;i < 20;++i)
+        sp[i] = nullptr;
+    sp[11] = (void *)entry;             //x30 ret跳转到entry
+#endif
+
+    m_sp = sp;
+    return true;
+}
+
+bool AsmContext::swapTo(AsmContext &to)
+{
+    kit_swap_context(&m_sp, to.m_sp);
+    return true;
+}
+#endif
+
+}
@@ -0,0 +1,108 @@
+#ifndef _KIT_CONTEXT_H_
+#define _KIT_CONTEXT_H_
+
+#include <ucontext.h>
+#include <stddef.h>
+
+#include "noncopyable.h"
+
+//x86-64/aarch64 提供汇编实现的上下文切换 其他平台只能使用ucontext
+#if defined(__x86_64__) || defined(__aarch64__)
+#define KIT_CONTEXT_HAS_ASM 1
+#else
+#define KIT_CONTEXT_HAS_ASM 0
+#endif
+
+
+namespace kit_server
+{
+
+/**
+ * @brief 基于ucontext的程序上下文
+ * @details swapcontext每次切换都要通过系统调用保存/恢复信号掩码 开销较大
+ */
+class UContext: Noncopyable
+{
+public:
+    typedef void (*Entry)();
+
+    /**
+     * @brief 在指定栈空间上构造一个新的上下文 第一次切换进来时从entry开始执行
+     * @param[in] stack 栈空间起始(低地址)
+     * @param[in] size 栈空间大小
+     * @param[in] entry 入口函数 不允许返回
+     * @return true 成功
+     * @return false 失败
+     */
+    bool make(void *stack, size_t size, Entry entry);
+
+    /**
+     * @brief 保存当前上下文到this 并切换到to
+     * @param[in] to 目标上下文
+     * @return true 成功
+     * @return false 失败
+     */
+    bool swapTo(UContext &to);
+
+    /**
+     * @brief 获取挂起时保存的栈顶指针 只在上下文被切出后有意义
+     * @return void* 不支持的平台返回nullptr
+     */
+    void* stackPointer() const;
+
+private:
+    /// ucontext上下文
+    ucontext_t m_ctx;
+};
+
+#if KIT_CONTEXT_HAS_ASM
+/**
+ * @brief 基于汇编的程序上下文
+ * @details 只在栈上保存/恢复被调用者保存寄存器 不保存信号掩码 也不陷入内核
+ *          整个上下文就是一个栈指针
+ */
+class AsmContext: Noncopyable
+{
+public:
+    typedef void (*Entry)();
+
+    /**
+     * @brief 在指定栈空间上构造一个新的上下文 第一次切换进来时从entry开始执行
+     * @param[in] stack 栈空间起始(低地址)
+     * @param[in] size 栈空间大小
+     * @param[in] entry 入口函数 不允许返回
+     * @return true 成功
+     * @return false 失败
+     */
+    bool make(void *stack, size_t size, Entry entry);
+
+    /**
+     * @brief 保存当前上下文到this 并切换到to
+     * @param[in] to 目标上下文
+     * @return true 成功
+     * @return false 失败
+     */
+    bool swapTo(AsmContext &to);
+
+    /**
+     * @brief 获取挂起时保存的栈顶指针 只在上下文被切出后有意义
+     * @return void* 
+     */
+    void* stackPointer() const {return m_sp;}
+
+private:
+    /// 挂起时的栈顶指针 寄存器保存在这个位置上
+    void *m_sp = nullptr;
+};
+#endif
+
+//编译时选择协程使用的上下文实现 定义KIT_USE_UCONTEXT强制使用ucontext
+#if KIT_CONTEXT_HAS_ASM && !defined(KIT_USE_UCONTEXT)
+typedef AsmContext Context;
+#else
+typedef UContext Context;
+#endif
+
+}
+
+#endif
@@ -7,6 +7,13 @@
 #include <atomic>
 #include <thread>
 #include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 
 namespace kit_server
@@ -42,75 +49,600 @@ static ConfigVar<uint32_t>::ptr g_cor_stack_size =
     Config::LookUp("coroutine.stack_size", (uint32_t)1024*1024, "coroutine stack size");
 
 /**
- * @brief 协程栈内存分配器类
+ * @brief 配置项 共享栈模式下每个线程共享栈的大小 默认8MB 使用mmap按需提交
  */
-class MallocStackAllocator
+static ConfigVar<uint32_t>::ptr g_cor_shared_stack_size =
+    Config::LookUp("coroutine.shared_stack_size", (uint32_t)8*1024*1024, "coroutine shared stack size");
+
+/**
+ * @brief 配置项 协程栈分配器 malloc:直接malloc pool:线程局部缓存池 mmap:mmap预留+保护页+按需提交
+ */
+static ConfigVar<std::string>::ptr g_cor_stack_allocator =
+    Config::LookUp("coroutine.stack_allocator", std::string("pool"), "coroutine stack allocator: malloc/pool/mmap");
+
+/**
+ * @brief 配置项 每个线程协程栈缓存池的高水位 超过后释放的栈直接归还系统 为0则不缓存 默认32MB
+ */
+static ConfigVar<uint64_t>::ptr g_cor_stack_pool_high_water =
+    Config::LookUp("coroutine.stack_pool.high_water", (uint64_t)32*1024*1024, "coroutine stack pool high water bytes per thread");
+
+/**
+ * @brief 协程栈分配器类型
+ */
+enum StackAllocatorType
+{
+    MALLOC_STACK,   //直接malloc
+    POOL_STACK,     //线程局部缓存池
+    MMAP_STACK      //mmap预留 带保护页
+};
+
+/**
+ * @brief 当前使用的协程栈分配器类型
+ */
+static std::atomic<int> s_stack_allocator_type(POOL_STACK);
+
+/**
+ * @brief 协程栈缓存池高水位
+ */
+static std::atomic<uint64_t> s_stack_pool_high_water(0);
+
+/**
+ * @brief 由malloc/缓存池分配 且仍被协程持有的栈字节数
+ */
+static std::atomic<uint64_t> s_heap_stack_bytes(0);
+
+/**
+ * @brief 将配置的字符串转换为分配器类型
+ * @param[in] name 分配器名称
+ * @return int 
+ */
+static int StackAllocatorFromString(const std::string& name)
+{
+    if(name == "malloc")
+        return MALLOC_STACK;
+    if(name == "mmap")
+        return MMAP_STACK;
+    if(name != "pool")
+        KIT_LOG_ERROR(g_logger) << "unknow coroutine stack allocator: " << name << ", use pool";
+
+    return POOL_STACK;
+}
+
+/**
+ * @brief 在main() 函数之前读取协程栈分配相关配置
+ */
+struct _StackAllocatorIniter
+{
+    _StackAllocatorIniter()
+    {
+        s_stack_allocator_type = StackAllocatorFromString(g_cor_stack_allocator->getValue());
+        s_stack_pool_high_water = g_cor_stack_pool_high_water->getValue();
+
+        //修改后只影响新创建的协程 已有的协程仍由原分配器释放
+        g_cor_stack_allocator->addListener([](const std::string &old_value, const std::string &new_value){
+            KIT_LOG_INFO(g_logger) << "coroutine stack allocator changed from " << old_value
+                << " to " << new_value;
+            s_stack_allocator_type = StackAllocatorFromString(new_value);
+        });
+
+        g_cor_stack_pool_high_water->addListener([](const uint64_t &old_value, const uint64_t &new_value){
+            KIT_LOG_INFO(g_logger) << "coroutine stack pool high water changed from " << old_value
+                << " to " << new_value;
+            s_stack_pool_high_water = new_value;
+        });
+    }
+};
+
+static struct _StackAllocatorIniter _stack_allocator_initer;
+
+/**
+ * @brief 协程栈内存分配器基类
+ */
+class StackAllocator
 {
 public:
+    virtual ~StackAllocator() {}
+
     /**
      * @brief 分配内存
      * @param[in] size 所需内存大小 
      * @return void* 
      */
-    static void* Alloc(size_t size)
+    virtual void* alloc(size_t size) = 0;
+
+    /**
+     * @brief 释放内存
+     * @param[in] vp 栈空间指针 
+     * @param[in] size 栈空间大小
+     */
+    virtual void dealloc(void *vp, size_t size) = 0;
+};
+
+/**
+ * @brief malloc协程栈内存分配器类
+ */
+class MallocStackAllocator: public StackAllocator
+{
+public:
+    void* alloc(size_t size) override
     {
+        s_heap_stack_bytes += size;
         return malloc(size);
     }
 
+    void dealloc(void *vp, size_t size) override
+    {
+        s_heap_stack_bytes -= size;
+        free(vp);
+    }
+};
+
+/**
+ * @brief 当前线程的协程栈缓存池是否已经析构 线程退出后释放的栈直接归还系统
+ */
+static thread_local bool t_stack_pool_destroyed = false;
+
+/**
+ * @brief 线程局部的协程栈缓存池
+ * @details 按2的幂划分尺寸等级 每个等级一个空闲链表 释放的栈在高水位以内时缓存起来
+ *          下次分配同等级的栈直接复用 避免频繁创建协程时反复malloc/free大块内存
+ */
+class StackPool
+{
+public:
+    /// 最小尺寸等级 8KB
+    static const size_t MIN_CLASS_SIZE = 8 * 1024;
+    /// 尺寸等级数量 8KB ~ 128MB
+    static const size_t CLASS_COUNT = 15;
+
     /**
-     * @brief 释放内存
+     * @brief 协程栈缓存池析构函数 线程退出时释放缓存的栈
+     */
+    ~StackPool()
+    {
+        for(auto &x : m_freeLists)
+        {
+            for(auto &vp : x)
+                free(vp);
+        }
+
+        t_stack_pool_destroyed = true;
+    }
+
+    /**
+     * @brief 计算所需内存大小所在的尺寸等级
+     * @param[in] size 所需内存大小
+     * @return size_t 超出最大等级返回CLASS_COUNT
+     */
+    static size_t ClassIndex(size_t size)
+    {
+        size_t index = 0;
+        size_t class_size = MIN_CLASS_SIZE;
+        while(class_size < size && index < CLASS_COUNT)
+        {
+            class_size <<= 1;
+            ++index;
+        }
+
+        return index;
+    }
+
+    /**
+     * @brief 获取尺寸等级对应的实际分配大小
+     * @param[in] index 尺寸等级
+     * @return size_t 
+     */
+    static size_t ClassSize(size_t index) {return MIN_CLASS_SIZE << index;}
+
+    /**
+     * @brief 分配内存 优先复用缓存的栈
+     * @param[in] size 所需内存大小
+     * @return void* 
+     */
+    void* alloc(size_t size)
+    {
+        size_t index = ClassIndex(size);
+        if(index >= CLASS_COUNT)
+            return malloc(size);
+
+        std::vector<void*>& list = m_freeLists[index];
+        if(list.size())
+        {
+            void* vp = list.back();
+            list.pop_back();
+            m_cachedBytes -= ClassSize(index);
+            return vp;
+        }
+
+        return malloc(ClassSize(index));
+    }
+
+    /**
+     * @brief 释放内存 高水位以内缓存 否则归还系统
      * @param[in] vp 栈空间指针 
      * @param[in] size 栈空间大小
      */
-    static void Dealloc(void *vp, size_t size)
+    void dealloc(void* vp, size_t size)
     {
-        free(vp);
+        size_t index = ClassIndex(size);
+        if(index >= CLASS_COUNT || 
+            m_cachedBytes + ClassSize(index) > s_stack_pool_high_water)
+        {
+            free(vp);
+            return;
+        }
+
+        m_freeLists[index].push_back(vp);
+        m_cachedBytes += ClassSize(index);
     }
+
+private:
+    /// 每个尺寸等级的空闲栈
+    std::vector<void*> m_freeLists[CLASS_COUNT];
+    /// 当前缓存的总字节数
+    size_t m_cachedBytes = 0;
 };
-//使用using起别名
-using StackAllocator = MallocStackAllocator;
 
-Coroutine::Coroutine()
+/**
+ * @brief 当前线程的协程栈缓存池
+ */
+static thread_local StackPool t_stack_pool;
+
+/**
+ * @brief 带缓存池的协程栈内存分配器类
+ */
+class PoolStackAllocator: public StackAllocator
 {
-    m_state = State::EXEC;
-    SetThis(this);
+public:
+    void* alloc(size_t size) override
+    {
+        s_heap_stack_bytes += size;
+        if(KIT_UNLIKELY(t_stack_pool_destroyed))
+            return malloc(size);
 
-    if(getcontext(&m_ctx) < 0)
+        return t_stack_pool.alloc(size);
+    }
+
+    void dealloc(void *vp, size_t size) override
     {
-        KIT_LOG_ERROR(g_logger) << "Cortione: getcontext error";
+        s_heap_stack_bytes -= size;
+        if(KIT_UNLIKELY(t_stack_pool_destroyed))
+        {
+            free(vp);
+            return;
+        }
+
+        t_stack_pool.dealloc(vp, size);
+    }
+};
+
+/**
+ * @brief 当前线程的mmap栈缓存是否已经析构 线程退出后释放的栈直接归还系统
+ */
+static thread_local bool t_mmap_cache_destroyed = false;
+
+class MmapStackAllocator;
 
-        KIT_ASSERT2(false, "getcontext error");
+/**
+ * @brief 线程局部的mmap栈缓存
+ * @details 释放的栈按大小缓存 保护页和映射都保留 下次分配同样大小的栈不用再mmap/mprotect
+ *          缓存总量不超过协程栈缓存池的高水位
+ */
+class MmapStackCache
+{
+public:
+    /**
+     * @brief 线程退出时把缓存的栈归还系统
+     */
+    ~MmapStackCache();
+
+    /**
+     * @brief 取出一个缓存的栈
+     * @param[in] size 对齐后的栈大小
+     * @return void* 没有缓存返回nullptr
+     */
+    void* get(size_t size)
+    {
+        auto it = m_stacks.find(size);
+        if(it == m_stacks.end() || it->second.empty())
+            return nullptr;
+
+        void* vp = it->second.back();
+        it->second.pop_back();
+        m_cachedBytes -= size;
+        return vp;
+    }
+
+    /**
+     * @brief 缓存一个释放的栈
+     * @param[in] vp 栈起始地址
+     * @param[in] size 对齐后的栈大小
+     * @return true 已缓存
+     * @return false 超过高水位 由调用者归还系统
+     */
+    bool put(void* vp, size_t size)
+    {
+        if(m_cachedBytes + size > s_stack_pool_high_water)
+            return false;
+
+        m_stacks[size].push_back(vp);
+        m_cachedBytes += size;
+        return true;
     }
+
+private:
+    /// 对齐后的栈大小->缓存的栈
+    std::unordered_map<size_t, std::vector<void*> > m_stacks;
+    /// 当前缓存的总字节数
+    size_t m_cachedBytes = 0;
+};
+
+static thread_local MmapStackCache t_mmap_cache;
+
+/**
+ * @brief mmap协程栈内存分配器类
+ * @details 只预留虚拟地址空间 物理页在第一次访问时才由内核提交
+ *          栈底(低地址)放一个PROT_NONE保护页 栈溢出时直接触发SIGSEGV 而不是踩坏相邻内存
+ *          协程创建/销毁优先走线程局部缓存 只有真正mmap/munmap时才登记到全局的映射表
+ */
+class MmapStackAllocator: public StackAllocator
+{
+public:
+    typedef Mutex MutexType;
+
+    MmapStackAllocator()
+        :m_pageSize(sysconf(_SC_PAGESIZE)) { }
+
+    void* alloc(size_t size) override
+    {
+        size = roundUp(size);
+        if(KIT_LIKELY(!t_mmap_cache_destroyed))
+        {
+            void* vp = t_mmap_cache.get(size);
+            if(vp)
+                return vp;
+        }
+
+        return map(size);
+    }
+
+    void dealloc(void *vp, size_t size) override
+    {
+        size = roundUp(size);
+        if(KIT_LIKELY(!t_mmap_cache_destroyed) && t_mmap_cache.put(vp, size))
+            return;
+
+        unmap(vp, size);
+    }
+
+    /**
+     * @brief 统计所有mmap栈(包括线程缓存中的)实际驻留物理内存的字节数
+     * @details 持锁只拷贝一份映射表 mincore在锁外执行 不阻塞协程的创建和销毁
+     *          期间被释放的栈mincore会失败 直接跳过
+     * @return uint64_t 
+     */
+    uint64_t residentBytes()
+    {
+        std::vector<std::pair<void*, size_t> > stacks;
+        {
+            MutexType::Lock lock(m_mutex);
+            stacks.assign(m_stacks.begin(), m_stacks.end());
+        }
+
+        uint64_t bytes = 0;
+        std::vector<unsigned char> vec;
+        for(auto &x : stacks)
+        {
+            vec.resize(x.second / m_pageSize);
+            if(mincore(x.first, x.second, &vec[0]) < 0)
+                continue;
+
+            for(auto &c : vec)
+            {
+                if(c & 1)
+                    bytes += m_pageSize;
+            }
+        }
+
+        return bytes;
+    }
+
+    /**
+     * @brief 把栈归还系统
+     * @param[in] vp 栈起始地址
+     * @param[in] size 对齐后的栈大小
+     */
+    void unmap(void *vp, size_t size)
+    {
+        {
+            MutexType::Lock lock(m_mutex);
+            m_stacks.erase(vp);
+        }
+
+        munmap((char*)vp - m_pageSize, size + m_pageSize);
+    }
+
+private:
+    /**
+     * @brief 向系统申请一个新的栈
+     * @param[in] size 对齐后的栈大小
+     * @return void* 
+     */
+    void* map(size_t size)
+    {
+        size_t len = size + m_pageSize;
+        //MAP_NORESERVE 不预先占用交换空间 配合按需提交
+        void* base = mmap(nullptr, len, PROT_READ | PROT_WRITE, 
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(base == MAP_FAILED)
+        {
+            KIT_LOG_ERROR(g_logger) << "MmapStackAllocator: mmap error, size=" << len
+                << ", errno=" << errno << ", is:" << strerror(errno);
+            KIT_ASSERT2(false, "mmap error");
+        }
+
+        //栈从高地址向低地址增长 最低的一页作为保护页
+        if(mprotect(base, m_pageSize, PROT_NONE) < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "MmapStackAllocator: mprotect error, errno=" << errno
+                << ", is:" << strerror(errno);
+            KIT_ASSERT2(false, "mprotect error");
+        }
+
+        void* vp = (char*)base + m_pageSize;
+        {
+            MutexType::Lock lock(m_mutex);
+            m_stacks[vp] = size;
+        }
+
+        return vp;
+    }
+
+    /**
+     * @brief 向上对齐到页大小
+     * @param[in] size 原始大小
+     * @return size_t 
+     */
+    size_t roundUp(size_t size) const
+    {
+        return (size + m_pageSize - 1) / m_pageSize * m_pageSize;
+    }
+
+private:
+    /// 页大小
+    size_t m_pageSize;
+    /// 互斥锁 只保护映射表
+    MutexType m_mutex;
+    /// 已经映射的栈 栈起始地址->栈大小
+    std::unordered_map<void*, size_t> m_stacks;
+};
+
+static MallocStackAllocator s_malloc_allocator;
+static PoolStackAllocator s_pool_allocator;
+static MmapStackAllocator s_mmap_allocator;
+
+MmapStackCache::~MmapStackCache()
+{
+    t_mmap_cache_destroyed = true;
+    for(auto &x : m_stacks)
+    {
+        for(auto &vp : x.second)
+            s_mmap_allocator.unmap(vp, x.first);
+    }
+}
+
+/**
+ * @brief 获取当前配置的协程栈分配器
+ * @return StackAllocator* 
+ */
+static StackAllocator* GetStackAllocator()
+{
+    switch(s_stack_allocator_type)
+    {
+        case MALLOC_STACK: return &s_malloc_allocator;
+        case MMAP_STACK: return &s_mmap_allocator;
+        default: return &s_pool_allocator;
+    }
+}
+
+/**
+ * @brief 当前线程的共享栈是否已经析构
+ */
+static thread_local bool t_shared_stack_destroyed = false;
+
+/**
+ * @brief 线程局部的共享栈
+ * @details 共享栈协程都在这块栈上运行 切出后用到的部分被拷贝到协程自己的堆内存里
+ *          第一次使用时才分配 使用mmap分配器 没有用到的页不占物理内存
+ */
+class SharedStack
+{
+public:
+    ~SharedStack()
+    {
+        t_shared_stack_destroyed = true;
+        if(m_stack)
+            s_mmap_allocator.dealloc(m_stack, m_size);
+    }
+
+    /**
+     * @brief 获取共享栈起始(低地址)
+     * @return char* 
+     */
+    char* stack()
+    {
+        if(KIT_UNLIKELY(!m_stack))
+        {
+            m_size = g_cor_shared_stack_size->getValue();
+            m_stack = (char *)s_mmap_allocator.alloc(m_size);
+        }
+
+        return m_stack;
+    }
+
+    /**
+     * @brief 获取共享栈栈底(高地址)
+     * @return char* 
+     */
+    char* top() {return stack() + m_size;}
+
+    /**
+     * @brief 获取共享栈大小
+     * @return size_t 
+     */
+    size_t size() {stack(); return m_size;}
+
+public:
+    /// 共享栈上内容所属的协程ID 用ID而不用指针 避免协程析构后地址被复用
+    uint64_t owner = 0;
+
+private:
+    /// 共享栈起始
+    char *m_stack = nullptr;
+    /// 共享栈大小
+    size_t m_size = 0;
+};
+
+static thread_local SharedStack t_shared_stack;
+
+Coroutine::Coroutine()
+{
+    m_state = State::EXEC;
+    SetThis(this);
+
+    //母协程运行在线程原本的栈上 上下文在第一次切出时保存
     ++s_cor_sum;
 }
 
-Coroutine::Coroutine(std::function<void()> cb, size_t stack_size, bool use_call)
+Coroutine::Coroutine(std::function<void()> cb, size_t stack_size, bool use_call, bool shared_stack)
     :m_id(++s_cor_id)
+    ,m_sharedStack(shared_stack)
     ,m_cb(cb)
 {
     ++s_cor_sum;
 
-    //为协程分配栈空间 让回调函数在对应栈空间去运行
-    m_stack_size = stack_size ? stack_size : g_cor_stack_size->getValue(); 
-    m_stack = StackAllocator::Alloc(m_stack_size);
-    if(getcontext(&m_ctx) < 0)
+    //共享栈协程的上下文在第一次切入时才在共享栈上构造
+    if(m_sharedStack)
     {
-        KIT_LOG_ERROR(g_logger) << "Cortione: getcontext error";
+        //调度协程需要在自己的栈上运行
+        KIT_ASSERT2(!use_call, "shared stack coroutine can not use call");
 
-        KIT_ASSERT2(false, "getcontext error");
+        KIT_LOG_DEBUG(g_logger) << "共享栈协程构造:" << m_id;
+        return;
     }
 
-    //指定代码序列执行完毕后 自动跳转到的指定地方
-    m_ctx.uc_link = nullptr;        
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stack_size;
-
+    //为协程分配栈空间 让回调函数在对应栈空间去运行
+    m_stack_size = stack_size ? stack_size : g_cor_stack_size->getValue(); 
+    m_allocator = GetStackAllocator();
+    m_stack = m_allocator->alloc(m_stack_size);
     //use_call 标识当前的协程是否作为调度协程使用
-    if(!use_call)
-        //指定要运行的代码序列
-        makecontext(&m_ctx, &Coroutine::MainFunc, 0);
-    else 
-        makecontext(&m_ctx, &Coroutine::CallMainFunc, 0);
+    //指定要运行的代码序列
+    if(!m_ctx.make(m_stack, m_stack_size, use_call ? &Coroutine::CallMainFunc : &Coroutine::MainFunc))
+    {
+        KIT_LOG_ERROR(g_logger) << "Cortione: make context error";
+
+        KIT_ASSERT2(false, "make context error");
+    }
 
 
     KIT_LOG_DEBUG(g_logger) << "协程构造:" << m_id;
@@ -120,13 +652,23 @@ Coroutine::Coroutine(std::function<void()> cb, size_t stack_size, bool use_call)
 Coroutine::~Coroutine()
 {
     --s_cor_sum;
-    if(m_stack)
+    if(m_sharedStack)
+    {
+        KIT_ASSERT(m_state != State::EXEC);
+
+        if(!t_shared_stack_destroyed && t_shared_stack.owner == m_id)
+            t_shared_stack.owner = 0;
+        freeSavedStack();
+
+        KIT_LOG_DEBUG(g_logger) << "共享栈协程析构:" << m_id;
+    }
+    else if(m_stack)
     {
         //只要不是运行态 或者 挂起就释放栈空间
         KIT_ASSERT(m_state != State::EXEC || m_state != State::HOLD);
 
         //释放栈空间
-        StackAllocator::Dealloc(m_stack, m_stack_size);
+        m_allocator->dealloc(m_stack, m_stack_size);
         
         KIT_LOG_DEBUG(g_logger) << "协程析构:" << m_id;
     }
@@ -147,25 +689,26 @@ Coroutine::~Coroutine()
 //协程重置
 void Coroutine::reset(std::function<void()> cb)
 {
-    KIT_ASSERT(m_stack);
+    KIT_ASSERT(m_stack || m_sharedStack);
     KIT_ASSERT(m_state == State::INIT || m_state == State::TERM || 
                m_state == State::EXCEPTION);
 
-    if(getcontext(&m_ctx) < 0)
+    if(m_sharedStack)
     {
-        KIT_LOG_ERROR(g_logger) << "reset: getcontext error";
+        //共享栈协程在下一次切入时重新构造上下文 也可以换到其他线程上运行
+        freeSavedStack();
+        m_ctxReady = false;
+        m_boundThread = -1;
+    }
+    else if(!m_ctx.make(m_stack, m_stack_size, &Coroutine::MainFunc))
+    {
+        KIT_LOG_ERROR(g_logger) << "reset: make context error";
 
-        KIT_ASSERT2(false, "getcontext error");
+        KIT_ASSERT2(false, "make context error");
     }
 
     m_cb = cb;
 
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stack_size;
-
-    makecontext(&m_ctx, &Coroutine::MainFunc, 0);
-
     m_state = State::INIT;
 
 }
@@ -179,26 +722,33 @@ void Coroutine::swapIn()
     //没在运行态才能 调入运行
     KIT_ASSERT(m_state != State::EXEC);
 
+    if(m_sharedStack)
+        acquireSharedStack();
+
     m_state = State::EXEC;
 
-    if(swapcontext(&Scheduler::GetMainCor()->m_ctx, &m_ctx) < 0)
+    if(!Scheduler::GetMainCor()->m_ctx.swapTo(m_ctx))
     {
-        KIT_LOG_ERROR(g_logger) << "swapIn: swapcontext error";
+        KIT_LOG_ERROR(g_logger) << "swapIn: swap context error";
 
-        KIT_ASSERT2(false, "swapcontext error");
+        KIT_ASSERT2(false, "swap context error");
     }
 
+    //已经切回调度协程 把共享栈上用到的部分保存起来 共享栈留给其他协程使用
+    if(m_sharedStack)
+        saveSharedStack();
+
 }
 
 //从目标代码序列切换到调度器/init协程
 void Coroutine::swapOut()
 {
     SetThis(Scheduler::GetMainCor());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainCor()->m_ctx) < 0)
+    if(!m_ctx.swapTo(Scheduler::GetMainCor()->m_ctx))
     {
-        KIT_LOG_ERROR(g_logger) << "swapOut: swapcontext error";
+        KIT_LOG_ERROR(g_logger) << "swapOut: swap context error";
 
-        KIT_ASSERT2(false, "swapcontext error");
+        KIT_ASSERT2(false, "swap context error");
     }
    
 }
@@ -206,15 +756,16 @@ void Coroutine::swapOut()
 //从init协程 切换到 目标代码
 void Coroutine::call()
 {
+    KIT_ASSERT2(!m_sharedStack, "shared stack coroutine can not use call");
 
     SetThis(this);
     m_state = State::EXEC;
     //应该是把当前创建调度器的那个协程的上下文拿出来运行
-    if(swapcontext(&init_cor_sp->m_ctx, &m_ctx) < 0)
+    if(!init_cor_sp->m_ctx.swapTo(m_ctx))
     {
-        KIT_LOG_ERROR(g_logger) << "call: swapcontext error";
+        KIT_LOG_ERROR(g_logger) << "call: swap context error";
 
-        KIT_ASSERT2(false, "swapcontext error");
+        KIT_ASSERT2(false, "swap context error");
     }
 
 }
@@ -223,15 +774,88 @@ void Coroutine::call()
 void Coroutine::back()
 {
     SetThis(init_cor_sp.get());
-    if(swapcontext(&m_ctx, &init_cor_sp->m_ctx) < 0)
+    if(!m_ctx.swapTo(init_cor_sp->m_ctx))
     {
-        KIT_LOG_ERROR(g_logger) << "back: swapcontext error";
+        KIT_LOG_ERROR(g_logger) << "back: swap context error";
+
+        KIT_ASSERT2(false, "swap context error");
+    }
+
+}
+
+
+//占用共享栈
+void Coroutine::acquireSharedStack()
+{
+    //保存的栈内容里有指向共享栈的地址 只能恢复到同一块共享栈上
+    pid_t tid = GetThreadId();
+    if(m_boundThread == -1)
+        m_boundThread = tid;
+    KIT_ASSERT2(m_boundThread == tid, "shared stack coroutine must resume on its bound thread");
 
-        KIT_ASSERT2(false, "swapcontext error");
+    if(!m_ctxReady)
+    {
+        //其他协程切出时都已经保存过 可以直接覆盖共享栈
+        if(!m_ctx.make(t_shared_stack.stack(), t_shared_stack.size(), &Coroutine::MainFunc))
+        {
+            KIT_LOG_ERROR(g_logger) << "acquireSharedStack: make context error";
+
+            KIT_ASSERT2(false, "make context error");
+        }
+        m_ctxReady = true;
+    }
+    else if(t_shared_stack.owner != m_id)   //共享栈被其他协程用过 恢复自己的栈内容
+    {
+        memcpy(t_shared_stack.top() - m_savedSize, m_savedStack, m_savedSize);
     }
 
+    t_shared_stack.owner = m_id;
 }
 
+//保存共享栈上用到的部分
+void Coroutine::saveSharedStack()
+{
+    //已经执行完毕 栈上的内容不再需要
+    if(m_state == State::TERM || m_state == State::EXCEPTION)
+    {
+        freeSavedStack();
+        t_shared_stack.owner = 0;
+        return;
+    }
+
+    char *top = t_shared_stack.top();
+    char *sp = (char *)m_ctx.stackPointer();
+    //拿不到栈顶指针 只能保存整个共享栈
+    if(!sp)
+        sp = t_shared_stack.stack();
+    size_t used = top - sp;
+
+    //按实际用量分配 用量大幅变小时也重新分配 把多余的内存还回去
+    if(m_savedCap < used || m_savedCap > used * 2)
+    {
+        freeSavedStack();
+        m_savedStack = (char *)malloc(used);
+        m_savedCap = used;
+        s_heap_stack_bytes += used;
+    }
+
+    memcpy(m_savedStack, sp, used);
+    m_savedSize = used;
+}
+
+//释放保存的栈内容
+void Coroutine::freeSavedStack()
+{
+    if(m_savedStack)
+    {
+        free(m_savedStack);
+        s_heap_stack_bytes -= m_savedCap;
+    }
+
+    m_savedStack = nullptr;
+    m_savedSize = 0;
+    m_savedCap = 0;
+}
 
 void Coroutine::Init()
 {
@@ -291,6 +915,14 @@ uint64_t Coroutine::TotalCoroutines()
     return s_cor_sum;
 }
 
+//获得当前总协程数以及协程栈驻留内存
+uint64_t Coroutine::TotalCoroutines(uint64_t& stack_resident)
+{
+    //malloc分配的栈按整块计算 mmap分配的栈只计算已经提交的页
+    stack_resident = s_heap_stack_bytes + s_mmap_allocator.residentBytes();
+    return s_cor_sum;
+}
+
 
 void Coroutine::MainFunc()
 {
@@ -1,14 +1,16 @@
 #ifndef _KIT_COUROUTINE_H_
 #define _KIT_COUROUTINE_H_
 
-#include <ucontext.h>
 #include <memory>
 #include <functional>
 #include "thread.h"
+#include "context.h"
 
 namespace kit_server
 {
 
+class StackAllocator;
+
 /**
  * @brief 协程类
  */
@@ -36,8 +38,10 @@ public:
      * @param[in] cb 指定的执行函数
      * @param[in] stack_size 协程栈空间大小
      * @param[in] use_call 是否作为调度协程使用
+     * @param[in] shared_stack 是否使用共享栈模式 运行时使用线程的共享栈 切出后只保存用到的部分
+     *                         共享栈协程第一次运行后就绑定在该线程上 不能和use_call同时使用
      */
-    Coroutine(std::function<void()> cb, size_t stack_size = 0, bool use_call = false);
+    Coroutine(std::function<void()> cb, size_t stack_size = 0, bool use_call = false, bool shared_stack = false);
 
     /**
      * @brief 协程类析构函数
@@ -88,6 +92,19 @@ public:
      */
     void setState(State state) {m_state = state;}
 
+    /**
+     * @brief 是否为共享栈协程
+     * @return true 
+     * @return false 
+     */
+    bool isSharedStack() const {return m_sharedStack;}
+
+    /**
+     * @brief 获取共享栈协程绑定的线程ID
+     * @return pid_t 还没运行过或者不是共享栈协程返回-1
+     */
+    pid_t getBoundThread() const {return m_boundThread;}
+
 public:
     /**
      * @brief 初始化母协程init
@@ -123,6 +140,13 @@ public:
      */
     static uint64_t TotalCoroutines();
 
+    /**
+     * @brief 获取当前线程上存在的协程总数 同时带回协程栈实际驻留的内存字节数
+     * @param[out] stack_resident 协程栈驻留内存字节数 mmap分配的栈只计算已经访问过的页
+     * @return uint64_t 
+     */
+    static uint64_t TotalCoroutines(uint64_t& stack_resident);
+
     /**
      * @brief 获取协程ID
      * @return uint64_t 
@@ -145,6 +169,21 @@ private:
      */
     static void CallMainFunc();
 
+    /**
+     * @brief 共享栈协程切入前占用线程的共享栈 必要时保存原占用者并恢复自己的栈内容
+     */
+    void acquireSharedStack();
+
+    /**
+     * @brief 把共享栈上已经使用的部分保存到堆上
+     */
+    void saveSharedStack();
+
+    /**
+     * @brief 释放保存栈内容的堆内存
+     */
+    void freeSavedStack();
+
 private:
     ///协程ID
     uint64_t m_id = 0;
@@ -153,9 +192,23 @@ private:
     ///协程状态
     State m_state = INIT;
     ///协程携带的程序上下文
-    ucontext_t m_ctx;
+    Context m_ctx;
     ///用户栈起始
     void *m_stack = nullptr;
+    ///分配用户栈的分配器 释放时必须使用同一个
+    StackAllocator* m_allocator = nullptr;
+    ///是否使用共享栈
+    bool m_sharedStack = false;
+    ///共享栈模式下上下文是否已经在共享栈上构造
+    bool m_ctxReady = false;
+    ///共享栈协程绑定的线程
+    pid_t m_boundThread = -1;
+    ///共享栈模式下切出时保存的栈内容
+    char *m_savedStack = nullptr;
+    ///保存的栈内容大小
+    size_t m_savedSize = 0;
+    ///保存栈内容的堆内存容量
+    size_t m_savedCap = 0;
     ///协程执行的回调函数
     std::function<void()> m_cb;
 
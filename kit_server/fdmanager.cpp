@@ -1,10 +1,14 @@
 #include "fdmanager.h"
 #include "Log.h"
 #include "hook.h"
+#include "macro.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h> 
+#include <stdlib.h>
+#include <sched.h>
+#include <new>
 
 namespace kit_server
 {
@@ -13,16 +17,9 @@ static Logger::ptr g_logger = KIT_LOG_NAME("system");
 /********************************FdCtx***************************************/
 
 FdCtx::FdCtx(int fd)
-    :m_isInit(false),
-     m_isSocket(false),
-     m_userNonblock(false),
-     m_sysNonblock(false),
-     m_isClosed(false),
-     m_fd(fd),
-     m_recvTimeout(-1),
-     m_sendTimeout(-1)
+    :m_fd(fd)
 {
-    init();
+    m_ioContext.fd = fd;
 }
 
 FdCtx::~FdCtx()
@@ -32,47 +29,41 @@ FdCtx::~FdCtx()
 //句柄初始化 判断是否是socket  是就设置为非阻塞
 bool FdCtx::init()
 {
-    //句柄初始化过了 就返回
-    if(m_isInit)
-        return true;
-    
+    uint32_t flags = VALID;
+
     //struct stat 获取当前系统文件句柄的状态
     struct stat fd_stat;
     if(fstat(m_fd, &fd_stat) < 0)
     {
-        m_isInit = false;
-        m_isSocket = false;
         KIT_LOG_ERROR(g_logger) << "FdCtx init(): fstat() error";
-
     }
     else
     {
-        m_isInit = true;
+        flags |= INIT;
         //取出状态位 判断句柄类型
-        m_isSocket = S_ISSOCK(fd_stat.st_mode);
+        if(S_ISSOCK(fd_stat.st_mode))
+            flags |= SOCKET;
     }
     
     //如果是socket 句柄 设置为非阻塞
-    if(m_isSocket)
+    if(flags & SOCKET)
     {
-        int flags = fcntl_f(m_fd, F_GETFL, 0);
+        int fl = fcntl_f(m_fd, F_GETFL, 0);
         //如果句柄阻塞 要设置为非阻塞
-        if(!(flags & O_NONBLOCK))
+        if(!(fl & O_NONBLOCK))
         {
-            fcntl_f(m_fd, F_SETFL, flags | O_NONBLOCK);
+            fcntl_f(m_fd, F_SETFL, fl | O_NONBLOCK);
         }
 
-        m_sysNonblock = true;
-    }
-    else
-    {
-        m_sysNonblock = false;
+        flags |= SYS_NONBLOCK;
     }
 
-    m_userNonblock = false;
-    m_isClosed = false;
+    m_recvTimeout = -1;
+    m_sendTimeout = -1;
+    //状态全部准备好之后再发布 其他线程看到VALID时状态一定完整
+    m_flags = flags;
     
-    return m_isInit;
+    return flags & INIT;
 
 }
 
@@ -100,55 +91,127 @@ uint64_t FdCtx::getTimeout(int type)
 
 FdManager::FdManager()
 {
-    m_fds.resize(64);
+    for(int i = 0;i < MAX_SEGMENTS;++i)
+        m_segments[i] = nullptr;
+}
+
+//获取句柄所在槽位
+FdCtx* FdManager::getSlot(int fd, bool auto_create)
+{
+    if(fd < 0 || fd >= MAX_SEGMENTS * SEGMENT_SIZE)
+        return nullptr;
+
+    std::atomic<FdCtx*>& segment = m_segments[fd >> SEGMENT_BITS];
+    FdCtx* slots = segment.load(std::memory_order_acquire);
+    if(KIT_LIKELY(slots))
+        return &slots[fd & (SEGMENT_SIZE - 1)];
+
+    if(!auto_create)
+        return nullptr;
+
+    //分配一整段 按缓存行对齐 多个线程同时分配时只有一个能放进去
+    void* mem = nullptr;
+    if(posix_memalign(&mem, alignof(FdCtx), sizeof(FdCtx) * SEGMENT_SIZE) != 0)
+    {
+        KIT_LOG_ERROR(g_logger) << "FdManager: alloc fd segment error, fd=" << fd;
+        return nullptr;
+    }
+
+    FdCtx* created = (FdCtx*)mem;
+    int base = fd & ~(SEGMENT_SIZE - 1);
+    for(int i = 0;i < SEGMENT_SIZE;++i)
+        new (&created[i]) FdCtx(base + i);
+
+    if(!segment.compare_exchange_strong(slots, created))
+    {
+        for(int i = 0;i < SEGMENT_SIZE;++i)
+            created[i].~FdCtx();
+        free(mem);
+    }
+    else
+    {
+        slots = created;
+    }
+
+    return &slots[fd & (SEGMENT_SIZE - 1)];
 }
 
 //获取句柄  不存在就创建
 FdCtx::ptr FdManager::get(int fd, bool auto_create)
 {
-    if(fd == -1)
+    FdCtx* ctx = getSlot(fd, auto_create);
+    if(!ctx)
         return nullptr;
-        
-    //加读锁
-    MutexType::ReadLock lock(m_mutex);
 
-    //如果fd越界说明容量不够 
-    if((int)m_fds.size() <= fd)
+    uint32_t flags = ctx->m_flags;
+    while(!(flags & FdCtx::VALID))
     {
         if(!auto_create)
             return nullptr;
 
-    }
-    else    //fd没有越界
-    {
-        if(m_fds[fd] || !auto_create)
-            return m_fds[fd];
+        //抢到初始化权的线程负责初始化 其他线程等它完成
+        if(!(flags & FdCtx::INITING))
+        {
+            if(ctx->m_flags.compare_exchange_weak(flags, FdCtx::INITING))
+            {
+                ctx->init();
+                break;
+            }
+            continue;
+        }
 
+        sched_yield();
+        flags = ctx->m_flags;
     }
-    lock.unlock();
 
-    //加写锁
-    MutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_fds.size())
-        m_fds.resize(fd * 1.5);
-
-    m_fds[fd] = ctx;
     return ctx;
     
 }
 
+//登记新的非阻塞socket句柄
+FdCtx::ptr FdManager::addSocket(int fd, bool user_nonblock)
+{
+    FdCtx* ctx = getSlot(fd, true);
+    if(!ctx)
+        return nullptr;
+
+    //句柄刚由内核返回 只有当前线程持有 直接覆盖槽位状态
+    uint32_t flags = FdCtx::VALID | FdCtx::INIT | FdCtx::SOCKET | FdCtx::SYS_NONBLOCK;
+    if(user_nonblock)
+        flags |= FdCtx::USER_NONBLOCK;
+
+    ctx->m_recvTimeout = -1;
+    ctx->m_sendTimeout = -1;
+    ctx->m_flags = flags;
+
+    return ctx;
+}
+
 //删除句柄
 void FdManager::del(int fd)
 {
-    MutexType::WriteLock lock(m_mutex);
-
-    if((int)m_fds.size() <= fd)
+    FdCtx* ctx = getSlot(fd, false);
+    if(!ctx)
         return;
 
-    m_fds[fd].reset();
+    //槽位保留 只清掉hook状态 还拿着槽位的协程会看到句柄已经关闭
+    ctx->m_flags = FdCtx::CLOSED;
 
 }
 
+//遍历已经分配的槽位
+void FdManager::foreach(const std::function<void(FdCtx*)>& cb)
+{
+    for(int i = 0;i < MAX_SEGMENTS;++i)
+    {
+        FdCtx* slots = m_segments[i].load(std::memory_order_acquire);
+        if(!slots)
+            continue;
 
-}
\ No newline at end of file
+        for(int j = 0;j < SEGMENT_SIZE;++j)
+            cb(&slots[j]);
+    }
+}
+
+
+}
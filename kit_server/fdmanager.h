@@ -7,6 +7,8 @@
 
 #include <memory>
 #include <vector>
+#include <atomic>
+#include <functional>
 
 
 namespace kit_server
@@ -14,12 +16,16 @@ namespace kit_server
 
 /**
  * @brief 文件句柄类
- * @details 管理文件句柄的类型、阻塞状态、关闭状态、读/写超时时间
+ * @details 管理文件句柄的类型、阻塞状态、关闭状态、读/写超时时间 以及IO调度器在句柄上注册的事件
+ *          对象是FdManager句柄表中的槽位 按缓存行对齐 地址固定 不会移动也不会释放 状态都可以无锁读取
  */
-class FdCtx: public std::enable_shared_from_this<FdCtx>
+class alignas(64) FdCtx
 {
+friend class FdManager;
+friend class IOManager;
 public:
-    typedef std::shared_ptr<FdCtx> ptr;
+    /// 槽位地址在进程内一直有效 直接使用裸指针
+    typedef FdCtx* ptr;
     
     /**
      * @brief 文件句柄类构造函数
@@ -37,48 +43,48 @@ public:
      * @return true 已经初始化
      * @return false 没有初始化
      */
-    bool isInit() const {return m_isInit;}
+    bool isInit() const {return m_flags & INIT;}
 
     /**
      * @brief 文件句柄是否是套接字socket类型
      * @return true 是socket
      * @return false 不是socket
      */
-    bool isSocket() const {return m_isSocket;}
+    bool isSocket() const {return m_flags & SOCKET;}
 
     /**
      * @brief 文件句柄是否已经关闭
      * @return true 已经关闭
      * @return false 没有关闭
      */
-    bool isClose() const {return m_isClosed;}
+    bool isClose() const {return m_flags & CLOSED;}
 
     //设定用户级 非阻塞状态
     /**
      * @brief 设定是否是用户设置非阻塞状态
      * @param[in] flag 
      */
-    void setUserNonblock(bool flag) {m_userNonblock = flag;}
+    void setUserNonblock(bool flag) {setFlag(USER_NONBLOCK, flag);}
 
     /**
      * @brief 获取是否是用户设置非阻塞状态
      * @return true 是
      * @return false 不是
      */
-    bool getUserNonblock() const {return m_userNonblock;}
+    bool getUserNonblock() const {return m_flags & USER_NONBLOCK;}
 
     /**
      * @brief 设置系统级 非阻塞状态
      * @param[in] flag 
      */
-    void setSysNonblock(bool flag) {m_sysNonblock = flag;}
+    void setSysNonblock(bool flag) {setFlag(SYS_NONBLOCK, flag);}
 
     /**
      * @brief 获取系统级 非阻塞状态
      * @return true 是
      * @return false 不是
      */
-    bool getSysNonblock() const {return m_sysNonblock;}
+    bool getSysNonblock() const {return m_flags & SYS_NONBLOCK;}
 
     /**
      * @brief 设置IO超时时间
@@ -101,6 +107,19 @@ public:
     int getFd() const {return m_fd;}
 
 private:
+    /**
+     * @brief 句柄状态位
+     */
+    enum Flag{
+        VALID = 0x1,            //句柄被hook管理
+        INITING = 0x2,          //正在初始化
+        INIT = 0x4,             //已经初始化
+        SOCKET = 0x8,           //是套接字socket类型
+        USER_NONBLOCK = 0x10,   //用户主动设置为非阻塞
+        SYS_NONBLOCK = 0x20,    //hook非阻塞
+        CLOSED = 0x40           //已经关闭
+    };
+
     /**
      * @brief 文件句柄初始化，如果为socket套接字句柄fd置为非阻塞
      * @return true 初始化成功
@@ -108,35 +127,40 @@ private:
      */
     bool init();
 
+    /**
+     * @brief 设置/清除状态位
+     * @param[in] flag 状态位
+     * @param[in] on 设置还是清除
+     */
+    void setFlag(Flag flag, bool on)
+    {
+        if(on)
+            m_flags.fetch_or(flag);
+        else
+            m_flags.fetch_and(~flag);
+    }
+
 private:
-    /*采用位域 来记录文件句柄上的一些状态*/
-    /// 是否初始化
-    bool m_isInit: 1;
-    /// 是否是套接字socket类型
-    bool m_isSocket: 1;
-    /// 是否是用户主动设置为非阻塞
-    bool m_userNonblock: 1;
-    /// 是否hook非阻塞
-    bool m_sysNonblock: 1;
-    /// 是否关闭
-    bool m_isClosed: 1;
+    /// 句柄状态位
+    std::atomic<uint32_t> m_flags = {0};
     /// 文件句柄
     int m_fd;
     /// 读超时时间
-    uint64_t m_recvTimeout = 0;
+    std::atomic<uint64_t> m_recvTimeout = {(uint64_t)-1};
     /// 写超时时间
-    uint64_t m_sendTimeout = 0;
+    std::atomic<uint64_t> m_sendTimeout = {(uint64_t)-1};
+    /// IO调度器在句柄上注册的事件
+    IOManager::FdContext m_ioContext;
 
 };
 
 /**
  * @brief 文件句柄管理类
+ * @details 句柄表分段分配 按句柄编号直接定位槽位 读取不加锁 扩容只追加新的段 已有槽位不会移动
  */
 class FdManager
 {
 public:
-    typedef RWMutex MutexType;
-
     /**
      * @brief 文件句柄管理类构造函数
      */
@@ -150,17 +174,43 @@ public:
      */
     FdCtx::ptr get(int fd, bool auto_create = false);
 
+    /**
+     * @brief 登记一个刚创建的非阻塞socket句柄 类型和阻塞状态已知 不用再fstat/fcntl
+     * @param[in] fd 用SOCK_NONBLOCK创建的socket句柄
+     * @param[in] user_nonblock 用户是否要求非阻塞
+     * @return FdCtx::ptr 句柄超出范围返回nullptr
+     */
+    FdCtx::ptr addSocket(int fd, bool user_nonblock);
+
     /**
      * @brief 删除文件句柄对象
      * @param fd 
      */
     void del(int fd);
 
+    /**
+     * @brief 获取句柄所在的槽位 不管句柄是否被hook管理
+     * @param[in] fd 文件句柄
+     * @param[in] auto_create 所在的段不存在时是否分配
+     * @return FdCtx* 句柄超出范围或者段不存在返回nullptr
+     */
+    FdCtx* getSlot(int fd, bool auto_create);
+
+    /**
+     * @brief 遍历所有已经分配的槽位
+     * @param[in] cb 对每个槽位执行的函数
+     */
+    void foreach(const std::function<void(FdCtx*)>& cb);
+
 private:
-    /// 读写锁
-    MutexType m_mutex;
-    /// 文件句柄对象队列
-    std::vector<FdCtx::ptr> m_fds;
+    /// 每段的槽位数
+    static const int SEGMENT_BITS = 10;
+    static const int SEGMENT_SIZE = 1 << SEGMENT_BITS;
+    /// 段数 总共可以管理2^20个句柄 和系统默认的nr_open上限一致
+    static const int MAX_SEGMENTS = 1024;
+
+    /// 句柄表的段 按需分配 分配后直到进程退出都不释放
+    std::atomic<FdCtx*> m_segments[MAX_SEGMENTS];
 
 };
 //置为单例
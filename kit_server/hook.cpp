@@ -5,6 +5,7 @@
 #include "fdmanager.h"
 #include "config.h"
 #include "macro.h"
+#include "io_uring.h"
 
 #include <sys/types.h>
 #include <dlfcn.h>
@@ -15,6 +16,7 @@
 #include <time.h>
 #include <errno.h>
 #include <string.h>
+#include <memory>
 
 
 
@@ -37,6 +39,7 @@ static ConfigVar<int>::ptr g_tcp_connect_timeout =
     XX(socket)\
     XX(connect)\
     XX(accept)\
+    XX(accept4)\
     XX(read)\
     XX(readv)\
     XX(recv)\
@@ -47,6 +50,7 @@ static ConfigVar<int>::ptr g_tcp_connect_timeout =
     XX(send)\
     XX(sendto)\
     XX(sendmsg)\
+    XX(sendfile)\
     XX(close)\
     XX(fcntl)\
     XX(ioctl)\
@@ -113,10 +117,32 @@ struct timer_info
 };
 
 
+//提交给io_uring的msghdr 放在堆上 由发起操作的hook函数持有到操作结束
+struct uring_msg
+{
+    struct msghdr msg;
+    struct iovec iov;
+};
+
+//按需创建 只有真正提交给io_uring时才分配
+static struct msghdr* make_uring_msg(std::unique_ptr<uring_msg>& holder)
+{
+    if(!holder)
+        holder.reset(new uring_msg);
+    memset(holder.get(), 0, sizeof(uring_msg));
+    return &holder->msg;
+}
+
+//IO操作是否能提交给io_uring 传nullptr的操作内核没有对应的opcode 只能等待poll
+template<class Prep>
+static bool has_prep(const Prep&) { return true; }
+static bool has_prep(std::nullptr_t) { return false; }
+
 //核心 用一个模板兼容我们要hook的IO操作函数
-template<class OriginFunc, typename... Args>
+//prep: io_uring后端下把IO操作直接提交给内核的填充函数 为nullptr时只用poll等待句柄可写/可读
+template<class OriginFunc, class Prep, typename... Args>
 static ssize_t do_io(int fd, OriginFunc func, const char *hook_func_name, 
-    uint32_t event, int timeout_so, Args&&... args)
+    uint32_t event, int timeout_so, Prep prep, Args&&... args)
 {
     if(!t_hook_enable)
         return func(fd, std::forward<Args>(args)...);
@@ -148,6 +174,9 @@ static ssize_t do_io(int fd, OriginFunc func, const char *hook_func_name,
     uint64_t timeout = ctx->getTimeout(timeout_so);
     //设置超时条件
     std::shared_ptr<timer_info> tinfo(new timer_info);
+    //io_uring后端下由内核完成IO操作 内核不能等待时(-EAGAIN)退回poll
+    //共享栈协程挂起时栈内容会被换出 内核拿到的栈上地址会失效 只能等待poll
+    bool use_op = has_prep(prep) && !Coroutine::GetThis()->isSharedStack();
 
 //重试标志位
 RETRY:
@@ -191,7 +220,46 @@ RETRY:
         }
 
 
-        /*b.为对应的fd添加异步回调 */
+        /*b.io_uring后端 直接提交IO操作 完成后协程被唤醒时已经拿到结果*/
+        if(iom->isUring() && use_op)
+        {
+            int res = 0;
+            if(KIT_UNLIKELY(iom->addOp(fd, (IOManager::Event)event, prep, &res) < 0))
+            {
+                KIT_LOG_ERROR(g_logger) <<  hook_func_name << " do_io: addOp("  << fd << "," << event << ")" << " error";
+                if(timer)
+                    timer->cancel();
+
+                return -1;
+            }
+
+            Coroutine::YieldToHold();
+
+            if(timer) 
+                timer->cancel();
+
+            //先看结果 超时和完成同时发生时数据已经被读走/写出 不能丢
+            if(res >= 0)
+                return res;
+
+            if(tinfo->canceled)
+            {
+                errno = tinfo->canceled;
+                return -1;
+            }
+
+            if(res == -EAGAIN)
+                use_op = false;
+            else if(res != -ECANCELED && res != -EINTR)
+            {
+                errno = -res;
+                return -1;
+            }
+
+            goto RETRY;
+        }
+
+        /*c.为对应的fd添加异步回调 */
         int ret = iom->addEvent(fd, (IOManager::Event)event);
         if(KIT_UNLIKELY(ret < 0))
         {
@@ -208,7 +276,7 @@ RETRY:
         }
 
 
-        /*c.挂起当前协程*/
+        /*d.挂起当前协程*/
         Coroutine::YieldToHold();
         /*切回来的两个时间点：
             1.IO没有数据到达，条件定时器超时强制唤醒 
@@ -263,9 +331,12 @@ unsigned int sleep(unsigned int secends)
     
     kit_server::Coroutine::ptr cor = kit_server::Coroutine::GetThis();
     kit_server::IOManager* iom = kit_server::IOManager::GetThis();
+    //普通调度器没有定时器 只能阻塞当前线程
+    if(!iom)
+        return sleep_f(secends);
 
     //bind 模板函数时候 需要把对应的参数类型设定好 默认参数也需要显示指定
-    iom->addTimer(secends * 1000, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int))&kit_server::IOManager::schedule, iom, cor, -1));
+    iom->addTimer(secends * 1000, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int, bool))&kit_server::IOManager::schedule, iom, cor, -1, false));
 
     // iom->addTimer(secends * 1000, [iom, cor](){
     //     iom->schedule(cor);
@@ -284,8 +355,11 @@ int usleep(useconds_t usec)
     
     kit_server::Coroutine::ptr cor = kit_server::Coroutine::GetThis();
     kit_server::IOManager* iom = kit_server::IOManager::GetThis();
+    //普通调度器没有定时器 只能阻塞当前线程
+    if(!iom)
+        return usleep_f(usec);
 
-    iom->addTimer(usec / 1000, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int))&kit_server::IOManager::schedule, iom, cor, -1));
+    iom->addTimer(usec / 1000, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int, bool))&kit_server::IOManager::schedule, iom, cor, -1, false));
 
     // iom->addTimer(usec / 1000, [iom, cor](){
     //     iom->schedule(cor);
@@ -304,6 +378,9 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
 
     kit_server::Coroutine::ptr cor = kit_server::Coroutine::GetThis();
     kit_server::IOManager* iom = kit_server::IOManager::GetThis();
+    //普通调度器没有定时器 只能阻塞当前线程
+    if(!iom)
+        return nanosleep_f(req, rem);
 
     uint64_t ms = 0;
     if(errno == EINTR)
@@ -314,7 +391,7 @@ int nanosleep(const struct timespec *req, struct timespec *rem)
     else 
         ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
 
-    iom->addTimer(ms, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int))&kit_server::IOManager::schedule, iom, cor, -1));
+    iom->addTimer(ms, std::bind((void(kit_server::Scheduler::*)(kit_server::Coroutine::ptr, int, bool))&kit_server::IOManager::schedule, iom, cor, -1, false));
 
     // iom->addTimer(ms, [iom, cor](){
     //     iom->schedule(cor);
@@ -335,12 +412,13 @@ int socket(int domain, int type, int protocol)
         return socket_f(domain, type, protocol);
 
     KIT_LOG_DEBUG(g_logger) << "hook socket start";
-    int fd = socket_f(domain, type, protocol);
+    //创建时就设为非阻塞 用户要求的SOCK_NONBLOCK只记录为用户级非阻塞
+    int fd = socket_f(domain, type | SOCK_NONBLOCK, protocol);
     if(fd < 0)
         return fd;
     
-    //由FdManager创建一个fd
-    kit_server::FdMgr::GetInstance()->get(fd, true);
+    //由FdManager登记fd 已知是非阻塞socket 不用再fstat/fcntl
+    kit_server::FdMgr::GetInstance()->addSocket(fd, type & SOCK_NONBLOCK);
 
     return fd;
     
@@ -461,7 +539,12 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen)
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 {
     int fd = do_io(sockfd, accept_f, "accept", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, addr, addrlen);
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)addr;
+            sqe->addr2 = (uint64_t)(uintptr_t)addrlen;
+        }, addr, addrlen);
 
     if(fd >= 0)
     {
@@ -473,6 +556,29 @@ int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen)
 }
 
 
+//accept4
+int accept4(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags)
+{
+    //和socket()一样 新句柄在内核层面总是非阻塞的
+    int sys_flags = kit_server::t_hook_enable ? flags | SOCK_NONBLOCK : flags;
+    int fd = do_io(sockfd, accept4_f, "accept4", kit_server::IOManager::Event::READ, 
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_ACCEPT;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)addr;
+            sqe->addr2 = (uint64_t)(uintptr_t)addrlen;
+            sqe->accept_flags = sys_flags;
+        }, addr, addrlen, sys_flags);
+
+    if(fd >= 0 && kit_server::t_hook_enable)
+    {
+        kit_server::FdMgr::GetInstance()->addSocket(fd, flags & SOCK_NONBLOCK);
+    }
+
+    return fd;
+}
+
+
 //close 要做一些清理工作
 int close(int fd)
 {
@@ -672,22 +778,45 @@ int setsockopt(int sockfd, int level, int optname, const void *optval, socklen_t
 ssize_t read(int fd, void *buf, size_t count)
 {
     return do_io(fd, read_f, "read", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, buf, count);
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            //只有socket会走到这里 IORING_OP_READ在非阻塞句柄上不会等待 用RECV代替
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)buf;
+            sqe->len = count;
+        }, buf, count);
 }
 
 
 //readv
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt)
 {
+    //内核在操作进行中才读取msghdr 放在堆上 协程等到操作结束才会返回
+    std::unique_ptr<kit_server::uring_msg> holder;
+
     return do_io(fd, readv_f, "readv", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, iov, iovcnt);
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            struct msghdr* msg = kit_server::make_uring_msg(holder);
+            msg->msg_iov = (struct iovec *)iov;
+            msg->msg_iovlen = iovcnt;
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+        }, iov, iovcnt);
 }
 
 //recv
 ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 {
     return do_io(sockfd, recv_f, "recv", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, buf, len, flags);
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)buf;
+            sqe->len = len;
+            sqe->msg_flags = flags;
+        }, buf, len, flags);
 }
 
 
@@ -695,15 +824,50 @@ ssize_t recv(int sockfd, void *buf, size_t len, int flags)
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, 
     struct sockaddr *src_addr, socklen_t *addrlen)
 {
-    return do_io(sockfd, recvfrom_f, "recvfrom", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    std::unique_ptr<kit_server::uring_msg> holder;
+
+    ssize_t n = do_io(sockfd, recvfrom_f, "recvfrom", kit_server::IOManager::Event::READ, 
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            struct msghdr* msg = kit_server::make_uring_msg(holder);
+            holder->iov.iov_base = buf;
+            holder->iov.iov_len = len;
+            msg->msg_iov = &holder->iov;
+            msg->msg_iovlen = 1;
+            msg->msg_name = src_addr;
+            msg->msg_namelen = addrlen ? *addrlen : 0;
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = flags;
+        }, buf, len, flags, src_addr, addrlen);
+
+    //由io_uring完成时 地址长度在msghdr里
+    if(n >= 0 && holder && addrlen)
+        *addrlen = holder->msg.msg_namelen;
+
+    return n;
 }  
 
 //recvmsg
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 {
     return do_io(sockfd, recvmsg_f, "recvmsg", kit_server::IOManager::Event::READ, 
-        SO_RCVTIMEO, msg, flags);
+        SO_RCVTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_RECVMSG;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = flags;
+        }, msg, flags);
+}
+
+//sendfile
+//io_uring没有sendfile操作 发送缓冲区满时挂起协程等待socket可写
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+    return do_io(out_fd, sendfile_f, "sendfile", kit_server::IOManager::Event::WRITE, 
+        SO_SNDTIMEO, nullptr, in_fd, offset, count);
 }
 
 /***********************************write***********************************/
@@ -711,37 +875,79 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags)
 ssize_t write(int fd, const void *buf, size_t count)
 {
     return do_io(fd, write_f, "write", kit_server::IOManager::Event::WRITE, 
-        SO_SNDTIMEO, buf, count);
+        SO_SNDTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)buf;
+            sqe->len = count;
+        }, buf, count);
 }
 
 
 //writev
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
 {
+    std::unique_ptr<kit_server::uring_msg> holder;
+
     return do_io(fd, writev_f, "writev", kit_server::IOManager::Event::WRITE, 
-        SO_SNDTIMEO, iov, iovcnt);
+        SO_SNDTIMEO, [&](struct io_uring_sqe* sqe){
+            struct msghdr* msg = kit_server::make_uring_msg(holder);
+            msg->msg_iov = (struct iovec *)iov;
+            msg->msg_iovlen = iovcnt;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = fd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+        }, iov, iovcnt);
 }
 
 //send
 ssize_t send(int sockfd, const void *buf, size_t len, int flags)
 {
     return do_io(sockfd, send_f, "send", kit_server::IOManager::Event::WRITE, 
-        SO_SNDTIMEO, buf, len, flags);
+        SO_SNDTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)buf;
+            sqe->len = len;
+            sqe->msg_flags = flags;
+        }, buf, len, flags);
 }
 
 //sendto
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
     const struct sockaddr *dest_addr, socklen_t addrlen)
 {
+    std::unique_ptr<kit_server::uring_msg> holder;
+
     return do_io(sockfd, sendto_f, "sendto", kit_server::IOManager::Event::WRITE, 
-        SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+        SO_SNDTIMEO, [&](struct io_uring_sqe* sqe){
+            struct msghdr* msg = kit_server::make_uring_msg(holder);
+            holder->iov.iov_base = (void *)buf;
+            holder->iov.iov_len = len;
+            msg->msg_iov = &holder->iov;
+            msg->msg_iovlen = 1;
+            msg->msg_name = (void *)dest_addr;
+            msg->msg_namelen = addrlen;
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = flags;
+        }, buf, len, flags, dest_addr, addrlen);
 }
  
 //sendmsg
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags)
 {
     return do_io(sockfd, sendmsg_f, "sendmsg", kit_server::IOManager::Event::WRITE, 
-        SO_SNDTIMEO, msg, flags);
+        SO_SNDTIMEO, [&](struct io_uring_sqe* sqe){
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = sockfd;
+            sqe->addr = (uint64_t)(uintptr_t)msg;
+            sqe->len = 1;
+            sqe->msg_flags = flags;
+        }, msg, flags);
 }
 
 
@@ -9,6 +9,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 
@@ -58,6 +59,10 @@ extern connect_func connect_f;
 typedef int (*accept_func)(int sockfd, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_func accept_f;
 
+//accept4
+typedef int (*accept4_func)(int sockfd, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_func accept4_f;
+
 //close
 typedef int (*close_func)(int fd);
 extern close_func close_f;
@@ -125,6 +130,10 @@ extern sendto_func sendto_f;
 typedef ssize_t (*sendmsg_func)(int sockfd, const struct msghdr *msg, int flags);
 extern sendmsg_func sendmsg_f;
 
+//sendfile
+typedef ssize_t (*sendfile_func)(int out_fd, int in_fd, off_t *offset, size_t count);
+extern sendfile_func sendfile_f;
+
 }
 
 
@@ -1,6 +1,9 @@
 #include "http.h"
 #include "../Log.h"
 
+#include <ctype.h>
+#include <strings.h>
+
 namespace kit_server
 {
 namespace http
@@ -75,6 +78,18 @@ bool CaseInsensitiveLess::operator()(const std::string& lhs, const std::string&
     return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
 }
 
+//不区分大小写的FNV-1a哈希
+size_t CaseInsensitiveHash(const char* s, size_t len)
+{
+    size_t h = 14695981039346656037ULL;
+    for(size_t i = 0;i < len;++i)
+    {
+        h ^= (unsigned char)tolower(s[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
 /****************************************HttpRequest**************************************/
 HttpRequest::HttpRequest(uint8_t version, bool close)
     :m_method(HttpMethod::GET)
@@ -88,22 +103,42 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
 static Logger::ptr g_logger = KIT_LOG_NAME("system");
 void HttpRequest::setHeader(const std::string& key, const std::string& val)
 {
+    detachHeaders();
     m_headers[key] = val;
 }
 
 std::string HttpRequest::getHeadr(const std::string& key, const std::string& def) const
 {
+    if(m_headerViews.size())
+    {
+        StringView v = getHeaderView(key.c_str());
+        return v.valid() ? v.str() : def;
+    }
+
     auto it = m_headers.find(key);
     return it == m_headers.end() ? def : it->second;
 }
 
 void HttpRequest::delHeader(const std::string& key)
 {
+    detachHeaders();
     m_headers.erase(key);
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string * val)
 {
+    if(m_headerViews.size())
+    {
+        StringView v = getHeaderView(key.c_str());
+        if(!v.valid())
+            return false;
+
+        if(val)
+            *val = v.str();
+
+        return true;
+    }
+
     auto it = m_headers.find(key);
     if(it == m_headers.end())
         return false;
@@ -179,13 +214,17 @@ std::ostream& HttpRequest::dump(std::ostream& os) const
     //实体
     
     //请求行封装
-    os << HttpMethodToString(m_method) << " "
-        << m_path
-        << (m_query.size() ? "?" : "")
-        << m_query
-        << (m_fragment.size() ? "#" : "")
-        << m_fragment
-        << " HTTP/"
+    StringView path = getPathView();
+    StringView query = getQueryView();
+    StringView fragment = m_fragmentView.valid() ? m_fragmentView : StringView(m_fragment.c_str(), m_fragment.size());
+
+    os << HttpMethodToString(m_method) << " ";
+    os.write(path.data, path.len);
+    if(query.len)
+        os.put('?').write(query.data, query.len);
+    if(fragment.len)
+        os.put('#').write(fragment.data, fragment.len);
+    os << " HTTP/"
         << ((uint32_t)(m_version >> 4))     //把低4位移走 只保留高4位
         << "."
         << ((uint32_t)(m_version & 0x0F))   //把高4位置0  只保留低4位
@@ -204,6 +243,14 @@ std::ostream& HttpRequest::dump(std::ostream& os) const
         os << x.first << ":" << x.second << "\r\n";
     }
 
+    for(auto &x : m_headerViews)
+    {
+        if(x.key.len == 10 && strncasecmp(x.key.data, "connection", 10) == 0)
+            continue;
+
+        os.write(x.key.data, x.key.len).put(':').write(x.value.data, x.value.len) << "\r\n";
+    }
+
 
     //报文实体封装
     if(m_body.size())
@@ -227,14 +274,98 @@ std::string HttpRequest::toString() const
 
 void HttpRequest::init()
 {
-    std::string connection = getHeadr("connection");
-    if(connection.size())
+    StringView connection;
+    if(m_headerViews.size())
+    {
+        connection = getHeaderView("connection");
+    }
+    else
+    {
+        auto it = m_headers.find("connection");
+        if(it != m_headers.end())
+            connection = StringView(it->second.c_str(), it->second.size());
+    }
+
+    if(connection.len)
     {
-        if(strcasecmp(connection.c_str(), "keep-alive") == 0)
+        if(connection.len == 10 && strncasecmp(connection.data, "keep-alive", 10) == 0)
             m_close = false;
         else
             m_close = true;
     }
+    else
+    {
+        //HTTP/1.1默认是长连接 流水线客户端(wrk --pipeline)一般不带Connection字段
+        m_close = m_version < 0x11;
+    }
+}
+
+//添加指向接收缓冲区的首部字段
+void HttpRequest::addHeaderView(const char* key, size_t klen, const char* val, size_t vlen)
+{
+    //一般请求的首部字段不超过16个 一次分配够
+    if(m_headerViews.empty())
+        m_headerViews.reserve(16);
+
+    HeaderView v;
+    v.key = StringView(key, klen);
+    v.value = StringView(val, vlen);
+    v.hash = CaseInsensitiveHash(key, klen);
+    m_headerViews.push_back(v);
+}
+
+StringView HttpRequest::getPathView() const
+{
+    return m_pathView.valid() ? m_pathView : StringView(m_path.c_str(), m_path.size());
+}
+
+StringView HttpRequest::getQueryView() const
+{
+    return m_queryView.valid() ? m_queryView : StringView(m_query.c_str(), m_query.size());
+}
+
+//查找首部字段 先比较哈希值再比较字符
+StringView HttpRequest::getHeaderView(const char* key) const
+{
+    if(m_headerViews.empty())
+    {
+        auto it = m_headers.find(key);
+        return it == m_headers.end() ? StringView() : StringView(it->second.c_str(), it->second.size());
+    }
+
+    //重复的字段以最后一个为准 和首部字段组一致
+    size_t len = strlen(key);
+    size_t hash = CaseInsensitiveHash(key, len);
+    for(auto it = m_headerViews.rbegin();it != m_headerViews.rend();++it)
+    {
+        if(it->hash == hash && it->key.len == len && strncasecmp(it->key.data, key, len) == 0)
+            return it->value;
+    }
+
+    return StringView();
+}
+
+bool HttpRequest::isView() const
+{
+    return m_pathView.valid() || m_queryView.valid() || m_fragmentView.valid() || m_headerViews.size();
+}
+
+//把视图都拷贝出来
+void HttpRequest::detach()
+{
+    OwnView(m_pathView, m_path);
+    OwnView(m_queryView, m_query);
+    OwnView(m_fragmentView, m_fragment);
+    detachHeaders();
+}
+
+void HttpRequest::detachHeaders() const
+{
+    for(auto &x : m_headerViews)
+        m_headers[x.key.str()] = x.value.str();
+
+    //swap把内存也还回去
+    std::vector<HeaderView>().swap(m_headerViews);
 }
 
 std::ostream& operator<<(std::ostream& os, const HttpRequest& req)
@@ -273,41 +404,70 @@ void HttpResponse::delHeader(const std::string& key)
 
 //报文封装
 std::ostream& HttpResponse::dump(std::ostream& os) const
+{
+    std::string header;
+    serializeHeader(header);
+    return os << header << getBody();
+}
+
+//十进制整数直接追加到字符串后面
+static void AppendUInt(std::string& out, uint64_t v)
+{
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    do
+    {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+
+    out.append(p, buf + sizeof(buf) - p);
+}
+
+//响应行和首部封装
+void HttpResponse::serializeHeader(std::string& out, bool with_length) const
 {
     // HTTP/1.1 200 OK
 
     //响应行封装
-    os << "HTTP/"
-        << ((uint32_t)(m_version >> 4))
-        << "."
-        << ((uint32_t)(m_version & 0x0F))
-        << " "
-        << (uint32_t)m_status
-        << " "
-        << (m_reason.size() ? m_reason : HttpStatusToString(m_status))
-        << "\r\n";
-
+    out.append("HTTP/");
+    out.push_back('0' + (m_version >> 4));
+    out.push_back('.');
+    out.push_back('0' + (m_version & 0x0F));
+    out.push_back(' ');
+    AppendUInt(out, (uint32_t)m_status);
+    out.push_back(' ');
+    if(m_reason.size())
+        out.append(m_reason);
+    else
+        out.append(HttpStatusToString(m_status));
+    out.append("\r\n");
 
     //响应首部封装
     for(auto &x : m_headers)
     {
         if(strcasecmp(x.first.c_str(), "connection") == 0)
             continue;
-        os << x.first << ":" << x.second << "\r\n";
+        out.append(x.first).push_back(':');
+        out.append(x.second).append("\r\n");
     }
 
     //单独封装连接状态
-    os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
-
-    //报文主体封装
-    if(m_body.size())
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-            << m_body;
-    else
-        os << "\r\n";
-    
-    return os;
-    
+    out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
+
+    //报文主体长度 主体本身不在这里
+    //长连接上空主体也要写content-length: 0 否则客户端不知道主体在哪结束
+    //1xx/204/304不能带主体 服务自己设置了长度的(比如HEAD请求)不再重复写
+    const std::string& body = getBody();
+    uint32_t status = (uint32_t)m_status;
+    if(with_length && status >= 200 && status != 204 && status != 304
+        && (body.size() || m_headers.find("content-length") == m_headers.end()))
+    {
+        out.append("content-length: ");
+        AppendUInt(out, body.size());
+        out.append("\r\n");
+    }
+    out.append("\r\n");
 }
 
 std::string HttpResponse::toString() const
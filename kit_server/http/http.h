@@ -5,6 +5,7 @@
 #include <string>
 #include <string.h>
 #include <map>
+#include <vector>
 #include <iostream>
 #include <boost/lexical_cast.hpp>
 #include <stdint.h>
@@ -180,6 +181,36 @@ struct CaseInsensitiveLess
     bool operator()(const std::string& lhs, const std::string& rhs) const;
 };
 
+/**
+ * @brief 指向一段字符的视图 只保存指针和长度 不拥有内存
+ */
+struct StringView
+{
+    StringView(): data(nullptr), len(0) {}
+    StringView(const char* d, size_t l): data(d), len(l) {}
+
+    /**
+     * @brief 是否指向了一段字符 长度为0的字段也算
+     */
+    bool valid() const {return data != nullptr;}
+
+    /**
+     * @brief 拷贝成std::string
+     */
+    std::string str() const {return std::string(data, len);}
+
+    const char* data;
+    size_t len;
+};
+
+/**
+ * @brief 不区分大小写计算一段字符的哈希值
+ * @param[in] s 字符
+ * @param[in] len 长度
+ * @return size_t 
+ */
+size_t CaseInsensitiveHash(const char* s, size_t len);
+
 
 /**
  * @brief 用于对存储字段的map容器进行查询和获取以及类型转换
@@ -289,37 +320,41 @@ public:
      * @brief 设置资源路径
      * @param[in] s 具体资源路径
      */
-    void setPath(const std::string& s) {m_path = s;}
+    void setPath(const std::string& s) {m_pathView = StringView(); m_path = s;}
 
     /**
      * @brief 获取资源路径
+     * @details 路径还指向接收缓冲区时 会先拷贝到mutable成员中再返回 虽然是const也会修改请求
+     *          同一个请求不能在多个线程中同时调用 只读不拷贝用getPathView()
      * @return const std::string& 
      */
-    const std::string& getPath() const {return m_path;}
+    const std::string& getPath() const {return OwnView(m_pathView, m_path);}
 
     /**
      * @brief 设置查询字符串
      * @param[in] s 具体查询字符串
      */
-    void setQuery(const std::string& s) {m_query = s;}
+    void setQuery(const std::string& s) {m_queryView = StringView(); m_query = s;}
 
     /**
      * @brief 获取查询字符串 
+     * @details 和getPath()一样会把视图拷贝到mutable成员中 只读不拷贝用getQueryView()
      * @return const std::string& 
      */
-    const std::string& getQuery() const {return m_query;}
+    const std::string& getQuery() const {return OwnView(m_queryView, m_query);}
 
     /**
      * @brief 设置片段标识符
      * @param[in] s 具体片段标识 
      */
-    void setFragment(const std::string& s) {m_fragment = s;}
+    void setFragment(const std::string& s) {m_fragmentView = StringView(); m_fragment = s;}
 
     /**
      * @brief 获取片段标识符
+     * @details 和getPath()一样会把视图拷贝到mutable成员中
      * @return const std::string& 
      */
-    const std::string& getFragment() const {return m_fragment;}
+    const std::string& getFragment() const {return OwnView(m_fragmentView, m_fragment);}
 
     /**
      * @brief 设置报文主体
@@ -337,13 +372,15 @@ public:
      * @brief 设置报文首部字段组
      * @param[in] v 具体map容器 
      */
-    void setHeaders(const MapType& v) {m_headers = v;}
+    void setHeaders(const MapType& v) {m_headerViews.clear(); m_headers = v;}
 
     /**
-     * @brief 获取报文首部字段组
+     * @brief 获取报文首部字段组 首部还是视图时先拷贝出来
+     * @details 拷贝会修改mutable成员 虽然是const 同一个请求不能在多个线程中同时调用
+     *          之后首部字段都不再指向接收缓冲区 只查个别字段用getHeaderView()
      * @return const MapType& 
      */
-    const MapType& getHeaders() const {return m_headers;}
+    const MapType& getHeaders() const {detachHeaders(); return m_headers;}
 
     /**
      * @brief 设置参数组
@@ -412,7 +449,25 @@ public:
     template<class T>
     bool checkGetHeaderAs(const std::string& key, T& val, const T& def = T())
     {
-        return checkGetAs(m_headers, key, val, def);
+        if(m_headerViews.empty())
+            return checkGetAs(m_headers, key, val, def);
+
+        val = def;
+        StringView v = getHeaderView(key.c_str());
+        if(!v.valid())
+            return false;
+
+        try
+        {
+            val = boost::lexical_cast<T>(v.data, v.len);
+            return true;
+        }
+        catch(...)
+        {
+            val = def;
+        }
+
+        return false;
     }
 
     /**
@@ -425,7 +480,9 @@ public:
     template<class T>
     T GetHeaderAs(const std::string& key, const T& def = T())
     {
-        return getAs(m_headers, key, def);
+        T val;
+        checkGetHeaderAs(key, val, def);
+        return val;
     }
 
     /**
@@ -497,8 +554,90 @@ public:
      */
     std::string toString() const;
 
+    /**
+     * @brief 解析完成后根据Connection字段和协议版本确定是否长连接
+     */
     void init();
 
+    /*零拷贝解析 路径、查询参数、首部字段直接指向接收缓冲区*/
+    void setPathView(const char* s, size_t len) {m_pathView = StringView(s, len);}
+    void setQueryView(const char* s, size_t len) {m_queryView = StringView(s, len);}
+    void setFragmentView(const char* s, size_t len) {m_fragmentView = StringView(s, len);}
+
+    /**
+     * @brief 添加一个指向接收缓冲区的首部字段
+     * @param[in] key 字段名
+     * @param[in] klen 字段名长度
+     * @param[in] val 字段值
+     * @param[in] vlen 字段值长度
+     */
+    void addHeaderView(const char* key, size_t klen, const char* val, size_t vlen);
+
+    /**
+     * @brief 获取资源路径 不拷贝
+     * @return StringView 
+     */
+    StringView getPathView() const;
+
+    /**
+     * @brief 获取查询字符串 不拷贝
+     * @return StringView 
+     */
+    StringView getQueryView() const;
+
+    /**
+     * @brief 查找首部字段 不拷贝
+     * @param[in] key 字段名 不区分大小写
+     * @return StringView 字段不存在时valid()为false
+     */
+    StringView getHeaderView(const char* key) const;
+
+    /**
+     * @brief 请求中是否还有指向接收缓冲区的字段
+     * @return true 有 请求只在下次HttpSession::recvRequest()之前有效
+     * @return false 没有 请求的数据都是自己的
+     */
+    bool isView() const;
+
+    /**
+     * @brief 把指向接收缓冲区的字段都拷贝出来
+     * @details 要在会话收下一个请求之后继续使用请求时 必须先调用
+     */
+    void detach();
+
+private:
+    /**
+     * @brief 字段还是视图时拷贝到对应的字符串中 之后都用字符串
+     * @param[in] view 字段视图
+     * @param[in] s 对应的字符串
+     * @return const std::string& 
+     */
+    static const std::string& OwnView(StringView& view, std::string& s)
+    {
+        if(view.valid())
+        {
+            s.assign(view.data, view.len);
+            view = StringView();
+        }
+        return s;
+    }
+
+    /**
+     * @brief 把首部字段视图拷贝到首部字段组中
+     */
+    void detachHeaders() const;
+
+    /**
+     * @brief 指向接收缓冲区的首部字段
+     */
+    struct HeaderView
+    {
+        StringView key;
+        StringView value;
+        //不区分大小写的哈希值 查找时先比较它
+        size_t hash;
+    };
+
 private:
     //请求方法
     HttpMethod m_method;
@@ -507,19 +646,25 @@ private:
     //是否处于长连接
     bool m_close;
 
-    /*URI 资源定位符*/
+    /*URI 资源定位符 视图拷贝成字符串不算修改请求 所以是mutable*/
     //资源路径
-    std::string m_path;
+    mutable std::string m_path;
     //查询字符串
-    std::string m_query;
+    mutable std::string m_query;
     //片段标识
-    std::string m_fragment;
+    mutable std::string m_fragment;
+    //指向接收缓冲区的资源路径/查询字符串/片段标识 拷贝之后置空
+    mutable StringView m_pathView;
+    mutable StringView m_queryView;
+    mutable StringView m_fragmentView;
 
     //报文主体
     std::string m_body;
 
     //首部字段
-    std::map<std::string, std::string, CaseInsensitiveLess> m_headers;
+    mutable std::map<std::string, std::string, CaseInsensitiveLess> m_headers;
+    //指向接收缓冲区的首部字段 和m_headers不会同时有数据
+    mutable std::vector<HeaderView> m_headerViews;
     //参数字段
     std::map<std::string, std::string, CaseInsensitiveLess> m_params;
     //cookie字段
@@ -570,13 +715,25 @@ public:
      * @brief 设置响应报文主体
      * @param[in] v 具体报文内容
      */
-    void setBody(const std::string& v) {m_body = v;}
+    void setBody(const std::string& v) {m_sharedBody.reset(); m_body = v;}
+
+    /**
+     * @brief 设置响应报文主体 移动进来 不拷贝
+     * @param[in] v 具体报文内容
+     */
+    void setBody(std::string&& v) {m_sharedBody.reset(); m_body = std::move(v);}
+
+    /**
+     * @brief 设置共享的响应报文主体 多个响应共用同一块数据 发送时也不拷贝
+     * @param[in] v 报文内容 发出之前不能修改
+     */
+    void setSharedBody(std::shared_ptr<const std::string> v) {m_body.clear(); m_sharedBody = v;}
 
     /**
      * @brief 获取响应报文主体
      * @return const std::string& 
      */
-    const std::string& getBody() const {return m_body;}
+    const std::string& getBody() const {return m_sharedBody ? *m_sharedBody : m_body;}
 
     /**
      * @brief 设置响应原因短语
@@ -654,6 +811,13 @@ public:
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 将响应行和首部追加到out后面 不经过ostream 报文主体不拷贝 由调用者和首部一起发出
+     * @param[out] out 首部缓冲区
+     * @param[in] with_length 是否按报文主体补上content-length 空主体补0 1xx/204/304除外 流式发送时由首部字段自己决定
+     */
+    void serializeHeader(std::string& out, bool with_length = true) const;
+
     /**
      * @brief 将HTTP响应报文以字符串形式输出
      * @return std::string 
@@ -670,6 +834,8 @@ private:
 
     //响应报文主体
     std::string m_body;
+    //共享的响应报文主体 设置了就用它
+    std::shared_ptr<const std::string> m_sharedBody;
     //响应状态原因短语
     std::string m_reason;
     //响应首部字段
@@ -2,6 +2,7 @@
 #include "http_parser.h"
 
 #include <errno.h>
+#include <atomic>
 
 namespace kit_server
 {
@@ -10,6 +11,11 @@ namespace http
 
 static Logger::ptr g_logger = KIT_LOG_NAME("system");
 
+//所有连接接收缓冲区分配的次数
+static std::atomic<uint64_t> s_buffer_alloc_count = {0};
+//所有连接收到的响应数
+static std::atomic<uint64_t> s_response_count = {0};
+
 
 std::string HttpResult::toString() const
 {
@@ -42,16 +48,18 @@ HttpConnection:: ~HttpConnection()
 //收到HTTP响应报文
 HttpResponse::ptr HttpConnection::recvResponse()
 {
-    HttpResponseParser::ptr parser(new HttpResponseParser);
-    //使用某一时刻的值即可 不需要实时的值
-    uint64_t buff_size = HttpResponseParser::GetHttpResponseBufferSize();
-
-    //创建一个接受响应报文的缓冲区 指定析构
-    std::shared_ptr<char> buffer(new char[buff_size + 1], [](char *ptr){
-        delete[] ptr;
-    }); 
+    //解析器和接收缓冲区属于连接 连接池复用连接时一起复用
+    HttpResponseParser* parser = &m_parser;
+    parser->reset();
+    if(m_buffer.empty())
+    {
+        //使用某一时刻的值即可 不需要实时的值 多留一个字节放'\0'
+        m_buffer.resize(HttpResponseParser::GetHttpResponseBufferSize() + 1);
+        ++s_buffer_alloc_count;
+    }
 
-    char *data = buffer.get();
+    uint64_t buff_size = m_buffer.size() - 1;
+    char *data = &m_buffer[0];
     int offset = 0;
     
     //一边读一遍解析
@@ -88,16 +96,23 @@ HttpResponse::ptr HttpConnection::recvResponse()
 
         
         offset = ret - n;
-        if(offset == (int)buff_size)
-        {
-            KIT_LOG_WARN(g_logger) << "HttpConnection::recvResponse http response buffer out of  range";
-            close();
-            return nullptr;
-        }
 
         //如果解析已经结束
         if(parser->isFinished())
             break;
+
+        //缓冲区满了首部还没收全 扩大缓冲区 已经到上限就放弃
+        if(offset == (int)buff_size)
+        {
+            if(!growBuffer())
+            {
+                KIT_LOG_WARN(g_logger) << "HttpConnection::recvResponse http response buffer out of  range";
+                close();
+                return nullptr;
+            }
+            buff_size = m_buffer.size() - 1;
+            data = &m_buffer[0];
+        }
     
     }
 
@@ -230,7 +245,7 @@ HttpResponse::ptr HttpConnection::recvResponse()
             //设置一个循环继续接收报文实体
             if(len > 0)
             {
-                if(readFixSize(&body[real_len], real_len) <= 0)
+                if(readFixSize(&body[real_len], len) <= 0)
                 {
                     KIT_LOG_ERROR(g_logger) << "HttpConnection::recvResponse readFixSize error, errno=" << errno
                         << ", is:" << strerror(errno);
@@ -243,10 +258,47 @@ HttpResponse::ptr HttpConnection::recvResponse()
             parser->getData()->setBody(body);
         }
     }
+
+    shrinkBuffer();
+    ++s_response_count;
     
     return parser->getData();
 }
 
+//扩大接收缓冲区
+bool HttpConnection::growBuffer()
+{
+    size_t max_size = HttpResponseParser::GetHttpResponseMaxHeaderSize() + 1;
+    if(m_buffer.size() >= max_size)
+        return false;
+
+    m_buffer.resize(std::min((m_buffer.size() - 1) * 2 + 1, max_size));
+    ++s_buffer_alloc_count;
+    return true;
+}
+
+//还原接收缓冲区大小
+void HttpConnection::shrinkBuffer()
+{
+    size_t default_size = HttpResponseParser::GetHttpResponseBufferSize() + 1;
+    if(m_buffer.size() <= default_size)
+        return;
+
+    //响应之间不会留下数据 直接换一块默认大小的
+    std::vector<char>(default_size).swap(m_buffer);
+    ++s_buffer_alloc_count;
+}
+
+uint64_t HttpConnection::GetBufferAllocCount()
+{
+    return s_buffer_alloc_count;
+}
+
+uint64_t HttpConnection::GetResponseCount()
+{
+    return s_response_count;
+}
+
 //发送HTTP请求报文
 int HttpConnection::sendRequest(HttpRequest::ptr rsp)
 {
@@ -5,10 +5,12 @@
 #include <memory>
 #include <list>
 #include <atomic>
+#include <vector>
 
 #include "../stream.h"
 #include "../socket_stream.h"
 #include "http.h"
+#include "http_parser.h"
 #include "../uri.h"
 #include "../mutex.h"
 
@@ -214,11 +216,40 @@ public:
      */
     static HttpResult::ptr DoRequest(HttpRequest::ptr req, Uri::ptr uri, uint64_t timeout_ms);
 
+    /**
+     * @brief 获取所有连接接收缓冲区分配的次数 和GetResponseCount()对比可以看出每个响应的分配次数
+     * @return uint64_t 
+     */
+    static uint64_t GetBufferAllocCount();
+
+    /**
+     * @brief 获取所有连接收到的响应数
+     * @return uint64_t 
+     */
+    static uint64_t GetResponseCount();
+
+private:
+    /**
+     * @brief 缓冲区放满了首部还没收全时 把接收缓冲区扩大一倍 不超过首部最大长度
+     * @return true 扩大成功
+     * @return false 已经到上限
+     */
+    bool growBuffer();
+
+    /**
+     * @brief 接收缓冲区被超长的响应撑大之后 还原到默认大小
+     */
+    void shrinkBuffer();
+
 private:
     //连接创建时间
     uint64_t m_createTime;
     //连接上的请求数
     uint64_t m_requestCount;
+    //响应解析器 每个响应开始解析时重置
+    HttpResponseParser m_parser;
+    //接收缓冲区 跨响应保留
+    std::vector<char> m_buffer;
 
 };
 
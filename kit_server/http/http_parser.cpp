@@ -24,23 +24,38 @@ static ConfigVar<uint64_t>::ptr g_http_request_buffer_size =
     Config::LookUp("http.request.buffer_size", (uint64_t)(4 * 1024), "http request buffer size");
 
 
+//首部超过缓冲区时 缓冲区翻倍增长 最大不超过这个值 默认16KB
+static ConfigVar<uint64_t>::ptr g_http_request_max_header_size = 
+    Config::LookUp("http.request.max_header_size", (uint64_t)(16 * 1024), "http request max header size");
+
 //使用一个配置项 规定一个报文实体数据长度阈值默认64MB 
 static ConfigVar<uint64_t>::ptr g_http_request_max_body_size = 
     Config::LookUp("http.request.max_body_size", (uint64_t)(64 *1024 * 1024), "http request max body size");
 
+//报文实体超过这个长度(或者是chunked)时不读进内存 由servlet流式读取 默认64KB
+static ConfigVar<uint64_t>::ptr g_http_request_stream_body_size = 
+    Config::LookUp("http.request.stream_body_size", (uint64_t)(64 * 1024), "http request stream body size");
+
 //使用一个配置项 规定一个首部字段数据长度阈值默认4KB  来规避大数据发包攻击 
 static ConfigVar<uint64_t>::ptr g_http_response_buffer_size = 
     Config::LookUp("http.response.buffer_size", (uint64_t)(4 * 1024), "http response buffer size");
 
 
+//首部超过缓冲区时 缓冲区翻倍增长 最大不超过这个值 默认16KB
+static ConfigVar<uint64_t>::ptr g_http_response_max_header_size = 
+    Config::LookUp("http.response.max_header_size", (uint64_t)(16 * 1024), "http response max header size");
+
 //使用一个配置项 规定一个报文实体数据长度阈值默认64MB 
 static ConfigVar<uint64_t>::ptr g_http_response_max_body_size = 
     Config::LookUp("http.response.max_body_size", (uint64_t)(64 *1024 * 1024), "http response max body size");
 
 
 static uint64_t s_http_request_buffer_size = 0;
+static uint64_t s_http_request_max_header_size = 0;
 static uint64_t s_http_request_max_body_size = 0;
+static uint64_t s_http_request_stream_body_size = 0;
 static uint64_t s_http_response_buffer_size = 0;
+static uint64_t s_http_response_max_header_size = 0;
 static uint64_t s_http_response_max_body_size = 0;
 
 
@@ -52,9 +67,12 @@ struct _RequestSizeIniter
     _RequestSizeIniter()
     {
         s_http_request_buffer_size = g_http_request_buffer_size->getValue();
+        s_http_request_max_header_size = g_http_request_max_header_size->getValue();
         s_http_request_max_body_size = g_http_request_max_body_size->getValue();
+        s_http_request_stream_body_size = g_http_request_stream_body_size->getValue();
 
         s_http_response_buffer_size = g_http_response_buffer_size->getValue();
+        s_http_response_max_header_size = g_http_response_max_header_size->getValue();
         s_http_response_max_body_size = g_http_response_max_body_size->getValue();
 
         g_http_request_buffer_size->addListener([](const uint64_t &old_value, const uint64_t &new_value){
@@ -76,6 +94,21 @@ struct _RequestSizeIniter
 
             s_http_request_max_body_size = new_value;
         });
+
+        g_http_request_max_header_size->addListener([](const uint64_t &old_value, const uint64_t &new_value){
+
+            s_http_request_max_header_size = new_value;
+        });
+
+        g_http_request_stream_body_size->addListener([](const uint64_t &old_value, const uint64_t &new_value){
+
+            s_http_request_stream_body_size = new_value;
+        });
+
+        g_http_response_max_header_size->addListener([](const uint64_t &old_value, const uint64_t &new_value){
+
+            s_http_response_max_header_size = new_value;
+        });
     }
 };
 static _RequestSizeIniter _initer;
@@ -120,7 +153,10 @@ void on_request_fragment(void *data, const char *at, size_t length)
 {
     //拿到this指针
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getData()->setFragment(std::string(at, length));
+    if(parser->isZeroCopy())
+        parser->getData()->setFragmentView(at, length);
+    else
+        parser->getData()->setFragment(std::string(at, length));
 }
 
 /**
@@ -130,7 +166,10 @@ void on_request_path(void *data, const char *at, size_t length)
 {
     //拿到this指针
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getData()->setPath(std::string(at, length));
+    if(parser->isZeroCopy())
+        parser->getData()->setPathView(at, length);
+    else
+        parser->getData()->setPath(std::string(at, length));
 }
 
 /**
@@ -140,7 +179,10 @@ void on_request_query_string(void *data, const char *at, size_t length)
 {
     //拿到this指针
     HttpRequestParser* parser = static_cast<HttpRequestParser*>(data);
-    parser->getData()->setQuery(std::string(at, length));
+    if(parser->isZeroCopy())
+        parser->getData()->setQueryView(at, length);
+    else
+        parser->getData()->setQuery(std::string(at, length));
 }
 
 /**
@@ -194,7 +236,10 @@ void on_request_http_field(void *data, const char *field, size_t flen, const cha
         return;
     }
 
-    parser->getData()->setHeader(std::string(field, flen), std::string(value, vlen));
+    if(parser->isZeroCopy())
+        parser->getData()->addHeaderView(field, flen, value, vlen);
+    else
+        parser->getData()->setHeader(std::string(field, flen), std::string(value, vlen));
 }
 
 /**************************************response回调************************************/
@@ -283,6 +328,7 @@ void on_response_http_field(void *data, const char *field, size_t flen, const ch
 /*************************************HttpRequestParser********************************/
 HttpRequestParser::HttpRequestParser()
     :m_error(0)
+    ,m_zeroCopy(false)
 {
     m_request.reset(new HttpRequest);
     // 调用初始化API
@@ -301,6 +347,8 @@ HttpRequestParser::HttpRequestParser()
 //执行解析动作 核心  1:解析成功 -1:解析有问题  >0已经处理的字节数 且data有效数据为len - v
 size_t HttpRequestParser::execute(char* data, size_t len)
 {
+    //解析过的数据会被挪走 不能指向它
+    m_zeroCopy = false;
     size_t ret = http_parser_execute(&m_parser, data, len, 0);
 
     //先将解析过的空间挪走 防止缓存不够 但是仍然有数据位解析完成的情况
@@ -311,6 +359,31 @@ size_t HttpRequestParser::execute(char* data, size_t len)
 
 }
 
+//从报文开头解析首部
+size_t HttpRequestParser::parse(const char* data, size_t len)
+{
+    return parse(data, len, 0);
+}
+
+//接着上一次的位置继续解析首部
+size_t HttpRequestParser::parse(const char* data, size_t len, size_t off)
+{
+    if(!off)
+        reset();
+    //数据不会被挪动 请求直接指向它
+    m_zeroCopy = true;
+    //每次执行只返回本次解析的字节数
+    return off + http_parser_execute(&m_parser, data, len, off);
+}
+
+//重置解析器
+void HttpRequestParser::reset()
+{
+    http_parser_init(&m_parser);
+    m_error = 0;
+    m_request.reset(new HttpRequest);
+}
+
 //解析是否结束
 int HttpRequestParser::isFinished()
 {
@@ -335,11 +408,21 @@ uint64_t HttpRequestParser::GetHttpRequestBufferSize()
     return s_http_request_buffer_size;
 }
 
+uint64_t HttpRequestParser::GetHttpRequestMaxHeaderSize()
+{
+    return s_http_request_max_header_size;
+}
+
 uint64_t HttpRequestParser::GetHttpMaxBodySize()
 {
     return s_http_request_max_body_size;
 }
 
+uint64_t HttpRequestParser::GetHttpRequestStreamBodySize()
+{
+    return s_http_request_stream_body_size;
+}
+
 
 /*************************************HttpResponseParser********************************/
 
@@ -376,6 +459,14 @@ size_t HttpResponseParser::execute(char* data, size_t len, bool chunck)
     return ret;
 }
 
+//重置解析器
+void HttpResponseParser::reset()
+{
+    httpclient_parser_init(&m_parser);
+    m_error = 0;
+    m_response.reset(new HttpResponse);
+}
+
 //解析是否结束
 int HttpResponseParser::isFinished()
 {
@@ -400,6 +491,11 @@ uint64_t HttpResponseParser::GetHttpResponseBufferSize()
     return s_http_response_buffer_size;
 }
 
+uint64_t HttpResponseParser::GetHttpResponseMaxHeaderSize()
+{
+    return s_http_response_max_header_size;
+}
+
 uint64_t HttpResponseParser::GetHttpMaxBodySize()
 {
     return s_http_response_max_body_size;
@@ -34,6 +34,33 @@ public:
      */
     size_t execute(char* data, size_t len);
 
+    /**
+     * @brief 从报文开头解析首部 不挪动数据 首部没有收全时带上新收到的数据重新调用
+     * @details 解析器会先重置 首部被拆在多次读取中时不会丢掉读到一半的字段
+     *          得到的请求中路径、查询参数、首部字段直接指向data 不拷贝 data要比请求活得久或者调用HttpRequest::detach()
+     * @param[in] data 从报文开头开始的数据
+     * @param[in] len 数据长度
+     * @return size_t 解析完成时为首部长度
+     */
+    size_t parse(const char* data, size_t len);
+
+    /**
+     * @brief 接着上一次parse()停下的位置继续解析首部 避免首部被拆成多次读取时每次都从头解析
+     * @details data必须和上一次是同一块没有挪动过的缓冲区 已经得到的字段还指向它
+     *          上一次交给解析器的数据必须以完整的一行结束 解析器在行首不会记着读到一半的字段
+     *          off为0时等同于parse(data, len)
+     * @param[in] data 从报文开头开始的数据
+     * @param[in] len 数据长度
+     * @param[in] off 上一次已经解析到的位置
+     * @return size_t 已经解析过的总字节数 解析完成时为首部长度
+     */
+    size_t parse(const char* data, size_t len, size_t off);
+
+    /**
+     * @brief 重置解析器 开始解析一个新的报文
+     */
+    void reset();
+
     /**
      * @brief 报文解析是否结束
      * @return int 
@@ -58,6 +85,13 @@ public:
      */
     void setError(int v) {m_error = v;}
 
+    /**
+     * @brief 当前是否是零拷贝解析(parse()) 回调中据此决定拷贝字段还是只记录位置
+     * @return true 是
+     * @return false 不是
+     */
+    bool isZeroCopy() const {return m_zeroCopy;}
+
     /**
      * @brief 获取报文主体字段"content-length"中的长度 并转换为uint64_t
      * @return uint64_t 
@@ -77,12 +111,24 @@ public:
      */
     static uint64_t GetHttpRequestBufferSize();
 
+    /**
+     * @brief 获取请求报文首部最大长度 接收缓冲区最多增长到这个大小
+     * @return uint64_t 
+     */
+    static uint64_t GetHttpRequestMaxHeaderSize();
+
     /**
      * @brief 获取请求报文主体最大大小
      * @return uint64_t 
      */
     static uint64_t GetHttpMaxBodySize();
 
+    /**
+     * @brief 获取流式读取请求报文主体的阈值 主体超过它时不读进内存
+     * @return uint64_t 
+     */
+    static uint64_t GetHttpRequestStreamBodySize();
+
 
 private:
     //解析请求报文的结构体
@@ -93,6 +139,8 @@ private:
     //1001: invalid version
     //1002: invalid field
     int m_error;    //错误码
+    //是否零拷贝解析
+    bool m_zeroCopy;
 };
 
 std::ostream& operator<<(std::ostream& os, const HttpRequestParser& req);
@@ -120,6 +168,11 @@ public:
      */
     size_t execute(char* data, size_t len, bool chunck);
 
+    /**
+     * @brief 重置解析器 开始解析一个新的报文
+     */
+    void reset();
+
     /**
      * @brief 报文解析是否结束
      * @return int 
@@ -165,6 +218,12 @@ public:
      */
     static uint64_t GetHttpResponseBufferSize();
 
+    /**
+     * @brief 获取响应报文首部最大长度 接收缓冲区最多增长到这个大小
+     * @return uint64_t 
+     */
+    static uint64_t GetHttpResponseMaxHeaderSize();
+
     /**
      * @brief 获取响应报文主体最大大小
      * @return uint64_t 
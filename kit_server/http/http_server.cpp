@@ -44,9 +44,20 @@ void HttpServer::handleClient(Socket::ptr client)
 
         // rsp->setBody(std::string("hello kit!"));
 
-        session->sendResponse(rsp);
+        bool close = !m_isKeepalive || rsp->isClose();
+        if(session->isResponseStarted())
+        {
+            //servlet流式发送了响应 补上结尾 响应不完整时连接不能再用
+            if(session->endResponse() < 0)
+                close = true;
+        }
+        else
+        {
+            //流水线中后面的请求已经在缓冲区里 响应先攒着 等要读socket时一次写出
+            session->sendResponse(rsp, close || !session->hasBufferedRequest());
+        }
 
-        if(!m_isKeepalive || req->isClose())
+        if(close)
             break;
 
     } while (1);
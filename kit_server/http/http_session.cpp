@@ -2,6 +2,13 @@
 #include "http_parser.h"
 
 #include <errno.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <atomic>
 
 namespace kit_server
 {
@@ -10,6 +17,26 @@ namespace http
 
 static Logger::ptr g_logger = KIT_LOG_NAME("system");
 
+//所有会话接收缓冲区分配的次数
+static std::atomic<uint64_t> s_buffer_alloc_count = {0};
+//所有会话收到的请求数
+static std::atomic<uint64_t> s_request_count = {0};
+
+//流式读取主体时 首部后面至少留出的缓冲区空间
+static const size_t MIN_BODY_BUFFER_SIZE = 1024;
+
+//Transfer-Encoding中是否有chunked
+static bool IsChunked(HttpRequest::ptr req)
+{
+    StringView v = req->getHeaderView("transfer-encoding");
+    for(size_t i = 0;i + 7 <= v.len;++i)
+    {
+        if(strncasecmp(v.data + i, "chunked", 7) == 0)
+            return true;
+    }
+    return false;
+}
+
 
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
     :SocketStream(sock, owner)
@@ -21,128 +48,687 @@ HttpSession::HttpSession(Socket::ptr sock, bool owner)
 //收到HTTP请求报文
 HttpRequest::ptr HttpSession::recvRequest()
 {
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    //使用某一时刻的值即可 不需要实时的值
-    uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    // uint64_t buff_size = 300;
-    // uint64_t buff_size = 100;
-    //创建一个接受请求报文的缓冲区 指定析构
-    std::shared_ptr<char> buffer(new char[buff_size], [](char *ptr){
-        delete[] ptr;
-    }); 
-
-    char *data = buffer.get();
-    int offset = 0;
+    //接收缓冲区在会话第一次收请求时创建 之后一直保留 流水线中读多的请求留在里面
+    if(m_buffer.empty())
+    {
+        //使用某一时刻的值即可 不需要实时的值
+        m_buffer.resize(HttpRequestParser::GetHttpRequestBufferSize());
+        ++s_buffer_alloc_count;
+    }
+
+    //上一个请求的报文主体servlet没有读完 先丢掉
+    if(m_bodyMode != BODY_NONE && !discardBody())
+    {
+        close();
+        return nullptr;
+    }
+    m_rspState = RSP_NONE;
+
+    //上一个请求指向缓冲区的字段到这里失效 把剩下的字节挪到缓冲区开头
+    if(m_bufferStart > 0)
+    {
+        memmove(&m_buffer[0], &m_buffer[m_bufferStart], m_bufferLen);
+        m_bufferStart = 0;
+    }
+    m_headerEnd = 0;
+    shrinkBuffer();
+
+    //上一个请求剩下的字节 先解析它们
+    size_t offset = m_bufferLen;
+    m_bufferLen = 0;
+    
+    //有剩下的字节时先解析一次 不够再读
+    bool parse_first = offset > 0;
     
+    //首部之后第一个字节的位置
+    size_t pos = 0;
+    //已经交给解析器的完整行的末尾 首部被拆开时从这里接着解析
+    size_t parsed = 0;
+
     //一边读一遍解析
     while(1)
     {
-        int ret = read(data + offset, buff_size - offset);
-        if(ret <= 0)
+        //缓冲区扩大后地址会变 每次重新取
+        char *data = &m_buffer[0];
+        if(!parse_first)
         {
-            KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest read error, errno=" << errno
-                << ", is:" << strerror(errno);
-            close();
-            return nullptr;
+            //要等socket数据了 客户端可能在等之前的响应 先发出去
+            if(!m_pending.empty() && flush() <= 0)
+            {
+                close();
+                return nullptr;
+            }
+
+            int ret = read(data + offset, m_buffer.size() - offset);
+            if(ret <= 0)
+            {
+                KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest read error, errno=" << errno
+                    << ", is:" << strerror(errno);
+                close();
+                return nullptr;
+            }
+            offset += ret;
         }
+        parse_first = false;
 
-       //KIT_LOG_DEBUG(g_logger) << "读取的原始数据, size=" << strlen(data) << "\n" << data;
+        //只把完整的行交给解析器 读到一半的字段等下一次连同新数据一起解析
+        //首部里的换行只会出现在行尾 首部之后的换行会在解析结束时停下
+        const char* line_end = (const char*)memrchr(data + parsed, '\n', offset - parsed);
+        if(line_end)
+        {
+            size_t end = line_end - data + 1;
+            //'<'和'@'开头的socket报文字段可以跨行 只能从头解析
+            bool resume = data[0] != '<' && data[0] != '@';
+            size_t n = m_parser.parse(data, end, resume ? parsed : 0);
 
-        ret += offset;
+            if(m_parser.hasError())
+            {   
+                KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest parser error";
+                close();
+                return nullptr;
+            }
 
-        size_t n = parser->execute(data, ret);
-        //KIT_LOG_DEBUG(g_logger) << "解析后的数据:\n" <<  data;
-        // KIT_LOG_DEBUG(g_logger) << "execute n= " << n
-        // << ",has error=" << parser->hasError()
-        // << ",is finished=" << parser->isFinished()
-        // << ", total len=" << ret
-        // << ", content length=" << parser->getContenLength()
-        // << ", data=\n" << parser->getData()->toString(); 
+            //如果解析已经结束 首部留在缓冲区里 请求直接指向它 后面是报文实体和后面的请求
+            if(m_parser.isFinished())
+            {
+                pos = n;
+                offset -= n;
+                break;
+            }
 
-        if(parser->hasError())
-        {   
-            KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest parser error";
-            close();
-            return nullptr;
+            parsed = end;
         }
 
-        
-        offset = ret - n;
-        if(offset == (int)buff_size)
+        //缓冲区满了首部还没收全 扩大缓冲区 已经到上限就放弃
+        if(offset == m_buffer.size())
         {
-            KIT_LOG_WARN(g_logger) << "HttpConnection::recvRequest http request buffer out of  range";
-            close();
-            return nullptr;
-        }
+            if(!growBuffer())
+            {
+                KIT_LOG_WARN(g_logger) << "HttpConnection::recvRequest http request buffer out of  range";
+                close();
+                return nullptr;
+            }
 
-        //如果解析已经结束
-        if(parser->isFinished())
-            break;
-    
+            //已经得到的字段指向旧的缓冲区 从头重新解析
+            parsed = 0;
+        }
     }
 
-    KIT_LOG_DEBUG(g_logger) << "已经解析得到的报文:" << parser->getData()->toString();
+    HttpRequest::ptr req = m_parser.getData();
+    KIT_LOG_DEBUG(g_logger) << "已经解析得到的报文:" << req->toString();
 
     //获取实体长度
-    int64_t len = parser->getContentLength();
+    uint64_t len = m_parser.getContentLength();
+    bool chunked = IsChunked(req);
+    if(!chunked && len > HttpRequestParser::GetHttpMaxBodySize())
+    {
+        KIT_LOG_WARN(g_logger) << "HttpSession::recvRequest http request body too large, content-length=" << len;
+        close();
+        return nullptr;
+    }
 
-    //将报文实体读出 并且设置到HttpRequest对象中去
-    if(len > 0)
+    if(chunked || len > HttpRequestParser::GetHttpRequestStreamBodySize())
     {
+        //报文主体留给servlet流式读取 首部后面要留出空间放读到的数据
+        if(m_buffer.size() - pos < MIN_BODY_BUFFER_SIZE)
+        {
+            m_buffer.resize(pos + HttpRequestParser::GetHttpRequestBufferSize());
+            ++s_buffer_alloc_count;
+            //缓冲区换了地址 重新解析一遍首部 让请求指向新的缓冲区
+            m_parser.parse(&m_buffer[0], pos);
+            req = m_parser.getData();
+        }
+
+        m_bodyMode = chunked ? BODY_CHUNKED : BODY_LENGTH;
+        m_bodyLeft = chunked ? 0 : len;
+        m_bodyRead = 0;
+        m_chunkState = CHUNK_SIZE;
+        m_chunkHasSize = false;
+    }
+    else if(len > 0)
+    {
+        //将报文实体读出 并且设置到HttpRequest对象中去
         std::string body;
         body.resize(len);
 
+        //这里offset 就是报文首部解析完之后 缓冲区中剩余的字节数 可能还包含后面的请求
+        size_t real_len = std::min((uint64_t)offset, len);
+        memcpy(&body[0], &m_buffer[pos], real_len);
+        pos += real_len;
+        offset -= real_len;
 
-        int real_len = 0;
+        //如果还有剩余的报文实体长度 说明报文实体没有在本次传输中全部被接收
+        if(len > real_len)
+        {
+            if(readFixSize(&body[real_len], len - real_len) <= 0)
+            {
+                KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest readFixSize error, errno=" << errno
+                    << ", is:" << strerror(errno);
+                close();
+                return nullptr;
+            }
+        }
+
+        //等到报文实体完整之后 装入对象之中 
+        req->setBody(body);
+    }
+    req->init();
+
+    //留给报文主体和下一个请求
+    m_headerEnd = pos;
+    m_bufferStart = pos;
+    m_bufferLen = offset;
+    ++s_request_count;
+    
+    return req;
+}
 
-        //这里offset 就是报文首部解析完之后 剩余的报文实体的字节数
-        if(len >= offset)
+//读取请求报文主体
+int HttpSession::readBody(void* buffer, size_t len)
+{
+    if(m_bodyMode == BODY_NONE || len == 0)
+        return 0;
+
+    if(m_bodyMode == BODY_LENGTH)
+    {
+        size_t want = std::min((uint64_t)len, m_bodyLeft);
+        int ret = 0;
+        //先取缓冲区中已经读到的 没有了直接从socket读到调用者的内存
+        if(m_bufferLen > 0)
         {
-            memcpy(&body[0], data, offset);
-            //body.append(data, offset);
-            real_len = offset;
+            ret = std::min(want, m_bufferLen);
+            memcpy(buffer, &m_buffer[m_bufferStart], ret);
+            m_bufferStart += ret;
+            m_bufferLen -= ret;
         }
         else
         {
-            memcpy(&body[0], data, len);
-            // body.append(data, len);
-            real_len = len;
+            if(!m_pending.empty() && flush() <= 0)
+                return -1;
 
+            ret = read(buffer, want);
+            if(ret <= 0)
+            {
+                KIT_LOG_ERROR(g_logger) << "HttpSession::readBody read error, errno=" << errno
+                    << ", is:" << strerror(errno);
+                return -1;
+            }
         }
 
+        m_bodyLeft -= ret;
+        if(m_bodyLeft == 0)
+            m_bodyMode = BODY_NONE;
+        return ret;
+    }
 
-        len -= offset;
-        //如果还有剩余的报文实体长度 说明报文实体没有在本次传输中全部被接收
-        //设置一个循环继续接收报文实体
-        if(len > 0)
+    //chunked 解码出数据或者读到结尾才返回
+    char* out = (char*)buffer;
+    size_t w = 0;
+    while(w == 0 && m_bodyMode == BODY_CHUNKED)
+    {
+        if(m_bufferLen == 0 && fillBuffer() <= 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "HttpSession::readBody read error, errno=" << errno
+                << ", is:" << strerror(errno);
+            return -1;
+        }
+
+        const char* p = &m_buffer[m_bufferStart];
+        size_t n = m_bufferLen;
+        size_t i = 0;
+        while(i < n && w < len && m_bodyMode == BODY_CHUNKED)
         {
-            if(readFixSize(&body[real_len], real_len) <= 0)
+            char c;
+            switch(m_chunkState)
             {
-                KIT_LOG_ERROR(g_logger) << "HttpSession::recvRequest readFixSize error, errno=" << errno
-                    << ", is:" << strerror(errno);
-                close();
-                return nullptr;
+            case CHUNK_SIZE:
+                c = p[i++];
+                if(isxdigit(c))
+                {
+                    if(m_bodyLeft >> 60)
+                        return -1;
+                    m_bodyLeft = m_bodyLeft * 16 + (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+                    m_chunkHasSize = true;
+                }
+                //至少要有一位十六进制数字 行尾必须是CRLF
+                else if(m_chunkHasSize && (c == ';' || c == ' ' || c == '\t'))
+                {
+                    m_chunkState = CHUNK_EXT;
+                }
+                else if(m_chunkHasSize && c == '\r')
+                {
+                    m_chunkState = CHUNK_SIZE_LF;
+                }
+                else
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk size";
+                    return -1;
+                }
+                break;
+            case CHUNK_EXT:
+                c = p[i++];
+                if(c == '\r')
+                {
+                    m_chunkState = CHUNK_SIZE_LF;
+                }
+                else if(c == '\n')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk extension";
+                    return -1;
+                }
+                break;
+            case CHUNK_SIZE_LF:
+                if(p[i++] != '\n')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk size line end";
+                    return -1;
+                }
+                m_chunkState = CHUNK_DATA;
+                break;
+            case CHUNK_DATA:
+            {
+                size_t k = std::min((uint64_t)std::min(n - i, len - w), m_bodyLeft);
+                memcpy(out + w, p + i, k);
+                i += k;
+                w += k;
+                m_bodyLeft -= k;
+                m_bodyRead += k;
+                if(m_bodyRead > HttpRequestParser::GetHttpMaxBodySize())
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody http request body too large";
+                    return -1;
+                }
+                if(m_bodyLeft == 0)
+                    m_chunkState = CHUNK_DATA_END;
+                break;
+            }
+            case CHUNK_DATA_END:
+                if(p[i++] != '\r')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk end";
+                    return -1;
+                }
+                m_chunkState = CHUNK_DATA_LF;
+                break;
+            case CHUNK_DATA_LF:
+                if(p[i++] != '\n')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk end";
+                    return -1;
+                }
+                m_chunkState = CHUNK_SIZE;
+                m_chunkHasSize = false;
+                break;
+            case CHUNK_TRAILER:
+                c = p[i++];
+                if(c == '\r')
+                {
+                    m_chunkState = CHUNK_TRAILER_LF;
+                }
+                else if(c == '\n')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk trailer";
+                    return -1;
+                }
+                else
+                {
+                    m_chunkLineEmpty = false;
+                }
+                break;
+            case CHUNK_TRAILER_LF:
+                if(p[i++] != '\n')
+                {
+                    KIT_LOG_WARN(g_logger) << "HttpSession::readBody invalid chunk trailer";
+                    return -1;
+                }
+                //空行 主体结束
+                if(m_chunkLineEmpty)
+                    m_bodyMode = BODY_NONE;
+                m_chunkLineEmpty = true;
+                m_chunkState = CHUNK_TRAILER;
+                break;
+            }
+
+            //长度为0的块是最后一块 后面是trailer
+            if(m_chunkState == CHUNK_DATA && m_bodyLeft == 0)
+            {
+                m_chunkState = CHUNK_TRAILER;
+                m_chunkLineEmpty = true;
             }
         }
 
-        //等到报文实体完整之后 装入对象之中 
-        parser->getData()->setBody(body);
+        m_bufferStart += i;
+        m_bufferLen -= i;
     }
-    parser->getData()->init();
-    
-    return parser->getData();
+
+    return w;
+}
+
+//丢掉没读的请求报文主体
+bool HttpSession::discardBody()
+{
+    char buffer[4096];
+    while(m_bodyMode != BODY_NONE)
+    {
+        if(readBody(buffer, sizeof(buffer)) < 0)
+        {
+            m_bodyMode = BODY_NONE;
+            return false;
+        }
+    }
+    return true;
+}
+
+//从socket读到首部后面
+int HttpSession::fillBuffer()
+{
+    //客户端可能在等之前的响应 先发出去
+    if(!m_pending.empty() && flush() <= 0)
+        return -1;
+
+    m_bufferStart = m_headerEnd;
+    int ret = read(&m_buffer[m_headerEnd], m_buffer.size() - m_headerEnd);
+    if(ret > 0)
+        m_bufferLen = ret;
+    return ret;
+}
+
+//扩大接收缓冲区
+bool HttpSession::growBuffer()
+{
+    size_t max_size = HttpRequestParser::GetHttpRequestMaxHeaderSize();
+    if(m_buffer.size() >= max_size)
+        return false;
+
+    m_buffer.resize(std::min(m_buffer.size() * 2, max_size));
+    ++s_buffer_alloc_count;
+    return true;
+}
+
+//还原接收缓冲区大小
+void HttpSession::shrinkBuffer()
+{
+    size_t default_size = HttpRequestParser::GetHttpRequestBufferSize();
+    //剩下的字节放不进默认大小时 等下一个请求处理完再还原 调用时剩下的字节已经在缓冲区开头
+    if(m_buffer.size() <= default_size || m_bufferLen > default_size)
+        return;
+
+    std::vector<char> buffer(m_buffer.begin(), m_buffer.begin() + m_bufferLen);
+    buffer.resize(default_size);
+    m_buffer.swap(buffer);
+    ++s_buffer_alloc_count;
 }
 
 //发回HTTP响应报文
-int HttpSession::sendResponse(HttpResponse::ptr rsp)
+int HttpSession::sendResponse(HttpResponse::ptr rsp, bool flush)
+{
+    //首部直接写进会话的首部缓冲区 报文主体只记下来 发送时和首部一起writev
+    PendingResponse pending;
+    pending.offset = m_output.size();
+    rsp->serializeHeader(m_output);
+    pending.len = m_output.size() - pending.offset;
+    pending.rsp = rsp;
+    m_pending.push_back(pending);
+
+    //流水线的响应先攒起来 一次写出
+    if(!flush)
+        return m_output.size();
+
+    return this->flush();
+}
+
+//发出攒下的响应
+int HttpSession::flush()
+{
+    if(m_pending.empty())
+        return 0;
+
+    m_iovs.clear();
+    appendPending();
+    return sendIovs();
+}
+
+//开始流式发送响应
+int HttpSession::beginResponse(HttpResponse::ptr rsp)
+{
+    if(m_rspState != RSP_NONE)
+        return -1;
+
+    uint64_t len = 0;
+    if(rsp->checkGetHeaderAs<uint64_t>("content-length", len))
+    {
+        m_rspState = RSP_LENGTH;
+        m_rspLeft = len;
+    }
+    else if(rsp->getVersion() >= 0x11)
+    {
+        rsp->setHeader("Transfer-Encoding", "chunked");
+        m_rspState = RSP_CHUNKED;
+    }
+    else
+    {
+        //HTTP/1.0不认识chunked 发完主体关闭连接表示结束
+        rsp->setClose(true);
+        m_rspState = RSP_CLOSE;
+    }
+
+    //首部先攒着 和第一段主体一起发出
+    PendingResponse pending;
+    pending.offset = m_output.size();
+    rsp->serializeHeader(m_output, false);
+    pending.len = m_output.size() - pending.offset;
+    m_pending.push_back(pending);
+
+    const std::string& body = rsp->getBody();
+    if(body.size())
+        return writeBody(body.c_str(), body.size());
+
+    return 0;
+}
+
+//流式发送一段响应报文主体
+int HttpSession::writeBody(const void* data, size_t len)
+{
+    if(m_rspState == RSP_NONE || m_rspState == RSP_DONE)
+        return -1;
+
+    if(len == 0)
+        return 0;
+
+    if(m_rspState == RSP_LENGTH)
+    {
+        if(len > m_rspLeft)
+        {
+            KIT_LOG_WARN(g_logger) << "HttpSession::writeBody body longer than content-length";
+            return -1;
+        }
+        m_rspLeft -= len;
+    }
+
+    m_iovs.clear();
+    appendPending();
+
+    struct iovec iov;
+    char head[24];
+    if(m_rspState == RSP_CHUNKED)
+    {
+        iov.iov_base = head;
+        iov.iov_len = snprintf(head, sizeof(head), "%lx\r\n", (unsigned long)len);
+        m_iovs.push_back(iov);
+    }
+
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    m_iovs.push_back(iov);
+
+    if(m_rspState == RSP_CHUNKED)
+    {
+        iov.iov_base = (void*)"\r\n";
+        iov.iov_len = 2;
+        m_iovs.push_back(iov);
+    }
+
+    int ret = sendIovs();
+    return ret <= 0 ? ret : (int)len;
+}
+
+//流式发送文件的一段
+ssize_t HttpSession::sendFile(int fd, off_t offset, size_t len)
+{
+    if(m_rspState == RSP_NONE || m_rspState == RSP_DONE)
+        return -1;
+
+    if(len == 0)
+        return 0;
+
+    if(m_rspState == RSP_LENGTH && len > m_rspLeft)
+    {
+        KIT_LOG_WARN(g_logger) << "HttpSession::sendFile body longer than content-length";
+        return -1;
+    }
+
+    //首部和块长度先发出 告诉内核后面还有数据 和文件内容合到同一批报文里
+    m_iovs.clear();
+    appendPending();
+
+    char head[24];
+    if(m_rspState == RSP_CHUNKED)
+    {
+        struct iovec iov;
+        iov.iov_base = head;
+        iov.iov_len = snprintf(head, sizeof(head), "%lx\r\n", (unsigned long)len);
+        m_iovs.push_back(iov);
+    }
+
+    if(m_iovs.size() && sendIovs(MSG_MORE) <= 0)
+        return -1;
+
+    //hook过的sendfile 发送缓冲区满时挂起协程
+    int sock = getSocket()->getFd();
+    size_t left = len;
+    while(left > 0)
+    {
+        ssize_t n = ::sendfile(sock, fd, &offset, left);
+        if(n <= 0)
+        {
+            KIT_LOG_WARN(g_logger) << "HttpSession::sendFile sendfile error, ret=" << n
+                << ", errno=" << errno << ", errstr=" << strerror(errno);
+            return n < 0 ? n : -1;
+        }
+        left -= n;
+        if(m_rspState == RSP_LENGTH)
+            m_rspLeft -= n;
+    }
+
+    if(m_rspState == RSP_CHUNKED && getSocket()->send("\r\n", 2) <= 0)
+        return -1;
+
+    return len;
+}
+
+//结束流式发送的响应
+int HttpSession::endResponse()
 {
-    std::stringstream ss;
-    ss << *rsp;
+    if(m_rspState == RSP_NONE)
+        return -1;
+
+    if(m_rspState == RSP_DONE)
+        return 0;
 
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    RspState state = m_rspState;
+    m_rspState = RSP_DONE;
+    if(state == RSP_LENGTH && m_rspLeft > 0)
+    {
+        KIT_LOG_WARN(g_logger) << "HttpSession::endResponse body shorter than content-length, left=" << m_rspLeft;
+        return -1;
+    }
+
+    m_iovs.clear();
+    appendPending();
+    if(state == RSP_CHUNKED)
+    {
+        struct iovec iov;
+        iov.iov_base = (void*)"0\r\n\r\n";
+        iov.iov_len = 5;
+        m_iovs.push_back(iov);
+    }
+
+    if(m_iovs.empty())
+        return 0;
+
+    return sendIovs() > 0 ? 0 : -1;
 }
 
+//攒下的响应加到m_iovs中
+void HttpSession::appendPending()
+{
+    //首部缓冲区不会再变 可以直接取地址
+    for(auto &x : m_pending)
+    {
+        struct iovec iov;
+        iov.iov_base = &m_output[x.offset];
+        iov.iov_len = x.len;
+        m_iovs.push_back(iov);
+
+        //流式发送的响应主体不在这里
+        if(!x.rsp)
+            continue;
+
+        const std::string& body = x.rsp->getBody();
+        if(body.size())
+        {
+            iov.iov_base = (void*)body.c_str();
+            iov.iov_len = body.size();
+            m_iovs.push_back(iov);
+        }
+    }
+}
+
+//发出m_iovs中所有的数据
+int HttpSession::sendIovs(int flags)
+{
+    int ret = 0;
+    for(auto &x : m_iovs)
+        ret += x.iov_len;
+
+    size_t i = 0;
+    while(i < m_iovs.size())
+    {
+        int n = getSocket()->send(&m_iovs[i], std::min(m_iovs.size() - i, (size_t)IOV_MAX), flags);
+        if(n <= 0)
+        {
+            ret = n;
+            break;
+        }
+
+        //跳过已经发完的块 发了一半的块调整起始位置
+        size_t left = n;
+        while(i < m_iovs.size() && left >= m_iovs[i].iov_len)
+        {
+            left -= m_iovs[i].iov_len;
+            ++i;
+        }
+        if(left > 0)
+        {
+            m_iovs[i].iov_base = (char*)m_iovs[i].iov_base + left;
+            m_iovs[i].iov_len -= left;
+        }
+    }
+
+    m_output.clear();
+    m_pending.clear();
+    return ret;
+}
+
+uint64_t HttpSession::GetBufferAllocCount()
+{
+    return s_buffer_alloc_count;
+}
+
+uint64_t HttpSession::GetRequestCount()
+{
+    return s_request_count;
+}
 
 
 }
@@ -3,10 +3,14 @@
 
 
 #include <memory>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
 
 #include "../stream.h"
 #include "../socket_stream.h"
 #include "http.h"
+#include "http_parser.h"
 
 namespace kit_server
 {
@@ -30,16 +34,231 @@ public:
 
     /**
      * @brief 接收HTTP请求报文
+     * @details 上一次读多的字节(流水线中后面的请求)留在会话的接收缓冲区里 先解析它们再从socket读
+     *          需要从socket读之前 会把还没发出的响应先发出去
+     *          请求的路径、查询参数、首部字段指向接收缓冲区 只在下次recvRequest()之前有效
+     *          之后还要用请求的 先调用HttpRequest::detach()
+     *          报文主体是chunked或者超过http.request.stream_body_size时不读进内存 由servlet用readBody()读
+     *          servlet没读完的主体在下次recvRequest()时丢掉
      * @return HttpRequest::ptr 
      */
     HttpRequest::ptr recvRequest();
 
     /**
      * @brief 发回HTTP响应报文
+     * @details 响应行和首部写进会话的首部缓冲区 报文主体不拷贝 发出时和首部一起writev
+     *          没发出之前会话持有rsp 报文主体不能修改
      * @param[in] rsp HTTP响应报文智能指针
+     * @param[in] flush 是否立即发出 否则先攒在发送缓冲区 和后面的响应一起发出
      * @return int 
      */
-    int sendResponse(HttpResponse::ptr rsp);
+    int sendResponse(HttpResponse::ptr rsp, bool flush = true);
+
+    /**
+     * @brief 发出发送缓冲区中攒下的响应
+     * @return int 发出的字节数 出错返回<=0
+     */
+    int flush();
+
+    /**
+     * @brief 接收缓冲区中是否还有没处理的请求数据 有说明客户端在使用流水线
+     * @return true 有
+     * @return false 没有
+     */
+    bool hasBufferedRequest() const {return m_bufferLen > 0;}
+
+    /**
+     * @brief 当前请求是否还有没读的报文主体 有就要用readBody()读
+     * @return true 有
+     * @return false 没有 主体已经在HttpRequest::getBody()中或者已经读完
+     */
+    bool hasPendingBody() const {return m_bodyMode != BODY_NONE;}
+
+    /**
+     * @brief 读取当前请求的报文主体 chunked编码在这里解开
+     * @param[out] buffer 存放主体的内存
+     * @param[in] len 内存大小
+     * @return int >0读到的字节数 0主体已经读完 <0出错
+     */
+    int readBody(void* buffer, size_t len);
+
+    /**
+     * @brief 丢掉当前请求还没读的报文主体
+     * @return true 成功
+     * @return false 读socket出错或者主体格式错误
+     */
+    bool discardBody();
+
+    /**
+     * @brief 开始流式发送响应 之后用writeBody()发主体 最后endResponse()
+     * @details rsp中有Content-Length首部时按这个长度发送 否则HTTP/1.1用chunked编码 HTTP/1.0发完后关闭连接
+     *          响应行和首部等到第一段主体一起发出 rsp中已经设置的报文主体作为第一段
+     * @param[in] rsp HTTP响应报文智能指针
+     * @return int >=0成功 <0出错
+     */
+    int beginResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 流式发送一段响应报文主体 数据直接发出 不缓存
+     * @param[in] data 主体数据
+     * @param[in] len 数据长度
+     * @return int 发出的字节数 出错返回<=0
+     */
+    int writeBody(const void* data, size_t len);
+
+    /**
+     * @brief 流式发送文件的一段作为响应报文主体 用sendfile直接从文件发到socket 不经过用户态
+     * @details 先用MSG_MORE发出还没发的首部 再循环sendfile 发送缓冲区满时协程挂起等socket可写
+     *          用偏移量读文件 不改变文件句柄的读写位置 同一个句柄可以被多个会话同时使用
+     * @param[in] fd 文件句柄
+     * @param[in] offset 文件中的起始偏移
+     * @param[in] len 发送的字节数
+     * @return ssize_t 发出的文件字节数 出错返回<=0 文件比预期短也算出错
+     */
+    ssize_t sendFile(int fd, off_t offset, size_t len);
+
+    /**
+     * @brief 结束流式发送的响应 chunked编码时发出结尾块 可以重复调用
+     * @return int >=0成功 <0出错 响应不完整 连接不能再用
+     */
+    int endResponse();
+
+    /**
+     * @brief 当前请求的响应是否已经开始流式发送
+     * @return true 是 不能再用sendResponse()
+     * @return false 不是
+     */
+    bool isResponseStarted() const {return m_rspState != RSP_NONE;}
+
+public:
+    /**
+     * @brief 获取所有会话接收缓冲区分配的次数 和GetRequestCount()对比可以看出每个请求的分配次数
+     * @return uint64_t 
+     */
+    static uint64_t GetBufferAllocCount();
+
+    /**
+     * @brief 获取所有会话收到的请求数
+     * @return uint64_t 
+     */
+    static uint64_t GetRequestCount();
+
+private:
+    /**
+     * @brief 缓冲区放满了首部还没收全时 把接收缓冲区扩大一倍 不超过首部最大长度
+     * @return true 扩大成功
+     * @return false 已经到上限
+     */
+    bool growBuffer();
+
+    /**
+     * @brief 接收缓冲区被超长的请求撑大之后 还原到默认大小
+     */
+    void shrinkBuffer();
+
+    /**
+     * @brief 接收缓冲区中没有数据时 从socket读到请求首部后面的位置 首部不动
+     * @return int 读到的字节数 出错返回<=0
+     */
+    int fillBuffer();
+
+    /**
+     * @brief 把攒下的响应加到m_iovs中
+     */
+    void appendPending();
+
+    /**
+     * @brief 发出m_iovs中所有的数据 清空攒下的响应
+     * @param[in] flags send的标志 后面紧接着还有数据时用MSG_MORE
+     * @return int 发出的字节数 出错返回<=0
+     */
+    int sendIovs(int flags = 0);
+
+    /**
+     * @brief 请求报文主体的读取方式
+     */
+    enum BodyMode
+    {
+        BODY_NONE,      //没有要读的主体
+        BODY_LENGTH,    //按Content-Length读
+        BODY_CHUNKED    //按chunked编码读
+    };
+
+    /**
+     * @brief chunked编码的解码状态
+     */
+    enum ChunkState
+    {
+        CHUNK_SIZE,     //块长度
+        CHUNK_EXT,      //块扩展 跳过
+        CHUNK_SIZE_LF,  //块长度行末尾CR后面的LF
+        CHUNK_DATA,     //块数据
+        CHUNK_DATA_END, //块数据后面的CR
+        CHUNK_DATA_LF,  //块数据后面CR之后的LF
+        CHUNK_TRAILER,  //最后一块之后的trailer 直到空行
+        CHUNK_TRAILER_LF    //trailer行末尾CR后面的LF
+    };
+
+    /**
+     * @brief 流式响应的发送方式
+     */
+    enum RspState
+    {
+        RSP_NONE,       //没有流式发送
+        RSP_LENGTH,     //按Content-Length发送
+        RSP_CHUNKED,    //按chunked编码发送
+        RSP_CLOSE,      //发完关闭连接
+        RSP_DONE        //已经结束
+    };
+
+private:
+    /// 请求解析器 每个请求开始解析时重置
+    HttpRequestParser m_parser;
+    /// 接收缓冲区 跨请求保留
+    std::vector<char> m_buffer;
+    /// 当前请求首部的结束位置 读流式主体时不会覆盖前面的首部
+    size_t m_headerEnd = 0;
+    /// 接收缓冲区中还没解析的字节的起始位置 前面是当前请求的首部
+    size_t m_bufferStart = 0;
+    /// 接收缓冲区中还没解析的字节数
+    size_t m_bufferLen = 0;
+    /**
+     * @brief 还没发出的响应
+     */
+    struct PendingResponse
+    {
+        //首部在首部缓冲区中的位置
+        size_t offset;
+        //首部长度
+        size_t len;
+        //报文主体在响应里 发出之前要保证它活着
+        HttpResponse::ptr rsp;
+    };
+
+    /// 首部缓冲区 攒下还没发出的响应首部 发出后清空但保留内存
+    std::string m_output;
+    /// 还没发出的响应
+    std::vector<PendingResponse> m_pending;
+    /// 发送用的iovec 跨请求复用
+    std::vector<struct iovec> m_iovs;
+
+    /// 请求报文主体的读取方式
+    BodyMode m_bodyMode = BODY_NONE;
+    /// 按长度读时剩余的字节数 chunked时是当前块剩余的字节数
+    uint64_t m_bodyLeft = 0;
+    /// chunked时已经读到的主体长度
+    uint64_t m_bodyRead = 0;
+    /// chunked解码状态
+    ChunkState m_chunkState = CHUNK_SIZE;
+    /// 块长度行是否已经读到十六进制数字
+    bool m_chunkHasSize = false;
+    /// trailer中当前行是否是空行
+    bool m_chunkLineEmpty = true;
+
+    /// 流式响应的发送方式
+    RspState m_rspState = RSP_NONE;
+    /// 按长度发送时剩余的字节数
+    uint64_t m_rspLeft = 0;
 };
 
 }
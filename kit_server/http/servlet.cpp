@@ -1,7 +1,16 @@
 #include "servlet.h"
 #include "../Log.h"
+#include "../util.h"
 
 #include <fnmatch.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <algorithm>
 
 namespace kit_server
 {
@@ -36,7 +45,8 @@ ServletDispatch::ServletDispatch(const std::string& name)
 int32_t ServletDispatch::handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session)
 {
     //KIT_LOG_DEBUG(g_logger) << "获得路径:" << request->getPath();
-    auto slt = getMatchedServlet(request->getPath());
+    //按视图匹配 getPath()会把路径拷贝进请求
+    auto slt = getMatchedServlet(request->getPathView());
     if(slt)
         slt->handle(request, response, session);
     
@@ -136,6 +146,15 @@ Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri)
     return m_default;
 }
 
+//根据uri视图获取服务对象
+Servlet::ptr ServletDispatch::getMatchedServlet(const StringView& uri)
+{
+    //查表和fnmatch都要以'\0'结尾的字符串 复用线程的缓冲区 不在每个请求上分配
+    static thread_local std::string t_uri;
+    t_uri.assign(uri.data, uri.len);
+    return getMatchedServlet(t_uri);
+}
+
 /*************************************NotFoundServlet**************************************/
 
 NotFoundServlet::NotFoundServlet(const std::string& serverName, const std::string& name)
@@ -193,5 +212,430 @@ int32_t HelloServlet::handle(HttpRequest::ptr request, HttpResponse::ptr respons
     return 0;
 }
 
+/*************************************StaticFileServlet**************************************/
+
+//文件扩展名对应的Content-Type
+static const char* GetContentType(const std::string& path)
+{
+    static const struct
+    {
+        const char* ext;
+        const char* type;
+    } s_types[] = {
+        {"html", "text/html; charset=utf-8"},
+        {"htm",  "text/html; charset=utf-8"},
+        {"css",  "text/css"},
+        {"js",   "application/javascript"},
+        {"json", "application/json"},
+        {"txt",  "text/plain; charset=utf-8"},
+        {"xml",  "application/xml"},
+        {"png",  "image/png"},
+        {"jpg",  "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif",  "image/gif"},
+        {"svg",  "image/svg+xml"},
+        {"ico",  "image/x-icon"},
+        {"webp", "image/webp"},
+        {"pdf",  "application/pdf"},
+        {"zip",  "application/zip"},
+        {"gz",   "application/gzip"},
+        {"mp4",  "video/mp4"},
+        {"mp3",  "audio/mpeg"},
+        {"wasm", "application/wasm"},
+    };
+
+    size_t pos = path.rfind('.');
+    if(pos == std::string::npos || path.find('/', pos) != std::string::npos)
+        return "application/octet-stream";
+
+    const char* ext = path.c_str() + pos + 1;
+    for(auto &x : s_types)
+    {
+        if(strcasecmp(ext, x.ext) == 0)
+            return x.type;
+    }
+    return "application/octet-stream";
+}
+
+bool StaticFileServlet::DecodePath(const char* s, size_t len, std::string& out)
+{
+    out.reserve(len);
+    for(size_t i = 0;i < len;++i)
+    {
+        if(s[i] != '%')
+        {
+            out.push_back(s[i]);
+            continue;
+        }
+
+        if(i + 2 >= len || !isxdigit(s[i + 1]) || !isxdigit(s[i + 2]))
+            return false;
+
+        char hex[3] = {s[i + 1], s[i + 2], 0};
+        char c = (char)strtol(hex, nullptr, 16);
+        if(c == '\0')
+            return false;
+        out.push_back(c);
+        i += 2;
+    }
+    return true;
+}
+
+bool StaticFileServlet::HasDotDot(const std::string& path)
+{
+    size_t start = 0;
+    while(start <= path.size())
+    {
+        size_t end = path.find('/', start);
+        if(end == std::string::npos)
+            end = path.size();
+        if(end - start == 2 && path[start] == '.' && path[start + 1] == '.')
+            return true;
+        start = end + 1;
+    }
+    return false;
+}
+
+//解析HTTP日期 只认RFC 7231推荐的IMF-fixdate格式
+static bool ParseHttpDate(const StringView& v, time_t& t)
+{
+    std::string str = v.str();
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char* end = strptime(str.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if(!end || *end != '\0')
+        return false;
+    t = timegm(&tm);
+    return true;
+}
+
+bool StaticFileServlet::MatchETag(const StringView& v, const std::string& etag)
+{
+    size_t i = 0;
+    while(i < v.len)
+    {
+        while(i < v.len && (v.data[i] == ' ' || v.data[i] == '\t' || v.data[i] == ','))
+            ++i;
+        size_t start = i;
+        while(i < v.len && v.data[i] != ',')
+            ++i;
+        size_t end = i;
+        while(end > start && (v.data[end - 1] == ' ' || v.data[end - 1] == '\t'))
+            --end;
+
+        if(end - start == 1 && v.data[start] == '*')
+            return true;
+        if(end - start > 2 && v.data[start] == 'W' && v.data[start + 1] == '/')
+            start += 2;
+        if(end - start == etag.size() && strncmp(v.data + start, etag.c_str(), etag.size()) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool StaticFileServlet::MatchIfRange(const StringView& v, const std::string& etag, const std::string& last_modified)
+{
+    //弱标签不能用在If-Range里
+    if(v.len >= 2 && v.data[0] == 'W' && v.data[1] == '/')
+        return false;
+    if(v.len == etag.size() && strncmp(v.data, etag.c_str(), v.len) == 0)
+        return true;
+    return v.len == last_modified.size() && strncmp(v.data, last_modified.c_str(), v.len) == 0;
+}
+
+//读一个十进制数
+static bool ParseUInt(const char*& p, const char* end, uint64_t& v)
+{
+    const char* start = p;
+    v = 0;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+        if(v > (UINT64_MAX - 9) / 10)
+            return false;
+        v = v * 10 + (*p - '0');
+        ++p;
+    }
+    return p != start;
+}
+
+int StaticFileServlet::ParseRange(const StringView& v, uint64_t size, uint64_t& first, uint64_t& last)
+{
+    if(v.len < 6 || strncasecmp(v.data, "bytes=", 6) != 0)
+        return 0;
+
+    const char* p = v.data + 6;
+    const char* end = v.data + v.len;
+    while(p < end && *p == ' ')
+        ++p;
+    //多个区间要用multipart/byteranges 直接回整个文件
+    if(memchr(p, ',', end - p))
+        return 0;
+
+    uint64_t a = 0, b = 0;
+    if(p < end && *p == '-')
+    {
+        //-n 最后n个字节
+        ++p;
+        if(!ParseUInt(p, end, b) || p != end)
+            return 0;
+        if(b == 0 || size == 0)
+            return -1;
+        first = b < size ? size - b : 0;
+        last = size - 1;
+        return 1;
+    }
+
+    if(!ParseUInt(p, end, a) || p == end || *p != '-')
+        return 0;
+    ++p;
+    if(p == end)
+        b = UINT64_MAX;
+    else if(!ParseUInt(p, end, b) || p != end || b < a)
+        return 0;
+
+    if(a >= size)
+        return -1;
+    first = a;
+    last = std::min(b, size - 1);
+    return 1;
+}
+
+StaticFileServlet::FileInfo::~FileInfo()
+{
+    if(fd >= 0)
+        ::close(fd);
+}
+
+StaticFileServlet::StaticFileServlet(const std::string& root, const std::string& prefix, size_t max_files,
+        uint64_t ttl_ms, const std::string& name)
+    :Servlet(name)
+    ,m_root(root)
+    ,m_prefix(prefix)
+    ,m_maxFiles(max_files ? max_files : 1)
+    ,m_ttl(ttl_ms)
+{
+    while(m_root.size() > 1 && m_root.back() == '/')
+        m_root.pop_back();
+
+    //通配的注册路径 去掉后面的*
+    while(m_prefix.size() && m_prefix.back() == '*')
+        m_prefix.pop_back();
+}
+
+int32_t StaticFileServlet::handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session)
+{
+    HttpMethod method = request->getMethod();
+    if(method != HttpMethod::GET && method != HttpMethod::HEAD)
+    {
+        response->setStatus(HttpStatus::METHOD_NOT_ALLOWED);
+        response->setHeader("Allow", "GET, HEAD");
+        response->setHeader("Content-Length", "0");
+        return 0;
+    }
+
+    //请求路径去掉前缀 映射到根目录下
+    StringView pv = request->getPathView();
+    if(pv.len >= m_prefix.size() && strncmp(pv.data, m_prefix.c_str(), m_prefix.size()) == 0)
+    {
+        pv.data += m_prefix.size();
+        pv.len -= m_prefix.size();
+    }
+
+    std::string rel;
+    if(!DecodePath(pv.data, pv.len, rel) || HasDotDot(rel))
+    {
+        response->setStatus(HttpStatus::FORBIDDEN);
+        response->setHeader("Content-Length", "0");
+        return 0;
+    }
+    if(rel.empty() || rel.back() == '/')
+        rel.append("index.html");
+
+    std::string path = m_root;
+    if(rel[0] != '/')
+        path.push_back('/');
+    path.append(rel);
+
+    FileInfo::ptr file = getFile(path);
+    if(!file)
+    {
+        response->setStatus(HttpStatus::NOT_FOUND);
+        response->setHeader("Content-Length", "0");
+        return 0;
+    }
+
+    response->setHeader("Accept-Ranges", "bytes");
+    response->setHeader("ETag", file->etag);
+    response->setHeader("Last-Modified", file->lastModified);
+
+    //If-None-Match优先 有它时不看If-Modified-Since
+    bool not_modified = false;
+    StringView inm = request->getHeaderView("if-none-match");
+    if(inm.valid())
+    {
+        not_modified = MatchETag(inm, file->etag);
+    }
+    else
+    {
+        time_t t = 0;
+        StringView ims = request->getHeaderView("if-modified-since");
+        if(ims.valid() && ParseHttpDate(ims, t) && file->mtime <= t)
+            not_modified = true;
+    }
+    if(not_modified)
+    {
+        response->setStatus(HttpStatus::NOT_MODIFIED);
+        return 0;
+    }
+
+    response->setHeader("Content-Type", file->contentType);
+
+    uint64_t size = file->size;
+    uint64_t first = 0, last = size ? size - 1 : 0;
+    uint64_t len = size;
+    StringView range = request->getHeaderView("range");
+    if(range.valid())
+    {
+        //If-Range对不上 说明客户端手里的是旧文件 回整个文件
+        StringView ifr = request->getHeaderView("if-range");
+        bool use_range = !ifr.valid() || MatchIfRange(ifr, file->etag, file->lastModified);
+
+        int rt = use_range ? ParseRange(range, size, first, last) : 0;
+        if(rt < 0)
+        {
+            response->setStatus(HttpStatus::RANGE_NOT_SATISFIABLE);
+            response->setHeader("Content-Range", "bytes */" + std::to_string(size));
+            response->setHeader("Content-Length", "0");
+            return 0;
+        }
+        if(rt > 0)
+        {
+            len = last - first + 1;
+            response->setStatus(HttpStatus::PARTIAL_CONTENT);
+            response->setHeader("Content-Range", "bytes " + std::to_string(first) + "-"
+                + std::to_string(last) + "/" + std::to_string(size));
+        }
+    }
+
+    response->setHeader("Content-Length", std::to_string(len));
+
+    //HEAD和空文件只有首部 走正常的发送流程
+    if(method == HttpMethod::HEAD || len == 0)
+        return 0;
+
+    if(session->beginResponse(response) < 0)
+        return -1;
+
+    //发送失败时响应不完整 服务器结束响应时会关闭连接
+    if(session->sendFile(file->fd, first, len) <= 0)
+    {
+        KIT_LOG_WARN(g_logger) << "StaticFileServlet send file error, path=" << path;
+        return -1;
+    }
+
+    return 0;
+}
+
+void StaticFileServlet::clear()
+{
+    MutexType::Lock lock(m_mutex);
+    m_files.clear();
+    m_lru.clear();
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::getFile(const std::string& path)
+{
+    uint64_t now = GetCurrentMs();
+    FileInfo::ptr old;
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_files.find(path);
+        if(it != m_files.end())
+        {
+            //移到链表头
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            old = it->second->second;
+            if(now < old->expire)
+                return old;
+        }
+    }
+
+    //不在缓存中或者已经过期 stat和open不持锁
+    struct stat st;
+    if(stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        MutexType::Lock lock(m_mutex);
+        auto it = m_files.find(path);
+        if(it != m_files.end())
+        {
+            m_lru.erase(it->second);
+            m_files.erase(it);
+        }
+        return nullptr;
+    }
+
+    FileInfo::ptr file;
+    if(old && old->ino == st.st_ino && old->mtime == st.st_mtime && old->size == st.st_size)
+    {
+        //文件没变 继续用原来的句柄
+        file = old;
+    }
+    else
+    {
+        file = openFile(path, st);
+        if(!file)
+            return nullptr;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    file->expire = now + m_ttl;
+    auto it = m_files.find(path);
+    if(it != m_files.end())
+    {
+        it->second->second = file;
+        m_lru.splice(m_lru.begin(), m_lru, it->second);
+        return file;
+    }
+
+    m_lru.push_front(std::make_pair(path, file));
+    m_files[path] = m_lru.begin();
+    //淘汰最久没用的 正在发送的文件等发完才关闭
+    while(m_lru.size() > m_maxFiles)
+    {
+        m_files.erase(m_lru.back().first);
+        m_lru.pop_back();
+    }
+    return file;
+}
+
+StaticFileServlet::FileInfo::ptr StaticFileServlet::openFile(const std::string& path, const struct stat& st)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        KIT_LOG_WARN(g_logger) << "StaticFileServlet open file error, path=" << path
+            << ", errno=" << errno << ", errstr=" << strerror(errno);
+        return nullptr;
+    }
+
+    FileInfo::ptr file(new FileInfo);
+    file->fd = fd;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+
+    char buf[64];
+    snprintf(buf, sizeof(buf), "\"%lx-%lx\"", (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+    file->etag = buf;
+
+    struct tm tm;
+    gmtime_r(&st.st_mtime, &tm);
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    file->lastModified = buf;
+
+    file->contentType = GetContentType(path);
+    return file;
+}
+
+}
 }
-}
\ No newline at end of file
@@ -6,7 +6,10 @@
 #include <functional>
 #include <string>
 #include <vector>
+#include <list>
 #include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "http.h"
 #include "http_session.h"
@@ -185,6 +188,13 @@ public:
      */
     Servlet::ptr getMatchedServlet(const std::string& uri);
 
+    /**
+     * @brief 根据uri视图获取任意一个匹配的服务对象 请求的路径不用拷贝成成员
+     * @param[in] uri 资源路径 
+     * @return Servlet::ptr 
+     */
+    Servlet::ptr getMatchedServlet(const StringView& uri);
+
 private:
     /// uri--->servlet  精准匹配  temp/xxxx
     std::unordered_map<std::string, Servlet::ptr> m_datas;
@@ -259,6 +269,146 @@ private:
     std::string m_content;
 };
 
+/**
+ * @brief 静态文件服务类
+ * @details 把请求路径去掉前缀后映射到根目录下的文件 用sendfile发送 文件内容不经过用户态
+ *          打开的文件句柄和stat结果放在LRU缓存中 过期后重新stat 文件没变就继续用原来的句柄
+ *          支持If-None-Match/If-Modified-Since(304) 以及单个区间的Range请求(206/416)
+ */
+class StaticFileServlet: public Servlet
+{
+public:
+    typedef std::shared_ptr<StaticFileServlet> ptr;
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 静态文件服务类构造函数
+     * @param[in] root 文件根目录
+     * @param[in] prefix 请求路径中要去掉的前缀 和注册服务的路径一致
+     * @param[in] max_files 最多缓存的文件句柄数
+     * @param[in] ttl_ms 缓存的stat结果多久之后重新检查 单位ms
+     * @param[in] name 服务名称
+     */
+    StaticFileServlet(const std::string& root, const std::string& prefix = "/", size_t max_files = 1024,
+        uint64_t ttl_ms = 5000, const std::string& name = "StaticFileServlet");
+
+    /**
+     * @brief 执行服务
+     * @param[in] request HTTP请求报文
+     * @param[in] response HTTP响应报文
+     * @param[in] session HTTP主动连接会话
+     * @return int32_t 
+     */
+    virtual int32_t handle(HttpRequest::ptr request, HttpResponse::ptr response, HttpSession::ptr session) override;
+
+    /**
+     * @brief 清空文件缓存 已经在发送的文件不受影响
+     */
+    void clear();
+
+    /**
+     * @brief 解码路径中的%XX
+     * @param[in] s 路径
+     * @param[in] len 路径长度
+     * @param[out] out 解码后的路径
+     * @return bool %后面不是两位十六进制数或者解出'\0'时返回false
+     */
+    static bool DecodePath(const char* s, size_t len, std::string& out);
+
+    /**
+     * @brief 路径中是否有..段 有就可能跑到根目录外面
+     * @param[in] path 解码后的路径
+     * @return bool
+     */
+    static bool HasDotDot(const std::string& path);
+
+    /**
+     * @brief If-None-Match中是否有和etag匹配的标签 弱比较
+     * @param[in] v If-None-Match首部的值 可以是*或者逗号分隔的多个标签
+     * @param[in] etag 文件的实体标签
+     * @return bool
+     */
+    static bool MatchETag(const StringView& v, const std::string& etag);
+
+    /**
+     * @brief If-Range是否和文件对得上 实体标签用强比较 日期要完全相同
+     * @param[in] v If-Range首部的值
+     * @param[in] etag 文件的实体标签
+     * @param[in] last_modified 文件Last-Modified首部的值
+     * @return bool
+     */
+    static bool MatchIfRange(const StringView& v, const std::string& etag, const std::string& last_modified);
+
+    /**
+     * @brief 解析Range首部 只支持单个区间
+     * @param[in] v Range首部的值
+     * @param[in] size 文件大小
+     * @param[out] first 区间第一个字节
+     * @param[out] last 区间最后一个字节 超过文件大小时截到文件末尾
+     * @return int 1区间有效 0格式不对或者多个区间 忽略Range -1区间不能满足
+     */
+    static int ParseRange(const StringView& v, uint64_t size, uint64_t& first, uint64_t& last);
+
+private:
+    /**
+     * @brief 缓存的文件
+     * @details 会话发送期间持有智能指针 被淘汰的文件发完之后才关闭句柄
+     */
+    struct FileInfo
+    {
+        typedef std::shared_ptr<FileInfo> ptr;
+        ~FileInfo();
+
+        /// 文件句柄
+        int fd = -1;
+        /// 文件大小
+        off_t size = 0;
+        /// 最后修改时间
+        time_t mtime = 0;
+        /// inode号 文件被替换时会变
+        ino_t ino = 0;
+        /// 实体标签
+        std::string etag;
+        /// Last-Modified首部的值
+        std::string lastModified;
+        /// 文件类型
+        std::string contentType;
+        /// 过期时间 之后要重新stat
+        uint64_t expire = 0;
+    };
+
+    /**
+     * @brief 获取文件 先查缓存 不在或者已经过期时stat/open
+     * @param[in] path 文件的完整路径
+     * @return FileInfo::ptr 文件不存在或不是普通文件返回nullptr
+     */
+    FileInfo::ptr getFile(const std::string& path);
+
+    /**
+     * @brief 打开文件并填好stat结果
+     * @param[in] path 文件的完整路径
+     * @param[in] st 文件的stat结果
+     * @return FileInfo::ptr 打开失败返回nullptr
+     */
+    FileInfo::ptr openFile(const std::string& path, const struct stat& st);
+
+private:
+    /// 文件根目录
+    std::string m_root;
+    /// 请求路径前缀
+    std::string m_prefix;
+    /// 最多缓存的文件数
+    size_t m_maxFiles;
+    /// stat结果的有效时间
+    uint64_t m_ttl;
+    /// LRU链表 最近用过的在前面
+    std::list<std::pair<std::string, FileInfo::ptr> > m_lru;
+    /// 路径到LRU链表节点
+    std::unordered_map<std::string, std::list<std::pair<std::string, FileInfo::ptr> >::iterator> m_files;
+    /// 互斥锁 每次访问都要调整LRU顺序
+    MutexType m_mutex;
+};
+
 }
 }
 
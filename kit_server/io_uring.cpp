@@ -0,0 +1,246 @@
+#include "io_uring.h"
+#include "Log.h"
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <algorithm>
+
+
+namespace kit_server
+{
+
+static Logger::ptr g_logger = KIT_LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete,
+    uint32_t flags, const void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void *arg, uint32_t nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+IOUring::IOUring()
+{
+}
+
+IOUring::~IOUring()
+{
+    if(m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    if(m_cqRing && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if(m_sqRing)
+        munmap(m_sqRing, m_sqRingSize);
+    if(m_fd >= 0)
+        close(m_fd);
+}
+
+//创建io_uring实例
+bool IOUring::init(uint32_t entries)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    //超过内核上限时自动截断
+    params.flags = IORING_SETUP_CLAMP;
+
+    m_fd = io_uring_setup(entries, &params);
+    if(m_fd < 0)
+    {
+        KIT_LOG_WARN(g_logger) << "IOUring: io_uring_setup error, errno=" << errno
+            << ", is:" << strerror(errno);
+        return false;
+    }
+
+    //等待超时依赖EXT_ARG 完成事件不丢失依赖NODROP
+    if(!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+    {
+        KIT_LOG_WARN(g_logger) << "IOUring: kernel lacks required features, features=" << params.features;
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap)
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(m_sqRing == MAP_FAILED)
+    {
+        m_sqRing = nullptr;
+        KIT_LOG_WARN(g_logger) << "IOUring: mmap sq ring error, errno=" << errno;
+        return false;
+    }
+
+    if(single_mmap)
+    {
+        m_cqRing = m_sqRing;
+    }
+    else
+    {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if(m_cqRing == MAP_FAILED)
+        {
+            m_cqRing = nullptr;
+            KIT_LOG_WARN(g_logger) << "IOUring: mmap cq ring error, errno=" << errno;
+            return false;
+        }
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        KIT_LOG_WARN(g_logger) << "IOUring: mmap sqes error, errno=" << errno;
+        return false;
+    }
+    m_sqes = (struct io_uring_sqe *)sqes;
+
+    char *sq = (char *)m_sqRing;
+    m_sqHead = (uint32_t *)(sq + params.sq_off.head);
+    m_sqTail = (uint32_t *)(sq + params.sq_off.tail);
+    m_sqMask = *(uint32_t *)(sq + params.sq_off.ring_mask);
+    m_sqEntries = *(uint32_t *)(sq + params.sq_off.ring_entries);
+    m_sqLocalTail = *m_sqTail;
+
+    //SQE下标和提交队列下标一一对应 之后不用再维护间接数组
+    uint32_t *array = (uint32_t *)(sq + params.sq_off.array);
+    for(uint32_t i = 0;i < m_sqEntries;++i)
+        array[i] = i;
+
+    char *cq = (char *)m_cqRing;
+    m_cqHead = (uint32_t *)(cq + params.cq_off.head);
+    m_cqTail = (uint32_t *)(cq + params.cq_off.tail);
+    m_cqMask = *(uint32_t *)(cq + params.cq_off.ring_mask);
+    m_cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return probe();
+}
+
+//立即提交
+int IOUring::submit()
+{
+    int ret = 0;
+    do
+    {
+        ret = io_uring_enter(m_fd, pending(), 0, 0, nullptr, 0);
+    }while(ret < 0 && errno == EINTR);
+
+    return ret;
+}
+
+//提交并等待完成事件
+int IOUring::wait(int timeout_ms)
+{
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000;
+
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    return io_uring_enter(m_fd, pending(), 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                        &arg, sizeof(arg));
+}
+
+//取出完成事件
+size_t IOUring::reap(std::vector<struct io_uring_cqe>& cqes, size_t max)
+{
+    MutexType::Lock lock(m_cqMutex);
+    uint32_t head = *m_cqHead;
+    uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+
+    size_t n = 0;
+    while(head != tail && n < max)
+    {
+        cqes.push_back(m_cqes[head & m_cqMask]);
+        ++head;
+        ++n;
+    }
+
+    //CQE拷贝走之后再归还槽位
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    return n;
+}
+
+//获取空闲SQE
+struct io_uring_sqe* IOUring::getSqe()
+{
+    uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(m_sqLocalTail - head >= m_sqEntries)
+    {
+        //提交队列满了 先交给内核腾出位置
+        if(submit() < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "IOUring: submit error, errno=" << errno
+                << ", is:" << strerror(errno);
+            return nullptr;
+        }
+
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqLocalTail - head >= m_sqEntries)
+            return nullptr;
+    }
+
+    struct io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+
+    return sqe;
+}
+
+//未提交的SQE数量
+uint32_t IOUring::pending() const
+{
+    return __atomic_load_n(m_sqTail, __ATOMIC_ACQUIRE) - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+//检查内核支持的操作
+bool IOUring::probe()
+{
+    static const uint8_t ops[] = {
+        IORING_OP_POLL_ADD, IORING_OP_POLL_REMOVE, IORING_OP_ASYNC_CANCEL,
+        IORING_OP_READ, IORING_OP_READV, IORING_OP_RECV, IORING_OP_RECVMSG,
+        IORING_OP_WRITE, IORING_OP_WRITEV, IORING_OP_SEND, IORING_OP_SENDMSG,
+        IORING_OP_ACCEPT, IORING_OP_CONNECT
+    };
+
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    std::vector<char> buf(len, 0);
+    struct io_uring_probe *p = (struct io_uring_probe *)&buf[0];
+    if(io_uring_register(m_fd, IORING_REGISTER_PROBE, p, 256) < 0)
+    {
+        KIT_LOG_WARN(g_logger) << "IOUring: probe error, errno=" << errno;
+        return false;
+    }
+
+    for(auto op : ops)
+    {
+        if(op > p->last_op || !(p->ops[op].flags & IO_URING_OP_SUPPORTED))
+        {
+            KIT_LOG_WARN(g_logger) << "IOUring: op " << (int)op << " not supported";
+            return false;
+        }
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,158 @@
+#ifndef _KIT_IO_URING_H_
+#define _KIT_IO_URING_H_
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <vector>
+
+#include "mutex.h"
+#include "noncopyable.h"
+
+
+namespace kit_server
+{
+
+/**
+ * @brief io_uring封装类
+ * @details 不依赖liburing 直接通过系统调用建立提交队列/完成队列
+ *          提交队列和完成队列各自加锁 可以被多个线程共享
+ *          放入提交队列的SQE不会立即提交 由下一次enter()统一批量提交
+ */
+class IOUring: Noncopyable
+{
+public:
+    typedef Mutex MutexType;
+
+    /**
+     * @brief io_uring类构造函数 只初始化成员 需要再调用init()
+     */
+    IOUring();
+
+    /**
+     * @brief io_uring类析构函数
+     */
+    ~IOUring();
+
+    /**
+     * @brief 创建io_uring实例
+     * @param[in] entries 提交队列长度
+     * @return true 创建成功
+     * @return false 内核不支持或者缺少需要的特性/操作
+     */
+    bool init(uint32_t entries);
+
+    /**
+     * @brief 获取一个空闲的SQE并填充 放入提交队列
+     * @details 提交队列满时会先把已有的SQE提交给内核
+     * @tparam Prep 填充函数类型 void(struct io_uring_sqe*)
+     * @param[in] prep 填充函数 在提交队列锁内调用
+     * @return true 成功
+     * @return false 失败
+     */
+    template<class Prep>
+    bool push(Prep prep)
+    {
+        MutexType::Lock lock(m_sqMutex);
+        struct io_uring_sqe* sqe = getSqe();
+        if(!sqe)
+            return false;
+
+        prep(sqe);
+        //SQE填写完毕后才能更新队尾 内核看到队尾时数据一定是完整的
+        __atomic_store_n(m_sqTail, ++m_sqLocalTail, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+    /**
+     * @brief 立即把提交队列里的SQE提交给内核 不等待完成
+     * @return int 提交数量 出错返回-1
+     */
+    int submit();
+
+    /**
+     * @brief 提交SQE并等待至少一个完成事件
+     * @param[in] timeout_ms 最长等待毫秒数
+     * @return int 出错返回-1 超时/被中断也返回-1 errno为ETIME/EINTR
+     */
+    int wait(int timeout_ms);
+
+    /**
+     * @brief 从完成队列取出完成事件
+     * @param[out] cqes 取出的完成事件 追加到末尾
+     * @param[in] max 最多取出数量
+     * @return size_t 取出的数量
+     */
+    size_t reap(std::vector<struct io_uring_cqe>& cqes, size_t max);
+
+    /**
+     * @brief 获取io_uring句柄
+     * @return int
+     */
+    int getFd() const {return m_fd;}
+
+    /**
+     * @brief 提交队列中还没提交给内核的SQE数量
+     * @return uint32_t
+     */
+    uint32_t pending() const;
+
+private:
+    /**
+     * @brief 获取一个空闲的SQE 调用前需持有提交队列锁
+     * @return struct io_uring_sqe*
+     */
+    struct io_uring_sqe* getSqe();
+
+    /**
+     * @brief 检查需要用到的操作内核是否都支持
+     * @return true
+     * @return false
+     */
+    bool probe();
+
+private:
+    /// io_uring句柄
+    int m_fd = -1;
+    /// 提交队列映射内存
+    void *m_sqRing = nullptr;
+    /// 提交队列映射长度
+    size_t m_sqRingSize = 0;
+    /// 完成队列映射内存 支持单次映射时和提交队列相同
+    void *m_cqRing = nullptr;
+    /// 完成队列映射长度
+    size_t m_cqRingSize = 0;
+    /// SQE数组
+    struct io_uring_sqe *m_sqes = nullptr;
+    /// SQE数组映射长度
+    size_t m_sqesSize = 0;
+
+    /// 提交队列 内核维护的队头
+    uint32_t *m_sqHead = nullptr;
+    /// 提交队列 队尾
+    uint32_t *m_sqTail = nullptr;
+    /// 提交队列 下标掩码
+    uint32_t m_sqMask = 0;
+    /// 提交队列 长度
+    uint32_t m_sqEntries = 0;
+    /// 本地维护的提交队列队尾
+    uint32_t m_sqLocalTail = 0;
+
+    /// 完成队列 队头
+    uint32_t *m_cqHead = nullptr;
+    /// 完成队列 内核维护的队尾
+    uint32_t *m_cqTail = nullptr;
+    /// 完成队列 下标掩码
+    uint32_t m_cqMask = 0;
+    /// 完成队列 CQE数组
+    struct io_uring_cqe *m_cqes = nullptr;
+
+    /// 提交队列锁
+    MutexType m_sqMutex;
+    /// 完成队列锁
+    MutexType m_cqMutex;
+};
+
+}
+
+#endif
@@ -3,12 +3,16 @@
 #include "config.h"
 #include "macro.h"
 #include "mutex.h"
+#include "io_uring.h"
+#include "fdmanager.h"
 
 
 #include <sys/epoll.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <errno.h>
@@ -19,6 +23,43 @@ namespace kit_server
 
 static Logger::ptr g_logger = KIT_LOG_NAME("system");
 
+/**
+ * @brief 配置项 IO调度器后端 epoll/io_uring io_uring不可用时自动退回epoll
+ */
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::LookUp("iomanager.backend", std::string("epoll"), "iomanager backend: epoll/io_uring");
+
+/**
+ * @brief 配置项 io_uring提交队列长度
+ */
+static ConfigVar<uint32_t>::ptr g_io_uring_entries =
+    Config::LookUp("iomanager.io_uring.entries", (uint32_t)1024, "iomanager io_uring submission queue entries");
+
+/**
+ * @brief 配置项 epoll后端下每个调度线程是否使用独立的epoll 句柄固定由注册它的线程处理
+ */
+static ConfigVar<bool>::ptr g_iomanager_per_thread_epoll =
+    Config::LookUp("iomanager.per_thread_epoll", false, "iomanager epoll set per worker thread");
+
+/**
+ * @brief 配置项 epoll_wait一次最多取回的事件数 事件数组取满时翻倍扩容 直到这个上限
+ */
+static ConfigVar<uint32_t>::ptr g_iomanager_max_events =
+    Config::LookUp("iomanager.max_events", (uint32_t)65536, "iomanager max events per epoll_wait");
+
+/**
+ * @brief io_uring完成事件的user_data编码
+ * @details 低2位: 1读事件 2写事件 3内部使用; 高16位: 提交序号; 中间为FdContext指针
+ */
+static const uint64_t URING_TAG_MASK = 0x3;
+static const uint64_t URING_TAG_INTERNAL = 0x3;
+/// eventfd唤醒
+static const uint64_t URING_TICKLE = 0x3;
+/// 取消等内部操作的完成事件 直接忽略
+static const uint64_t URING_IGNORE = 0x7;
+static const int URING_SEQ_SHIFT = 48;
+static const uint64_t URING_PTR_MASK = ((1ull << URING_SEQ_SHIFT) - 1) & ~URING_TAG_MASK;
+
 //获取具体事件对象
 IOManager::FdContext::EventContext& IOManager::FdContext::getEventContext(IOManager::Event event)
 {
@@ -39,11 +80,12 @@ void IOManager::FdContext::resetEventContext(IOManager::FdContext::EventContext&
     event_ctx.scheduler = nullptr;
     event_ctx.coroutine.reset();
     event_ctx.cb = nullptr;
+    event_ctx.result = nullptr;
 }
 
 
 //主动触发事件
-void IOManager::FdContext::triggerEvent(IOManager::Event event)
+void IOManager::FdContext::triggerEvent(IOManager::Event event, EventBatch* batch)
 {
     KIT_ASSERT(events & event);
 
@@ -54,7 +96,21 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event)
 
     KIT_ASSERT(ctx.cb || ctx.coroutine);
 
-    if(ctx.cb)
+    //批量调度 只交换出任务 不碰调度队列
+    if(batch && ctx.scheduler == batch->scheduler)
+    {
+        if(ctx.cb)
+        {
+            batch->cbs.emplace_back();
+            batch->cbs.back().swap(ctx.cb);
+        }
+        else
+        {
+            batch->coroutines.emplace_back();
+            batch->coroutines.back().swap(ctx.coroutine);
+        }
+    }
+    else if(ctx.cb)
     {
         ctx.scheduler->schedule(&ctx.cb);
     }
@@ -71,6 +127,72 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event)
 IOManager::IOManager(const std::string& name, size_t threads_size, bool use_caller)
     :Scheduler(name, threads_size, use_caller)
 {
+    m_wakeupWindowStart = GetCurrentMs();
+
+    //创建eventfd句柄 读写共用一个fd 设置为非阻塞
+    m_tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(m_tickleFd < 0)
+    {
+        KIT_LOG_ERROR(g_logger) << "IOManager: eventfd create error";
+        KIT_ASSERT2(false, "eventfd create error");
+    }
+
+    //优先尝试io_uring 内核不支持时退回epoll
+    if(g_iomanager_backend->getValue() == "io_uring")
+    {
+        m_uring.reset(new IOUring);
+        if(m_uring->init(g_io_uring_entries->getValue()))
+        {
+            m_epfd = -1;
+            uringArmTickle();
+            m_uring->submit();
+
+            KIT_LOG_INFO(g_logger) << "IOManager: name=" << name << " use io_uring backend";
+            //启动IO调度器
+            start();
+            return;
+        }
+
+        KIT_LOG_WARN(g_logger) << "IOManager: name=" << name << " io_uring unavailable, fall back to epoll";
+        m_uring.reset();
+    }
+
+    //每个调度线程一个epoll和eventfd 唤醒时只惊动一个线程
+    if(g_iomanager_per_thread_epoll->getValue())
+    {
+        m_epfd = -1;
+        for(size_t i = 0;i < getWorkerCount();++i)
+        {
+            std::unique_ptr<EpollWorker> worker(new EpollWorker);
+            worker->epfd = epoll_create(1);
+            worker->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if(worker->epfd < 0 || worker->tickleFd < 0)
+            {
+                KIT_LOG_ERROR(g_logger) << "IOManager: create epoll/eventfd error";
+                KIT_ASSERT2(false, "create per thread epoll error");
+            }
+
+            struct epoll_event event;
+            memset(&event, 0, sizeof(struct epoll_event));
+            event.events = EPOLLIN | EPOLLET;
+            event.data.fd = worker->tickleFd;
+            if(epoll_ctl(worker->epfd, EPOLL_CTL_ADD, worker->tickleFd, &event) < 0)
+            {
+                KIT_LOG_ERROR(g_logger) << "IOManager: epoll_ctl";
+                KIT_ASSERT2(false, "epoll_ctl error");
+            }
+
+            m_workers.push_back(std::move(worker));
+        }
+
+        //定时器也按线程划分 每个线程只处理自己的时间轮
+        setTimerWheels(m_workers.size());
+
+        KIT_LOG_INFO(g_logger) << "IOManager: name=" << name << " use per thread epoll, workers=" << m_workers.size();
+        start();
+        return;
+    }
+
     //创建epoll句柄
     m_epfd = epoll_create(1);
     if(m_epfd < 0)
@@ -79,42 +201,22 @@ IOManager::IOManager(const std::string& name, size_t threads_size, bool use_call
         KIT_ASSERT2(false, "epoll_create error");
     }
 
-    //创建管道句柄
-    int ret = pipe(m_tickleFds);
-    if(ret < 0)
-    {
-        KIT_LOG_ERROR(g_logger) << "IOManager: pipe create error";
-        KIT_ASSERT2(false, "pipe create error");
-    }
-
     //初始化epoll事件
     struct epoll_event event;
     memset(&event, 0, sizeof(struct epoll_event));
 
     //设置为 读事件触发 以及 边缘触发
     event.events = EPOLLIN | EPOLLET;
-    // [0]为读管道 [1]为写管道
-    event.data.fd = m_tickleFds[0];    
-
-    //设置读管道句柄属性 将读fd 设置为非阻塞
-    ret = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    if(ret < 0)
-    {
-        KIT_LOG_ERROR(g_logger) << "IOManager: fcntl error";
-        KIT_ASSERT2(false, "fcntl error");
-    }
+    event.data.fd = m_tickleFd;    
 
     //将当前的事件添加到epoll中
-    ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
+    int ret = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFd, &event);
     if(ret < 0)
     {
         KIT_LOG_ERROR(g_logger) << "IOManager: epoll_ctl";
         KIT_ASSERT2(false, "epoll_ctl error");
     }
 
-    //默认为个事件信息
-    contextResize(256);
-
     //启动IO调度器
     start();
 }
@@ -124,66 +226,61 @@ IOManager::~IOManager()
     //停止调度器
     stop();
 
-    close(m_epfd);          //关闭epoll句柄
-    close(m_tickleFds[0]);  //关闭读管道句柄
-    close(m_tickleFds[1]);  //关闭写管道句柄
-
-    //删除事件对象分配的空间
-    //不使用智能指针的原因：要把空间释放集中到持有调度器的这个线程中
-    for(size_t i = 0;i < m_fdContexts.size();++i)
+    if(m_epfd >= 0)
+        close(m_epfd);      //关闭epoll句柄
+    m_uring.reset();        //关闭io_uring
+    for(auto& worker : m_workers)
     {
-        if(m_fdContexts[i])
-            delete m_fdContexts[i];
+        close(worker->epfd);
+        close(worker->tickleFd);
     }
-}
-
-//句柄对象初始化
-void IOManager::contextResize(size_t size)
-{
-    m_fdContexts.resize(size);
+    close(m_tickleFd);      //关闭eventfd句柄
 
-    for(size_t i = 0;i < m_fdContexts.size();++i)
-    {
-        if(!m_fdContexts[i])
+    //句柄表是全局的 不随调度器释放 只解除本调度器对句柄的占用
+    FdMgr::GetInstance()->foreach([this](FdCtx* ctx){
+        FdContext* fd_ctx = &ctx->m_ioContext;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if(fd_ctx->manager == this)
         {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
+            fd_ctx->manager = nullptr;
+            fd_ctx->worker = -1;
         }
-    }
-
+    });
 }
 
+//获取句柄对象
+IOManager::FdContext* IOManager::getFdContext(int fd, bool auto_create)
+{
+    FdCtx* ctx = FdMgr::GetInstance()->getSlot(fd, auto_create);
+    return ctx ? &ctx->m_ioContext : nullptr;
+}
 
 //添加事件 0成功 -1出错
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 {
-    FdContext *fd_ctx = nullptr;
-
     /*拿到对应的 句柄对象  没有就创建*/
-    //给句柄队列加读锁
-    MutexType::ReadLock lock(m_mutex); 
-
-    if((int)m_fdContexts.size() > fd)
-    {
-        //KIT_LOG_DEBUG(g_logger) << "存在并取出 fd = " << fd;
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();  //解读锁
-    }
-    else  //事件对象扩容
+    FdContext *fd_ctx = getFdContext(fd, true);
+    if(KIT_UNLIKELY(!fd_ctx))
     {
-        //解读锁
-        lock.unlock();
-        //给句柄队列加写锁
-        MutexType::WriteLock lock2(m_mutex);
-        
-        KIT_LOG_DEBUG(g_logger) << "fd不存在并扩容,fd=" << fd;
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+        KIT_LOG_ERROR(g_logger) << "addEvent: fd out of range, fd=" << fd;
+        return -1;
     }
 
     //给句柄资源加互斥锁
     FdContext::MutexType::Lock _lock(fd_ctx->mutex);
 
+    //句柄上的事件还注册在其他调度器上
+    if(KIT_UNLIKELY(getOtherOwner(fd_ctx)))
+    {
+        KIT_LOG_ERROR(g_logger) << "addEvent: fd=" << fd << " has events on another iomanager";
+        return -1;
+    }
+    if(fd_ctx->manager != this)
+    {
+        fd_ctx->manager = this;
+        fd_ctx->worker = -1;
+    }
+
     /*设置句柄对象的信息*/
     //同一个句柄上面不能加加相同的事件
     //如果有这种情况出现 说明有多个线程在操作同一个句柄
@@ -195,21 +292,36 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
         KIT_ASSERT(!(fd_ctx->events & event));
     }
 
-    //判断本次事件修改还是新增
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-
-    struct epoll_event ev;
-    ev.events = EPOLLET | fd_ctx->events | event;
-    ev.data.ptr = fd_ctx;
-
-    //将事件添加/修改到epoll
-    int ret = epoll_ctl(m_epfd, op, fd, &ev);
-    if(ret < 0)
+    if(m_uring)
+    {
+        //io_uring后端 每个事件提交一个一次性的poll
+        if(!uringArm(fd_ctx, event, nullptr))
+            return -1;
+    }
+    else
     {
-        KIT_LOG_ERROR(g_logger) << "\naddEvent: epoll_ctl(" << m_epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
-        << " error:" << ret << "(" << errno << "," << strerror(errno) << ")"; 
+        //每线程epoll模式下 句柄第一次注册时确定所属线程 之后一直由它处理
+        //epoll_ctl本身是线程安全的 其他线程直接注册到所属线程的epoll即可
+        if(!m_workers.empty() && fd_ctx->worker < 0)
+            fd_ctx->worker = selectWorker();
+        int epfd = getEpfd(fd_ctx);
+
+        //判断本次事件修改还是新增
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+        struct epoll_event ev;
+        ev.events = EPOLLET | fd_ctx->events | event;
+        ev.data.ptr = fd_ctx;
+
+        //将事件添加/修改到epoll
+        int ret = epoll_ctl(epfd, op, fd, &ev);
+        if(ret < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "\naddEvent: epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
+            << " error:" << ret << "(" << errno << "," << strerror(errno) << ")";
 
-        return -1;
+            return -1;
+        }
     }
 
     //待处理事件自增
@@ -246,18 +358,20 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 //为句柄删除事件
 bool IOManager::delEvent(int fd, Event event)
 {
-    MutexType::ReadLock lock(m_mutex);
     //句柄对象不存在不用删除
-    if((int)m_fdContexts.size() <= fd)
-    {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx)
         return false;
-    }   
-
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     //给句柄资源加互斥锁
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+
+    //事件注册在其他调度器上 交给它处理
+    if(IOManager* owner = getOtherOwner(fd_ctx))
+    {
+        lock2.unlock();
+        return owner->delEvent(fd, event);
+    }
     //该句柄上没有对应事件 不用删除
     if(!(fd_ctx->events & event))
     {
@@ -267,22 +381,32 @@ bool IOManager::delEvent(int fd, Event event)
     //取反运算+与运算 就是去掉该事件event
     Event left_events = (Event)(fd_ctx->events & ~event);
 
-    //去掉之后看句柄上还是否有剩余的事件  有就修改epoll 没有了就从epoll删除
-    int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-
-    //构造epoll_event事件
-    struct epoll_event ev;
-    ev.events = EPOLLET | left_events;
-    ev.data.ptr = fd_ctx;
-
-    //将事件添加/修改到epoll
-    int ret = epoll_ctl(m_epfd, op, fd, &ev);
-    if(ret < 0)
+    if(m_uring)
+    {
+        //IO操作还在访问用户缓冲区 不能直接丢弃 只能等它被取消后唤醒协程
+        if(uringCancel(fd_ctx, event))
+            return true;
+    }
+    else
     {
-        KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << m_epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
-        << " error:" << ret << "(" << errno << "," << strerror(errno) << ")"; 
+        //去掉之后看句柄上还是否有剩余的事件  有就修改epoll 没有了就从epoll删除
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+
+        //构造epoll_event事件
+        struct epoll_event ev;
+        ev.events = EPOLLET | left_events;
+        ev.data.ptr = fd_ctx;
+
+        //将事件添加/修改到epoll
+        int epfd = getEpfd(fd_ctx);
+        int ret = epoll_ctl(epfd, op, fd, &ev);
+        if(ret < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
+            << " error:" << ret << "(" << errno << "," << strerror(errno) << ")";
 
-        return false;
+            return false;
+        }
     }
 
 
@@ -303,42 +427,53 @@ bool IOManager::delEvent(int fd, Event event)
 //取消事件  找到对应事件强制触发执行 不等待条件满足
 bool IOManager::cancelEvent(int fd, Event event)
 {
-    MutexType::ReadLock lock(m_mutex);
     //句柄不存在不用触发
-    if((int)m_fdContexts.size() <= fd)
-    {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx)
         return false;
-    }   
-
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+
+    if(IOManager* owner = getOtherOwner(fd_ctx))
+    {
+        lock2.unlock();
+        return owner->cancelEvent(fd, event);
+    }
     //该句柄上没有对应事件 不用触发
     if(!(fd_ctx->events & event))
     {
         return false;
     }
 
-    //取反运算 + 与运算 就是去掉该事件
-    Event left_events = (Event)(fd_ctx->events & ~event);
-    
-    //去掉之后看句柄上还是否有剩余的事件  有就修改epoll 没有了就从epoll删除
-    int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-
-    //构造epoll_event事件
-    struct epoll_event ev;
-    ev.events = EPOLLET | left_events;
-    ev.data.ptr = fd_ctx;
-
-    //将事件添加/修改到epoll
-    int ret = epoll_ctl(m_epfd, op, fd, &ev);
-    if(ret < 0)
+    if(m_uring)
+    {
+        //IO操作由它的完成事件唤醒协程
+        if(uringCancel(fd_ctx, event))
+            return true;
+    }
+    else
     {
-        KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << m_epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
-        << " error:" << ret << "(" << errno << "," << strerror(errno) << ")"; 
+        //取反运算 + 与运算 就是去掉该事件
+        Event left_events = (Event)(fd_ctx->events & ~event);
+        
+        //去掉之后看句柄上还是否有剩余的事件  有就修改epoll 没有了就从epoll删除
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+
+        //构造epoll_event事件
+        struct epoll_event ev;
+        ev.events = EPOLLET | left_events;
+        ev.data.ptr = fd_ctx;
+
+        //将事件添加/修改到epoll
+        int epfd = getEpfd(fd_ctx);
+        int ret = epoll_ctl(epfd, op, fd, &ev);
+        if(ret < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
+            << " error:" << ret << "(" << errno << "," << strerror(errno) << ")";
 
-        return false;
+            return false;
+        }
     }
 
 
@@ -356,44 +491,65 @@ bool IOManager::cancelEvent(int fd, Event event)
 //为句柄取消所有事件
 bool IOManager::cancelAll(int fd)
 {
-    MutexType::ReadLock lock(m_mutex);
     //句柄不存在不用删除
-    if((int)m_fdContexts.size() <= fd)
-    {
+    FdContext* fd_ctx = getFdContext(fd, false);
+    if(!fd_ctx)
         return false;
-    }   
-
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
     FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+
+    //关闭句柄的线程可能属于其他调度器 交给注册事件的调度器处理
+    if(IOManager* owner = getOtherOwner(fd_ctx))
+    {
+        lock2.unlock();
+        return owner->cancelAll(fd);
+    }
     //该句柄上没有对应事件 不用删除
     if(!fd_ctx->events)
     {
+        //句柄通常随后就被关闭 编号复用时重新分配所属线程
+        fd_ctx->worker = -1;
         return false;
     }
 
-    //直接从epoll里移除该事件
-    int op = EPOLL_CTL_DEL;
-
-    //构造epoll_event事件
-    struct epoll_event ev;
-    ev.events = 0;
-    ev.data.ptr = fd_ctx;
+    //IO操作要等完成事件 不在这里触发
+    bool read_op = false;
+    bool write_op = false;
 
-    //将事件删除到epoll
-    int ret = epoll_ctl(m_epfd, op, fd, &ev);
-    if(ret < 0)
+    if(m_uring)
+    {
+        if(fd_ctx->events & READ)
+            read_op = uringCancel(fd_ctx, READ);
+        if(fd_ctx->events & WRITE)
+            write_op = uringCancel(fd_ctx, WRITE);
+    }
+    else
     {
-        KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << m_epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
-        << " error:" << ret << "(" << errno << "," << strerror(errno) << ")"; 
+        //直接从epoll里移除该事件
+        int op = EPOLL_CTL_DEL;
+
+        //构造epoll_event事件
+        struct epoll_event ev;
+        ev.events = 0;
+        ev.data.ptr = fd_ctx;
+
+        //将事件删除到epoll
+        int epfd = getEpfd(fd_ctx);
+        int ret = epoll_ctl(epfd, op, fd, &ev);
+        if(ret < 0)
+        {
+            KIT_LOG_ERROR(g_logger) << "\ndelEvent: epoll_ctl(" << epfd << ", " << op << ", " << fd << ", " << ev.events << ");\n"
+            << " error:" << ret << "(" << errno << "," << strerror(errno) << ")";
 
-        return false;
+            return false;
+        }
+
+        fd_ctx->worker = -1;
     }
 
  
 
-    if(fd_ctx->events & READ)
+    if((fd_ctx->events & READ) && !read_op)
     {
         //事件对象 主动触发读事件对象上的回调
         fd_ctx->triggerEvent(READ);
@@ -402,7 +558,7 @@ bool IOManager::cancelAll(int fd)
         --m_pendingEventCount;
     }
     
-    if(fd_ctx->events & WRITE)
+    if((fd_ctx->events & WRITE) && !write_op)
     {
 
         //事件对象 主动触发写事件对象上的回调
@@ -413,14 +569,62 @@ bool IOManager::cancelAll(int fd)
 
     }
 
-    //句柄对象上的注册事件应该为NONE = 0
-    KIT_ASSERT(fd_ctx->events == 0);
+    //句柄对象上的注册事件应该为NONE = 0 只剩下等待取消完成的IO操作
+    KIT_ASSERT(fd_ctx->events == ((read_op ? READ : NONE) | (write_op ? WRITE : NONE)));
 
     return true;
 
 
 }
 
+//提交IO操作 0成功 -1出错
+int IOManager::addOp(int fd, Event event, const OpPrep& prep, int* result)
+{
+    KIT_ASSERT(m_uring && result);
+
+    FdContext *fd_ctx = getFdContext(fd, true);
+    if(KIT_UNLIKELY(!fd_ctx))
+    {
+        KIT_LOG_ERROR(g_logger) << "addOp: fd out of range, fd=" << fd;
+        return -1;
+    }
+
+    FdContext::MutexType::Lock _lock(fd_ctx->mutex);
+
+    if(KIT_UNLIKELY(getOtherOwner(fd_ctx)))
+    {
+        KIT_LOG_ERROR(g_logger) << "addOp: fd=" << fd << " has events on another iomanager";
+        return -1;
+    }
+    fd_ctx->manager = this;
+
+    //同一个句柄上面不能加加相同的事件
+    if(KIT_UNLIKELY(fd_ctx->events & event))   
+    {
+        KIT_LOG_ERROR(g_logger) << "addOp: event exists, fd= " << fd
+            << ", event=" << event
+            << ";exist event=" << fd_ctx->events;
+        KIT_ASSERT(!(fd_ctx->events & event));
+    }
+
+    if(!uringArm(fd_ctx, event, &prep))
+        return -1;
+
+    ++m_pendingEventCount;
+    fd_ctx->events = (Event)(fd_ctx->events | event);
+
+    FdContext::EventContext& event_contex = fd_ctx->getEventContext(event);
+    KIT_ASSERT(!event_contex.scheduler && !event_contex.coroutine && !event_contex.cb);
+
+    //操作完成后继续执行当前协程
+    event_contex.scheduler = Scheduler::GetThis();
+    event_contex.coroutine = Coroutine::GetThis();
+    event_contex.result = result;
+    KIT_ASSERT2(event_contex.coroutine->getState() == Coroutine::State::EXEC,  "thread id=" << GetThreadId() << ",coroutine id=" << event_contex.coroutine->getID() << ",state=" << event_contex.coroutine->getState());
+
+    return 0;
+}
+
 //获取当前调度器的指针 这里是不是不太规范？？？ 向下转型。
 //这里使用向下转型的目的：是去访问线程局部变量存储的Scheduler调度器的指针 进而访问到实体
 IOManager* IOManager::GetThis()
@@ -436,8 +640,34 @@ void IOManager::tickle()
     if(!isIdleThreads())
         return;
 
+    //每线程epoll模式 只唤醒一个正在空转且还没被唤醒的线程 从轮询位置开始找 分散唤醒
+    if(!m_workers.empty())
+    {
+        size_t size = m_workers.size();
+        size_t start = m_nextWorker++;
+        EpollWorker* target = nullptr;
+        for(size_t i = 0;i < size && !target;++i)
+        {
+            EpollWorker* worker = m_workers[(start + i) % size].get();
+            if(worker->idle && !worker->tickled)
+                target = worker;
+        }
+
+        //空闲线程还没进入idle() 留一个唤醒给轮询到的线程 它下一次epoll_wait会立即返回
+        if(!target)
+            target = m_workers[start % size].get();
+
+        tickleWorker(target);
+        return;
+    }
+
+    //已经有唤醒还没被处理 被唤醒的线程取任务时会继续唤醒其他线程 不用重复写
+    if(m_tickled.exchange(true))
+        return;
+
     //写入一个消息 以唤醒
-    int ret = write(m_tickleFds[1], "T", 1);
+    uint64_t one = 1;
+    int ret = write(m_tickleFd, &one, sizeof(one));
     if(ret < 0)
     {
         KIT_LOG_ERROR(g_logger) << "tickle: write error";
@@ -460,18 +690,26 @@ void IOManager::idle()
 {
     KIT_LOG_DEBUG(g_logger) << "idle start";
 
-    const uint64_t MAX_EVENTS = 256;
-    //4个一组 取出已经就绪的IO
-    struct epoll_event *events = new epoll_event[MAX_EVENTS];
+    //就绪事件数组 一次取满说明还有积压 翻倍扩容减少epoll_wait的次数
+    std::vector<struct epoll_event> events(256);
+    const size_t max_events = std::max(g_iomanager_max_events->getValue(), (uint32_t)events.size());
 
-    //小技巧：借助智能指针的指定析构函数  自动释放数组
-    std::shared_ptr<struct epoll_event> evs_sp(events, [](struct epoll_event* p){
-        delete[] p;
-    });
+    //就绪事件的任务先收集起来 每次等待返回后一次性调度
+    EventBatch batch;
+    batch.scheduler = this;
+
+    //每线程epoll模式下 只等待本线程的epoll
+    EpollWorker* worker = m_workers.empty() ? nullptr : m_workers[getWorkerIndex()].get();
+    int epfd = worker ? worker->epfd : m_epfd;
+    int tickle_fd = worker ? worker->tickleFd : m_tickleFd;
 
     while(1)
     {
+        if(worker)
+            worker->idle = true;
 
+        //获取下一次定时器的执行时间 顺带执行收件箱里的操作 没被唤醒处理的取消要先摘下再判断停止
+        uint64_t next_timeout = getNextTime();
              
         /*1.如果调度器关闭了 就退出该函数*/
         if(stopping())
@@ -479,13 +717,15 @@ void IOManager::idle()
         
             KIT_LOG_INFO(g_logger) << "iomanager name= " << getName() << " is stopping, idle func exit";
 
+            //多次唤醒被合并成一次 退出前接力唤醒还在epoll_wait的线程
+            if(worker)
+                worker->idle = false;
+            tickle();
+
             return;
             
         }
 
-        //获取下一次定时器的执行时间
-        uint64_t next_timeout = getNextTime();
-
 
         /*2.通过epoll_wait 带回已经就绪的IO*/
         int n_ready = 0;
@@ -503,7 +743,15 @@ void IOManager::idle()
                 next_timeout = MAXTIMEOUT;
             }
 
-            n_ready = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+            //io_uring后端 顺带批量提交积压的SQE 完成事件在下面统一处理
+            if(m_uring)
+            {
+                if(m_uring->wait((int)next_timeout) < 0 && errno == EINTR)
+                    continue;
+                break;
+            }
+
+            n_ready = epoll_wait(epfd, &events[0], events.size(), (int)next_timeout);
             //KIT_LOG_DEBUG(g_logger) << "epoll_wait n_ready=" <<  n_ready;
             if(n_ready < 0 && errno == EINTR)
                 continue;       //重新尝试等待wait
@@ -513,29 +761,43 @@ void IOManager::idle()
 
         }while(1);
 
-        /*3. 检查定时器队列 将所有到时定时器任务进行调度*/
-        std::vector<std::function<void()> > cbs;
-        listExpiredCb(cbs);
-        if(cbs.size())
+        //等待可能很久 刷新缓存的时间再处理定时器
+        uint64_t now_ms = UpdateCoarseMs();
+
+        //统计唤醒次数 每过一秒由一个线程结算上一个窗口的唤醒频率
+        uint64_t wakeups = ++m_wakeupCount;
+        uint64_t window_start = m_wakeupWindowStart;
+        if(now_ms >= window_start + 1000 && m_wakeupWindowStart.compare_exchange_strong(window_start, now_ms))
         {
-            KIT_LOG_DEBUG(g_logger) << "定时器到时调度";
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
+            uint64_t base = m_wakeupWindowBase.exchange(wakeups);
+            m_wakeupsPerSecond = (wakeups - base) * 1000 / (now_ms - window_start);
         }
 
+        /*3. 检查定时器队列 到时的定时器任务和就绪的IO一起调度*/
+        listExpiredCb(batch.cbs);
+
 
         /*4.依次处理已经就绪的IO*/
+        if(m_uring)
+            uringHandleCompletions(batch);
+
         for(int i = 0;i < n_ready;++i)
         {
             struct epoll_event& event = events[i];
 
-            //过滤管道读端被消息唤醒  跳过
-            if(event.data.fd == m_tickleFds[0])
+            //过滤eventfd被消息唤醒  跳过
+            if(event.data.fd == tickle_fd)
             {
-                //KIT_LOG_DEBUG(g_logger) << "读管道活跃";
-                uint8_t temp[256];
-                //循环的目的 把缓冲区全部读干净
-                while(read(m_tickleFds[0], temp, sizeof(temp)) > 0);
+                //先清标志再读 保证之后的tickle一定会重新写eventfd
+                if(worker)
+                    worker->tickled = false;
+                else
+                    m_tickled = false;
+                //一次read就能把计数清零
+                uint64_t value = 0;
+                read(tickle_fd, &value, sizeof(value));
+                if(!worker)
+                    relayTimerTickle();
 
                 continue;
             }
@@ -577,10 +839,10 @@ void IOManager::idle()
             //复用event
             event.events = EPOLLET | left_events;
             
-            int ret = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
+            int ret = epoll_ctl(epfd, op, fd_ctx->fd, &event);
             if(ret < 0)
             {
-                KIT_LOG_ERROR(g_logger) << "\nidel: epoll_ctl(" << m_epfd << ", " << op << ", " << fd_ctx->fd << ", " << fd_ctx->events << ");\n"
+                KIT_LOG_ERROR(g_logger) << "\nidel: epoll_ctl(" << epfd << ", " << op << ", " << fd_ctx->fd << ", " << fd_ctx->events << ");\n"
                 << " error:" << ret << "(" << errno << "," << strerror(errno) << ")"; 
 
                 continue;
@@ -590,7 +852,7 @@ void IOManager::idle()
             if(real_events & READ)
             {
                 KIT_LOG_DEBUG(g_logger) << "idle 读事件触发";
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, &batch);
                 --m_pendingEventCount;
             }
 
@@ -598,7 +860,7 @@ void IOManager::idle()
             if(real_events & WRITE)
             {
                 KIT_LOG_DEBUG(g_logger) << "idle 写事件触发";
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, &batch);
                 --m_pendingEventCount;
             }
 
@@ -607,7 +869,16 @@ void IOManager::idle()
         }
         
 
+        //就绪的任务一次性放入调度队列 只唤醒一次
+        scheduleBatch(batch);
+
+        //事件数组被取满 下一次多取一些
+        if((size_t)n_ready == events.size() && events.size() < max_events)
+            events.resize(std::min(events.size() * 2, max_events));
+
         /*5.处理完就绪的IO  让出当前协程的执行权 到Scheduler::run中去*/
+        if(worker)
+            worker->idle = false;
         Coroutine::ptr cur = Coroutine::GetThis();
         auto p = cur.get();
         cur.reset();
@@ -619,13 +890,231 @@ void IOManager::idle()
 
 }
 
+//批量调度就绪事件
+void IOManager::scheduleBatch(EventBatch& batch)
+{
+    //协程和函数类型不同 各自一次批量放入 批量放入只在队列由空变非空时唤醒一次
+    if(!batch.coroutines.empty())
+    {
+        schedule(batch.coroutines.begin(), batch.coroutines.end());
+        batch.coroutines.clear();
+    }
+
+    if(!batch.cbs.empty())
+    {
+        KIT_LOG_DEBUG(g_logger) << "就绪事件批量调度";
+        schedule(batch.cbs.begin(), batch.cbs.end());
+        batch.cbs.clear();
+    }
+}
+
+//每线程epoll模式 选择句柄所属线程
+int IOManager::selectWorker()
+{
+    //use_caller的线程只有在stop()时才参与调度 不分配句柄给它 除非只有它一个线程
+    size_t children = getWorkerCount() - (m_mainThreadId != -1 ? 1 : 0);
+    int index = getWorkerIndex();
+    if(index >= 0 && (size_t)index < children)
+        return index;
+
+    return children ? m_nextWorker++ % children : 0;
+}
+
+//唤醒指定线程
+void IOManager::tickleWorker(EpollWorker* worker)
+{
+    if(worker->tickled.exchange(true))
+        return;
+
+    uint64_t one = 1;
+    if(write(worker->tickleFd, &one, sizeof(one)) < 0)
+    {
+        KIT_LOG_ERROR(g_logger) << "tickle: write error";
+        KIT_ASSERT2(false, "write error");
+    }
+}
+
+//当前线程拥有的时间轮
+int IOManager::getTimerWheelIndex()
+{
+    //和selectWorker()一致 use_caller的线程只在它是唯一调度线程时才拥有时间轮
+    int index = getWorkerIndex();
+    size_t children = getWorkerCount() - (m_mainThreadId != -1 ? 1 : 0);
+    if(index >= 0 && ((size_t)index < children || !children))
+        return index;
+
+    return -1;
+}
+
+//外部线程添加的定时器分给哪个线程
+size_t IOManager::selectTimerWheel()
+{
+    return selectWorker();
+}
+
+//时间轮收件箱有新的操作
+void IOManager::onTimerPosted(size_t index, bool lazy)
+{
+    //拥有者先置idle再取收件箱 这里先投递再看idle 两边总有一方能看到对方
+    //不在idle()中的线程回到idle()时自然会处理
+    //取消操作不用唤醒 但停止时要尽快摘下 否则stopping()要等到下一次超时
+    EpollWorker* worker = m_workers[index].get();
+    if(worker->idle && (!lazy || m_stopping))
+        tickleWorker(worker);
+}
+
 //实现TimerManger中的纯虚函数 唤醒epol_wait重新设置超时时间
 void IOManager::onTimerInsertedAtFront()
 {
+    //先记下通知 唤醒和任务的唤醒合并时 被唤醒的线程会接力
+    m_timerTickled = true;
     //唤醒一下 在epoll_wait的线程
     tickle();
 }
 
+//接力定时器插到队头的通知
+void IOManager::relayTimerTickle()
+{
+    //被唤醒的线程回到run()后可能去执行任务 其他空闲线程还在按旧的超时时间等待
+    //只有自己空闲时 回到idle()会重新计算超时时间 不用接力
+    if(m_timerTickled.exchange(false) && m_idleThreadCount > 1)
+        tickle();
+}
+
+
+
+//io_uring后端 提交poll或者IO操作
+bool IOManager::uringArm(FdContext* fd_ctx, Event event, const OpPrep* prep)
+{
+    FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
+
+    //序号区分同一个句柄先后提交的请求 取消后迟到的完成事件会被丢弃
+    ++event_ctx.seq;
+    uint64_t data = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? 1 : 2)
+        | ((uint64_t)event_ctx.seq << URING_SEQ_SHIFT);
+
+    bool ok = m_uring->push([&](struct io_uring_sqe* sqe){
+        if(prep)
+        {
+            (*prep)(sqe);
+        }
+        else
+        {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd_ctx->fd;
+            sqe->poll32_events = event == READ ? POLLIN : POLLOUT;
+        }
+        sqe->user_data = data;
+    });
+
+    if(!ok)
+    {
+        KIT_LOG_ERROR(g_logger) << "uringArm: push error, fd=" << fd_ctx->fd << ", event=" << event;
+        return false;
+    }
+
+    //有线程阻塞在io_uring_enter里 它们不会去提交 只能立即提交
+    //否则留给本线程下一次进入idle()时批量提交 积压太多也立即提交
+    static const uint32_t MAX_BATCH = 32;
+    if(isIdleThreads() || m_uring->pending() >= MAX_BATCH)
+        m_uring->submit();
+
+    return true;
+}
+
+//io_uring后端 取消poll或者IO操作
+bool IOManager::uringCancel(FdContext* fd_ctx, Event event)
+{
+    FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
+    bool is_op = event_ctx.result != nullptr;
+    uint64_t data = (uint64_t)(uintptr_t)fd_ctx | (event == READ ? 1 : 2)
+        | ((uint64_t)event_ctx.seq << URING_SEQ_SHIFT);
+
+    m_uring->push([&](struct io_uring_sqe* sqe){
+        sqe->opcode = is_op ? IORING_OP_ASYNC_CANCEL : IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = data;
+        sqe->user_data = URING_IGNORE;
+    });
+
+    //IO操作要尽快停下来 协程还在等它
+    if(is_op)
+        m_uring->submit();
+
+    return is_op;
+}
+
+//io_uring后端 监听eventfd
+void IOManager::uringArmTickle()
+{
+    m_uring->push([this](struct io_uring_sqe* sqe){
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_tickleFd;
+        sqe->poll32_events = POLLIN;
+        //multishot 触发一次之后不用重新提交
+        if(m_tickleMultishot)
+            sqe->len = IORING_POLL_ADD_MULTI;
+        sqe->user_data = URING_TICKLE;
+    });
+}
+
+//io_uring后端 处理完成事件
+void IOManager::uringHandleCompletions(EventBatch& batch)
+{
+    static const size_t MAX_EVENTS = 256;
+    std::vector<struct io_uring_cqe> cqes;
+    cqes.reserve(MAX_EVENTS);
+
+    while(m_uring->reap(cqes, MAX_EVENTS) > 0)
+    {
+        for(auto& cqe : cqes)
+        {
+            if(cqe.user_data == URING_TICKLE)
+            {
+                //先清标志再读 保证之后的tickle一定会重新写eventfd
+                m_tickled = false;
+                uint64_t value = 0;
+                read(m_tickleFd, &value, sizeof(value));
+                relayTimerTickle();
+
+                //poll已经结束 需要重新提交
+                if(!(cqe.flags & IORING_CQE_F_MORE))
+                {
+                    if(cqe.res == -EINVAL)
+                        m_tickleMultishot = false;
+                    uringArmTickle();
+                    m_uring->submit();
+                }
+                continue;
+            }
+
+            //取消操作等内部请求
+            if((cqe.user_data & URING_TAG_MASK) == URING_TAG_INTERNAL)
+                continue;
+
+            FdContext* fd_ctx = (FdContext*)(uintptr_t)(cqe.user_data & URING_PTR_MASK);
+            Event event = (cqe.user_data & URING_TAG_MASK) == 1 ? READ : WRITE;
+            uint16_t seq = (uint16_t)(cqe.user_data >> URING_SEQ_SHIFT);
+
+            FdContext::MutexType::Lock lock(fd_ctx->mutex);
+            FdContext::EventContext& event_ctx = fd_ctx->getEventContext(event);
+
+            //事件已经被删除/取消 或者已经被重新提交 是过期的完成事件
+            if(!(fd_ctx->events & event) || event_ctx.seq != seq)
+                continue;
 
+            if(event_ctx.result)
+            {
+                *event_ctx.result = cqe.res;
+                event_ctx.result = nullptr;
+            }
+
+            fd_ctx->triggerEvent(event, &batch);
+            --m_pendingEventCount;
+        }
 
-}
\ No newline at end of file
+        cqes.clear();
+    }
+}
+
+}
@@ -6,15 +6,20 @@
 #include "timer.h"
 #include <memory>
 
+struct io_uring_sqe;
+struct io_uring_cqe;
 
 namespace kit_server
 {
 
+class IOUring;
+
 /**
  * @brief IO调度器类
  */
 class IOManager: public Scheduler, public TimerManager
 {
+friend class FdCtx;
 public:
     /**
      * @brief 事件枚举类型 直接对标epoll里的事件赋值
@@ -28,6 +33,8 @@ public:
 public:
     typedef std::shared_ptr<IOManager> ptr;
     typedef RWMutex MutexType;
+    /// 填充io_uring提交项的函数
+    typedef std::function<void(struct io_uring_sqe*)> OpPrep;
 
     /**
      * @brief IO调度器类构造函数
@@ -80,6 +87,40 @@ public:
      */
     bool cancelAll(int fd);
 
+    /**
+     * @brief 把IO操作直接提交给io_uring 操作完成后唤醒当前协程 只在io_uring后端下可用
+     * @details 提交项先放入提交队列 由工作线程下一次进入idle()时批量提交
+     *          操作和事件共用句柄上的读/写位 可以被cancelEvent/cancelAll取消
+     *          取消后协程要等到操作真正结束(结果通常为-ECANCELED)才会被唤醒 保证内核不再访问用户缓冲区
+     * @param[in] fd 操作的句柄
+     * @param[in] event 操作占用的读/写事件
+     * @param[in] prep 填充提交项的函数 不需要设置user_data
+     * @param[out] result 操作结果 >=0成功 <0为-errno 协程被唤醒后有效
+     * @return 
+     *      @retval 0  提交成功
+     *      @retval -1 提交失败
+     */
+    int addOp(int fd, Event event, const OpPrep& prep, int* result);
+
+    /**
+     * @brief 是否使用io_uring后端
+     * @return true io_uring
+     * @return false epoll
+     */
+    bool isUring() const {return m_uring != nullptr;}
+
+    /**
+     * @brief 获取调度线程从epoll_wait/io_uring等待中返回的总次数
+     * @return uint64_t 
+     */
+    uint64_t getWakeupCount() const {return m_wakeupCount;}
+
+    /**
+     * @brief 获取上一个统计窗口(约1秒)内平均每秒的唤醒次数 用于衡量空转唤醒的开销
+     * @return uint64_t 
+     */
+    uint64_t getWakeupsPerSecond() const {return m_wakeupsPerSecond;}
+
 public:
     /**
      * @brief 获取当前线程运行的调度器this指针
@@ -106,16 +147,92 @@ protected:
     void idle() override;
 
     /**
-     * @brief 修改句柄对象数量
-     * @param[in] size 要修改到的数量
+     * @brief 定时器队列队头插入对象后进行epoll_wait超时更新
+     */
+    void onTimerInsertedAtFront() override;
+
+    /**
+     * @brief 每线程epoll模式下 当前线程拥有的时间轮就是自己的下标
+     * @return int 不拥有时间轮返回-1
      */
+    int getTimerWheelIndex() override;
 
-    void contextResize(size_t size);
+    /**
+     * @brief 每线程epoll模式下 外部线程添加的定时器按句柄的分配方式选择线程
+     * @return size_t 
+     */
+    size_t selectTimerWheel() override;
 
     /**
-     * @brief 定时器队列队头插入对象后进行epoll_wait超时更新
+     * @brief 每线程epoll模式下 唤醒时间轮的拥有者处理收件箱
+     * @param[in] index 时间轮下标
+     * @param[in] lazy 为true时(取消操作)只在调度器停止时唤醒
      */
-    void onTimerInsertedAtFront() override;
+    void onTimerPosted(size_t index, bool lazy) override;
+
+private:
+    struct FdContext;
+    struct EventBatch;
+
+    /**
+     * @brief 从全局句柄表获取句柄对象 无锁
+     * @param[in] fd 句柄
+     * @param[in] auto_create 句柄所在的段不存在时是否分配
+     * @return FdContext* 句柄超出范围或者不存在返回nullptr
+     */
+    FdContext* getFdContext(int fd, bool auto_create);
+
+    /**
+     * @brief 句柄上的事件注册在其他IO调度器上时 取出那个调度器 调用前需持有句柄对象锁
+     * @param[in] fd_ctx 句柄对象
+     * @return IOManager* 事件注册在本调度器或者没有事件时返回nullptr
+     */
+    IOManager* getOtherOwner(FdContext* fd_ctx) const
+    {
+        return fd_ctx->events && fd_ctx->manager && fd_ctx->manager != this ? fd_ctx->manager : nullptr;
+    }
+
+    /**
+     * @brief io_uring后端下为句柄提交一次性poll或者IO操作 调用前需持有句柄对象锁
+     * @param[in] fd_ctx 句柄对象
+     * @param[in] event 读/写事件
+     * @param[in] prep 填充IO操作的函数 为空则提交poll
+     * @return true 成功
+     * @return false 失败
+     */
+    bool uringArm(FdContext* fd_ctx, Event event, const OpPrep* prep);
+
+    /**
+     * @brief io_uring后端下取消句柄上的poll或者IO操作 调用前需持有句柄对象锁
+     * @param[in] fd_ctx 句柄对象
+     * @param[in] event 读/写事件
+     * @return true 取消的是IO操作 要等操作的完成事件再唤醒协程
+     * @return false 取消的是poll 可以直接触发事件
+     */
+    bool uringCancel(FdContext* fd_ctx, Event event);
+
+    /**
+     * @brief io_uring后端下为eventfd提交poll 用于唤醒
+     */
+    void uringArmTickle();
+
+    /**
+     * @brief 共用epoll模式下读走唤醒消息后调用 唤醒里合并了定时器插到队头的通知时
+     *        接力唤醒另一个空闲线程 让它按新的队头定时器重新设置超时时间
+     */
+    void relayTimerTickle();
+
+    /**
+     * @brief 处理io_uring完成队列里的完成事件
+     * @param[in] batch 就绪事件批量调度对象
+     */
+    void uringHandleCompletions(EventBatch& batch);
+
+    /**
+     * @brief 把一批就绪事件的任务一次性交给调度器
+     * @param[in] batch 就绪事件批量调度对象
+     */
+    void scheduleBatch(EventBatch& batch);
 
 private:
     /**
@@ -136,6 +253,10 @@ private:
             Coroutine::ptr coroutine;
             //事件绑定的函数
             std::function<void()> cb;
+            //io_uring后端下每次提交自增 用来丢弃过期的完成事件
+            uint16_t seq = 0;
+            //io_uring后端下IO操作结果的存放位置 poll为空
+            int *result = nullptr;
 
         };
 
@@ -147,6 +268,10 @@ private:
         EventContext write_event;
         /// 套接字句柄上注册好的事件
         Event events = NONE;
+        /// 注册了事件的IO调度器 句柄表全局共用 同一时刻句柄只能在一个调度器上注册事件
+        IOManager* manager = nullptr;
+        /// 每线程epoll模式下 句柄所属的调度线程下标 -1为未分配
+        int worker = -1;
         /// 互斥锁
         MutexType mutex;
 
@@ -166,22 +291,90 @@ private:
         /**
          * @brief 主动触发事件，执行事件对象上的回调函数
          * @param[in] event 读/写事件 
+         * @param[in] batch 不为空时 属于同一调度器的任务先放入批量对象 由调用者统一调度
          */
-        void triggerEvent(Event event);
+        void triggerEvent(Event event, EventBatch* batch = nullptr);
+
+    };
 
+    /**
+     * @brief 一次等待返回的就绪事件批量调度对象
+     */
+    struct EventBatch
+    {
+        /// 批量调度的调度器 其他调度器上的事件仍然单独调度
+        Scheduler* scheduler = nullptr;
+        /// 就绪事件绑定的协程
+        std::vector<Coroutine::ptr> coroutines;
+        /// 就绪事件绑定的函数
+        std::vector<std::function<void()> > cbs;
     };
 
+    /**
+     * @brief 每线程epoll模式下 调度线程独占的epoll对象
+     */
+    struct EpollWorker
+    {
+        /// epoll句柄
+        int epfd = -1;
+        /// eventfd描述符 只唤醒这一个线程
+        int tickleFd = -1;
+        /// 是否正阻塞在epoll_wait中
+        std::atomic<bool> idle = {false};
+        /// 是否已经有未被处理的唤醒
+        std::atomic<bool> tickled = {false};
+    };
+
+    /**
+     * @brief 每线程epoll模式下 为还未分配的句柄选择所属调度线程
+     * @details 调度线程自己注册的句柄归自己 外部线程注册的句柄在子线程间轮询分配
+     * @return int 调度线程下标
+     */
+    int selectWorker();
+
+    /**
+     * @brief 每线程epoll模式下 唤醒指定的调度线程 已经有未处理的唤醒则跳过
+     * @param[in] worker 调度线程的epoll对象
+     */
+    void tickleWorker(EpollWorker* worker);
+
+    /**
+     * @brief 获取句柄所在的epoll句柄
+     * @param[in] fd_ctx 句柄对象
+     * @return int 
+     */
+    int getEpfd(FdContext* fd_ctx) const
+    {
+        return m_workers.empty() ? m_epfd : m_workers[fd_ctx->worker]->epfd;
+    }
+
 private:
     /// epoll句柄
     int m_epfd; 
-    /// 管道描述符 作为唤醒工具
-    int m_tickleFds[2];
+    /// eventfd描述符 作为唤醒工具
+    int m_tickleFd;
+    /// 是否已经有未被处理的唤醒 有则不再重复写eventfd
+    std::atomic<bool> m_tickled = {false};
+    /// 还没被处理的唤醒中 是否有定时器插到队头的通知 它不能和任务的唤醒一起被合并掉
+    std::atomic<bool> m_timerTickled = {false};
+    /// io_uring实例 为空则使用epoll
+    std::unique_ptr<IOUring> m_uring;
+    /// eventfd上的poll是否为multishot 不支持时每次触发后重新提交
+    bool m_tickleMultishot = true;
     /// 待处理事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    /// 读写锁
-    MutexType m_mutex;
-    /// 套接字句柄对象指针数组
-    std::vector<FdContext*> m_fdContexts;
+    /// 每线程epoll模式下 按调度线程下标排列的epoll对象 为空则所有线程共用m_epfd
+    std::vector<std::unique_ptr<EpollWorker> > m_workers;
+    /// 轮询下标 用于分配句柄以及选择唤醒的线程
+    std::atomic<size_t> m_nextWorker = {0};
+    /// 从epoll_wait/io_uring等待中返回的总次数
+    std::atomic<uint64_t> m_wakeupCount = {0};
+    /// 唤醒统计窗口的开始时间点
+    std::atomic<uint64_t> m_wakeupWindowStart = {0};
+    /// 唤醒统计窗口开始时的唤醒总次数
+    std::atomic<uint64_t> m_wakeupWindowBase = {0};
+    /// 上一个统计窗口内平均每秒的唤醒次数
+    std::atomic<uint64_t> m_wakeupsPerSecond = {0};
 };
 
 }
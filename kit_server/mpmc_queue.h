@@ -0,0 +1,187 @@
+#ifndef _KIT_MPMC_QUEUE_H_
+#define _KIT_MPMC_QUEUE_H_
+
+#include <atomic>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "noncopyable.h"
+
+
+namespace kit_server
+{
+
+/**
+ * @brief 有界无锁多生产者多消费者环形队列
+ * @details 槽位在构造时一次性分配 入队/出队只做原子操作和元素移动 不加锁也不分配内存
+ *          每个槽位带一个序号 生产者和消费者通过比较序号判断槽位是否可写/可读
+ * @tparam T 元素类型 需要支持默认构造和移动赋值
+ */
+template<class T>
+class MPMCQueue: Noncopyable
+{
+public:
+    /**
+     * @brief 环形队列构造函数
+     * @param[in] capacity 期望容量 会向上取整到2的幂
+     */
+    MPMCQueue(size_t capacity)
+        :m_cells(RoundUpPowerOfTwo(capacity))
+        ,m_mask(m_cells.size() - 1)
+    {
+        for(size_t i = 0;i < m_cells.size();++i)
+        {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief 入队
+     * @param[in] v 入队元素 成功后被移走
+     * @return true 入队成功
+     * @return false 队列已满
+     */
+    bool push(T& v)
+    {
+        Cell* cell = nullptr;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        while(1)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            //槽位空闲 抢占这个位置
+            if(dif == 0)
+            {
+                if(m_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0)    //槽位上一轮的数据还没被取走 队列满
+            {
+                return false;
+            }
+            else    //被其他生产者抢先 重新读取位置
+            {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->data = std::move(v);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @brief 出队
+     * @param[out] v 取出的元素
+     * @return true 出队成功
+     * @return false 队列为空
+     */
+    bool pop(T& v)
+    {
+        Cell* cell = nullptr;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        while(1)
+        {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            //槽位数据已经写好 抢占这个位置
+            if(dif == 0)
+            {
+                if(m_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if(dif < 0)    //槽位还没有写入数据 队列空
+            {
+                return false;
+            }
+            else    //被其他消费者抢先 重新读取位置
+            {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        v = std::move(cell->data);
+        //清空槽位 避免智能指针引用被环形队列延长
+        cell->data = T();
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+    /**
+     * @brief 获取队列中元素的大致数量 并发时只作参考
+     * @return size_t
+     */
+    size_t size() const
+    {
+        size_t enqueue = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t dequeue = m_dequeuePos.load(std::memory_order_relaxed);
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    /**
+     * @brief 队列是否为空 并发时只作参考
+     * @return true 空
+     * @return false 不为空
+     */
+    bool empty() const {return size() == 0;}
+
+    /**
+     * @brief 获取队列容量
+     * @return size_t
+     */
+    size_t capacity() const {return m_mask + 1;}
+
+private:
+    /**
+     * @brief 槽位结构体
+     */
+    struct Cell
+    {
+        /// 槽位序号
+        std::atomic<size_t> sequence;
+        /// 槽位数据
+        T data;
+    };
+
+    /// 缓存行大小
+    static const size_t CACHE_LINE_SIZE = 64;
+
+    /**
+     * @brief 向上取整到2的幂 方便用掩码取下标
+     * @param[in] v 原始值
+     * @return size_t
+     */
+    static size_t RoundUpPowerOfTwo(size_t v)
+    {
+        size_t size = 2;
+        while(size < v)
+            size <<= 1;
+
+        return size;
+    }
+
+private:
+    /// 槽位数组
+    std::vector<Cell> m_cells;
+    /// 下标掩码 容量-1
+    size_t m_mask;
+    /// 填充 防止和入队位置处于同一缓存行
+    char m_pad0[CACHE_LINE_SIZE];
+    /// 入队位置
+    std::atomic<size_t> m_enqueuePos = {0};
+    /// 填充 防止入队/出队位置伪共享
+    char m_pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    /// 出队位置
+    std::atomic<size_t> m_dequeuePos = {0};
+    /// 填充
+    char m_pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+};
+
+}
+
+#endif
@@ -3,6 +3,7 @@
 #include "macro.h"
 #include "util.h"
 #include "hook.h"
+#include "config.h"
 
 #include <string>
 #include <iostream>
@@ -12,8 +13,16 @@ namespace kit_server
 
 static Logger::ptr g_logger = KIT_LOG_NAME("system");
 
+/**
+ * @brief 配置项 每个调度线程无锁任务环形队列的容量
+ */
+static ConfigVar<uint32_t>::ptr g_scheduler_ring_size =
+    Config::LookUp("scheduler.ring_size", (uint32_t)1024, "scheduler lock-free task ring size per thread");
+
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Coroutine* t_sche_coroutine = nullptr;
+/// 当前线程在所属调度器中的本地队列下标
+static thread_local int t_queue_index = -1;
 
 
 Scheduler::Scheduler(const std::string& name, size_t threads_size, bool use_caller)
@@ -53,6 +62,20 @@ Scheduler::Scheduler(const std::string& name, size_t threads_size, bool use_call
     Thread::SetName(m_name);
 
     m_threadSum = threads_size;
+
+    //每个调度线程一个本地队列 子线程在前 use_caller的线程放在最后
+    size_t queue_size = m_threadSum + (use_caller ? 1 : 0);
+    size_t ring_size = g_scheduler_ring_size->getValue();
+    for(size_t i = 0;i < queue_size;++i)
+    {
+        m_queues.emplace_back(new WorkQueue(ring_size));
+    }
+
+    if(use_caller)
+    {
+        m_queues.back()->threadId = m_mainThreadId;
+        t_queue_index = m_queues.size() - 1;
+    }
 }
 
 
@@ -80,6 +103,12 @@ void Scheduler::start()
     m_stopping = false;
     KIT_ASSERT(m_threads.empty());
 
+    //stop()之后重新start() 上一轮的子线程都已经回收 本地队列重新分配
+    m_registeredCount = 0;
+    m_threadIds.resize(m_mainThreadId != -1 ? 1 : 0);
+    for(size_t i = 0;i < m_threadSum;++i)
+        m_queues[i]->threadId = -1;
+
     m_threads.resize(m_threadSum);
     for(size_t i = 0;i < m_threadSum;++i)
     {
@@ -210,7 +239,13 @@ void Scheduler::run()
     if(GetThreadId() != m_mainThreadId)
     {
         t_sche_coroutine = Coroutine::GetThis().get();
+
+        //子线程领取一个本地队列
+        t_queue_index = m_registeredCount++;
+        KIT_ASSERT(t_queue_index < (int)m_threadSum);
+        m_queues[t_queue_index]->threadId = GetThreadId();
     }
+    size_t index = t_queue_index;
 
     //创建一个专门跑idle()的协程
     Coroutine::ptr idle_coroutine(new Coroutine(std::bind(&Scheduler::idle, this)));
@@ -229,43 +264,14 @@ void Scheduler::run()
         //是一个信号 没轮到当前线程执行任务 就要发出信号通知下一个线程去处理
         bool is_tickle = false;
         bool is_work = false;
-        //加锁
-        {  
-            //取出协程消息队列的元素
-            MutexType::Lock lock(m_mutex);
-            auto it = m_coroutines.begin();
-            for(;it != m_coroutines.end();++it)
-            {
-                //a.当前任务没有指定线程执行 且 不是我当前线程要处理的协程 跳过
-                if(it->threadId != -1 && it->threadId != GetThreadId())
-                {
-                    is_tickle = true;
-                    continue;
-                }
-
-                KIT_ASSERT(it->cor || it->cb);
-
-                //b.契合线程的协程且正在处理  跳过
-                if(it->cor && it->cor->getState() == Coroutine::State::EXEC)
-                {
-                    continue;
-                }
-
-                //b.是我当前线程要处理的任务/协程 就取出并且删除
-                co = *it;
-                m_coroutines.erase(it);
-                ++m_activeThreadCount;
-                is_work = true;
-                break;
-                
-            }
+        //先取本地队列 取不到再去窃取其他线程的任务
+        size_t scanned = 0;
+        is_work = popTask(index, co, is_tickle, scanned);
+        if(scanned)
+            m_queues[index]->scannedCount.fetch_add(scanned, std::memory_order_relaxed);
 
-            is_tickle |= it != m_coroutines.end();
-     
-                
-            
-        }//解锁
-        
+        //每轮调度读一次时钟 这一轮里的定时器计算都用这个缓存
+        UpdateCoarseMs();
 
         if(is_tickle)
         {
@@ -303,13 +309,14 @@ void Scheduler::run()
         else if(co.cb)  //b. 如果要执行的任务是函数
         {
 
-            if(cb_coroutine)    //协程体的指针不为空就继续利用现有空间
+            //协程体的指针不为空且栈模式相同 就继续利用现有空间
+            if(cb_coroutine && cb_coroutine->isSharedStack() == co.sharedStack)
             {
                 cb_coroutine->reset(co.cb);
             }  
             else    //为空就重新开辟
             {
-                cb_coroutine.reset(new Coroutine(co.cb));
+                cb_coroutine.reset(new Coroutine(co.cb, 0, false, co.sharedStack));
             }
             //可执行对象置空
             co.reset();
@@ -376,8 +383,214 @@ void Scheduler::run()
 
     }
 
+    //线程不再调度 缓存的时间不会再刷新
+    ResetCoarseMs();
+
+}
+
+//放入任务
+bool Scheduler::pushTask(CoroutineObject& co)
+{
+    WorkQueue* queue = nullptr;
+    if(co.threadId != -1)
+    {
+        //指定了线程的任务 必须交给该线程处理
+        queue = findQueue(co.threadId);
+        if(KIT_UNLIKELY(!queue))
+        {
+            KIT_LOG_ERROR(g_logger) << "schedule: thread id=" << co.threadId 
+                << " not in scheduler name=" << m_name << ", ignore thread id";
+            co.threadId = -1;
+        }
+    }
+
+    if(queue)
+    {
+        //指定线程的任务只进收件箱 其他线程取任务时不用再逐个跳过
+        MutexType::Lock lock(queue->mutex);
+        bool isEmpty = queue->inbox.empty();
+        queue->inbox.push_back(co);
+        ++queue->inboxCount;
+        ++m_taskCount;
+
+        return isEmpty;
+    }
+
+    return pushLocal(selectQueue(), co);
+}
+
+//放入本地队列
+bool Scheduler::pushLocal(WorkQueue& queue, CoroutineObject& co)
+{
+    bool isEmpty = queue.ring.empty() && queue.tasksCount == 0;
+    //先计数再放入 保证取出时计数不会减为负数
+    ++m_taskCount;
+
+    //无锁环形队列 不加锁也不分配节点内存
+    if(queue.ring.push(co))
+        return isEmpty;
+
+    //环形队列满了 退回到加锁队列
+    MutexType::Lock lock(queue.mutex);
+    queue.tasks.push_back(co);
+    ++queue.tasksCount;
+
+    return isEmpty;
+}
+
+//选择任务队列
+Scheduler::WorkQueue& Scheduler::selectQueue()
+{
+    //调度线程自己放入的任务留在本地 保持局部性
+    if(t_scheduler == this && t_queue_index >= 0)
+        return *m_queues[t_queue_index];
+
+    return *m_queues[m_nextQueue++ % m_queues.size()];
+}
+
+//根据线程ID找队列
+Scheduler::WorkQueue* Scheduler::findQueue(pid_t threadId)
+{
+    for(auto &x : m_queues)
+    {
+        if(x->threadId == threadId)
+            return x.get();
+    }
+
+    return nullptr;
+}
+
+//取出任务
+bool Scheduler::popTask(size_t index, CoroutineObject& co, bool& is_tickle, size_t& scanned)
+{
+    WorkQueue& queue = *m_queues[index];
+
+    /*1.先取指定给本线程的任务*/
+    if(queue.inboxCount > 0)
+    {
+        MutexType::Lock lock(queue.mutex);
+        if(takeTask(queue.inbox, co, scanned))
+        {
+            --queue.inboxCount;
+            is_tickle = !queue.ring.empty() || queue.tasksCount > 0;
+            return true;
+        }
+    }
+
+    /*2.再取本地环形队列 环形队列满时溢出的任务在加锁队列*/
+    if(takeRing(queue, co, is_tickle, scanned))
+    {
+        //本地还有剩余任务 通知空闲线程来窃取
+        is_tickle = !queue.ring.empty() || queue.tasksCount > 0;
+        return true;
+    }
+
+    if(queue.tasksCount > 0)
+    {
+        MutexType::Lock lock(queue.mutex);
+        if(takeTask(queue.tasks, co, scanned))
+        {
+            --queue.tasksCount;
+            is_tickle = !queue.tasks.empty();
+            return true;
+        }
+    }
+
+    /*3.本地没有任务 从其他线程队列窃取*/
+    for(size_t i = 1;i < m_queues.size();++i)
+    {
+        WorkQueue& other = *m_queues[(index + i) % m_queues.size()];
+
+        //其他线程收件箱里有任务 通知对应线程处理
+        if(other.inboxCount > 0)
+            is_tickle = true;
+
+        if(takeRing(other, co, is_tickle, scanned))
+        {
+            //被窃取的线程还有任务 继续通知其他空闲线程
+            is_tickle = is_tickle || !other.ring.empty() || other.tasksCount > 0;
+            return true;
+        }
+
+        if(other.tasksCount == 0)
+            continue;
+
+        //加锁队列从队尾窃取
+        MutexType::Lock lock(other.mutex);
+        for(auto it = other.tasks.rbegin();it != other.tasks.rend();++it)
+        {
+            ++scanned;
+            if(it->cor && it->cor->getState() == Coroutine::State::EXEC)
+                continue;
+
+            co = *it;
+            other.tasks.erase(std::next(it).base());
+            --other.tasksCount;
+            ++m_activeThreadCount;
+            --m_taskCount;
+            is_tickle = is_tickle || !other.ring.empty() || other.tasksCount > 0;
 
+            return true;
+        }
+    }
 
+    return false;
+}
+
+//从环形队列取出任务
+bool Scheduler::takeRing(WorkQueue& queue, CoroutineObject& co, bool& is_tickle, size_t& scanned)
+{
+    if(!queue.ring.pop(co))
+        return false;
+
+    ++scanned;
+
+    KIT_ASSERT(co.cor || co.cb);
+
+    //协程还在其他线程上运行 放回队尾稍后再取
+    if(co.cor && co.cor->getState() == Coroutine::State::EXEC)
+    {
+        if(!queue.ring.push(co))
+        {
+            MutexType::Lock lock(queue.mutex);
+            queue.tasks.push_back(co);
+            ++queue.tasksCount;
+        }
+        co.reset();
+        is_tickle = true;
+
+        return false;
+    }
+
+    //先增加活跃数 再减少任务数 避免stopping()误判
+    ++m_activeThreadCount;
+    --m_taskCount;
+
+    return true;
+}
+
+//从队头取出一个可以执行的任务
+bool Scheduler::takeTask(std::deque<CoroutineObject>& tasks, CoroutineObject& co, size_t& scanned)
+{
+    for(auto it = tasks.begin();it != tasks.end();++it)
+    {
+        ++scanned;
+        KIT_ASSERT(it->cor || it->cb);
+
+        //正在处理的协程 跳过
+        if(it->cor && it->cor->getState() == Coroutine::State::EXEC)
+            continue;
+
+        co = *it;
+        tasks.erase(it);
+        //先增加活跃数 再减少任务数 避免stopping()误判
+        ++m_activeThreadCount;
+        --m_taskCount;
+
+        return true;
+    }
+
+    return false;
 }
 
 //唤醒函数
@@ -389,10 +602,8 @@ void Scheduler::tickle()
 //让子类有其他的清理功能
 bool Scheduler::stopping()
 {
-    MutexType::Lock lock(m_mutex);
-
     return m_autoStop && m_stopping &&
-        !m_coroutines.size() && m_activeThreadCount == 0;
+        m_taskCount == 0 && m_activeThreadCount == 0;
 }
 
 //协程空转函数
@@ -413,12 +624,39 @@ void Scheduler::idle()
 }
 
 
+//获取调度线程ID
+std::vector<int> Scheduler::getWorkerThreadIds()
+{
+    MutexType::Lock lock(m_mutex);
+    //use_caller的线程ID总是第一个放入
+    if(m_mainThreadId != -1 && m_threadIds.size() > 1)
+        return std::vector<int>(m_threadIds.begin() + 1, m_threadIds.end());
+
+    return m_threadIds;
+}
+
+//取任务时检查过的任务数 队列在构造时建好 不用加锁
+uint64_t Scheduler::getScannedCount()
+{
+    uint64_t count = 0;
+    for(auto &x : m_queues)
+        count += x->scannedCount.load(std::memory_order_relaxed);
+
+    return count;
+}
+
 //设置当前线程的调度器
 void Scheduler::setThis()
 {
     t_scheduler = this;
 }
 
+//获取当前线程在本调度器中的下标
+int Scheduler::getWorkerIndex() const
+{
+    return t_scheduler == this ? t_queue_index : -1;
+}
+
 //获取到调度器
 Scheduler* Scheduler::GetThis()
 {
@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
+#include <atomic>
 #include <functional>
 #include <pthread.h>
 #include <iostream>
@@ -12,6 +14,7 @@
 #include "thread.h"
 #include "mutex.h"
 #include "Log.h"
+#include "mpmc_queue.h"
 
 
 namespace kit_server
@@ -62,24 +65,43 @@ public:
      */
     bool isIdleThreads() {return m_idleThreadCount > 0;}
 
+    /**
+     * @brief 获取调度线程ID 有子线程时不包括use_caller的线程 它只在stop()时才参与调度
+     * @return std::vector<int> 调度器还没有start()时只有use_caller的线程
+     */
+    std::vector<int> getWorkerThreadIds();
+
+    /**
+     * @brief 获取队列中等待调度的任务数
+     * @return size_t 
+     */
+    size_t getTaskCount() const {return m_taskCount;}
+
+    /**
+     * @brief 获取所有线程取任务时检查过的任务数
+     * @details 每个任务只被检查一次时等于取出的任务数 多出来的是被跳过的任务
+     *          用来确认取任务的开销不随其他线程积压的任务增长
+     * @return uint64_t 
+     */
+    uint64_t getScannedCount();
+
     /**
      * @brief 将单个任务加入队列
      * @tparam CorOrCB 协程/函数类型
      * @param[in] cc 具体的被调度对象
      * @param[in] threadId 指定任务被哪一个线程调度 默认不指定
+     * @param[in] shared_stack 函数任务是否放在共享栈协程上执行 对协程任务无效 由协程自己决定
      */
     template<class CorOrCB>
-    void schedule(CorOrCB cc, int threadId = -1)
+    void schedule(CorOrCB cc, int threadId = -1, bool shared_stack = false)
     {
-        //该标志判断放入任务之前 队列是否空的
-        bool isEmpty = false;
-        {
-            MutexType::Lock lock(m_mutex);
-            isEmpty = scheduleNoLock(cc, threadId);
-        }
+        CoroutineObject co(cc, threadId);
+        if(!co.cor && !co.cb)
+            return;
+        co.sharedStack = shared_stack;
 
         //如果放入任务之前队列为空 要去唤醒线程抢任务
-        if(isEmpty)
+        if(pushTask(co))
             tickle();
     }
 
@@ -92,15 +114,19 @@ public:
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end)
     {
+        //批量任务放入同一个队列
+        WorkQueue& queue = selectQueue();
         bool isEmpty = false;
+        while(begin != end)
         {
-            MutexType::Lock lock(m_mutex);
-            while(begin != end)
+            CoroutineObject co((&(*begin)), -1);
+            if(co.cor || co.cb)
             {
                 //只要有一次为真 就认为之前经历了空队列  必然有休眠 就必然要唤醒
-                isEmpty = scheduleNoLock((&(*begin))) || isEmpty; 
-                ++begin;
+                //绑定了线程的共享栈协程要交给对应线程
+                isEmpty = (co.threadId == -1 ? pushLocal(queue, co) : pushTask(co)) || isEmpty;
             }
+            ++begin;
         }
 
         if(isEmpty)
@@ -135,29 +161,17 @@ protected:
      */
     void setThis();
 
-private:
     /**
-     * @brief 真正执行任务添加动作
-     * @tparam CorOrCB 协程/函数类型
-     * @param[in] cc 具体的被调度对象
-     * @param[in] threadId 指定任务被哪一个线程调度 默认不指定
-     * @return true 放入任务之前队列为空
-     * @return false 放入任务之前队列不空
+     * @brief 获取当前线程在本调度器中的下标 与本地任务队列下标一致
+     * @return int 不是本调度器的调度线程返回-1
      */
-    template<class CorOrCB>
-    bool scheduleNoLock(CorOrCB cc, int threadId = -1)
-    {
-        //如果为 true 则说明之前没有任何任务需要执行 现在放入一个任务
-        bool isEmpty = m_coroutines.empty();
-
-        CoroutineObject co(cc, threadId);
-        if(co.cor || co.cb)
-        {
-            m_coroutines.push_back(co);
-        }
+    int getWorkerIndex() const;
 
-        return isEmpty; 
-    }
+    /**
+     * @brief 获取调度线程总数 包括use_caller的线程 子线程下标在前 use_caller的线程下标在最后
+     * @return size_t 
+     */
+    size_t getWorkerCount() const {return m_queues.size();}
 
 public:
     /**
@@ -184,15 +198,21 @@ private:
         std::function<void()> cb;
         /// 指定的执行线程
         pid_t threadId;
+        /// 函数任务是否在共享栈协程上执行
+        bool sharedStack = false;
 
         CoroutineObject(Coroutine::ptr p, pthread_t t)
-            :cor(p), threadId(t){ }
+            :cor(p), threadId(t)
+        {
+            bindThread();
+        }
 
         CoroutineObject(Coroutine::ptr* p, pthread_t t)
             :threadId(t)
         { 
             //减少一次智能指针引用
             cor.swap(*p);
+            bindThread();
         }    
 
         CoroutineObject(std::function<void()> f, pthread_t t)
@@ -214,10 +234,113 @@ private:
             cor = nullptr;
             cb = nullptr;
             threadId = -1;
+            sharedStack = false;
+        }
+
+        /**
+         * @brief 共享栈协程运行过之后只能回到原来的线程上执行
+         */
+        void bindThread()
+        {
+            if(threadId == -1 && cor)
+                threadId = cor->getBoundThread();
         }
 
     };
 
+    /**
+     * @brief 工作线程本地任务队列结构体
+     */
+    struct WorkQueue
+    {
+        /**
+         * @brief 本地任务队列构造函数
+         * @param[in] ring_size 无锁环形队列容量
+         */
+        WorkQueue(size_t ring_size)
+            :ring(ring_size) { }
+
+        /// 无锁环形队列 任务提交的主路径 槽位预先分配
+        MPMCQueue<CoroutineObject> ring;
+        /// 互斥锁
+        MutexType mutex;
+        /// 环形队列满时退回使用的加锁队列 本线程从队头取 其他线程从队尾窃取
+        std::deque<CoroutineObject> tasks;
+        /// 加锁队列中的任务数 供无锁查看
+        std::atomic<size_t> tasksCount = {0};
+        /// 指定本线程执行的任务收件箱 只有本线程会取 不参与窃取
+        std::deque<CoroutineObject> inbox;
+        /// 收件箱中的任务数 供其他线程无锁查看
+        std::atomic<size_t> inboxCount = {0};
+        /// 队列所属线程ID 线程开始调度前为-1
+        std::atomic<pid_t> threadId = {-1};
+        /// 本线程取任务时检查过的任务数 包括从其他线程窃取时检查的
+        std::atomic<uint64_t> scannedCount = {0};
+    };
+
+    /**
+     * @brief 将任务放入对应线程的本地队列
+     * @param[in] co 被调度对象
+     * @return true 放入任务之前队列为空
+     * @return false 放入任务之前队列不空
+     */
+    bool pushTask(CoroutineObject& co);
+
+    /**
+     * @brief 将无指定线程的任务放入某个本地队列 优先放入无锁环形队列
+     * @param[in] queue 本地队列
+     * @param[in] co 被调度对象
+     * @return true 放入任务之前队列为空
+     * @return false 放入任务之前队列不空
+     */
+    bool pushLocal(WorkQueue& queue, CoroutineObject& co);
+
+    /**
+     * @brief 从本地队列的环形队列取出一个可以执行的任务
+     * @param[in] queue 本地队列
+     * @param[out] co 取出的被调度对象
+     * @param[out] is_tickle 取出的协程还在运行被放回时置为true
+     * @param[out] scanned 累加检查过的任务数
+     * @return true 取到任务
+     * @return false 没有取到任务
+     */
+    bool takeRing(WorkQueue& queue, CoroutineObject& co, bool& is_tickle, size_t& scanned);
+
+    /**
+     * @brief 选择无指定线程任务要放入的队列
+     * @details 调度线程放入自己的本地队列 外部线程轮询放入
+     * @return WorkQueue& 
+     */
+    WorkQueue& selectQueue();
+
+    /**
+     * @brief 根据线程ID找到对应的本地队列
+     * @param[in] threadId 线程ID 
+     * @return WorkQueue* 没有找到返回nullptr
+     */
+    WorkQueue* findQueue(pid_t threadId);
+
+    /**
+     * @brief 从本地队列取任务 取不到就去其他线程队列窃取
+     * @param[in] index 当前线程本地队列下标
+     * @param[out] co 取出的被调度对象
+     * @param[out] is_tickle 是否还有任务需要唤醒其他线程
+     * @param[out] scanned 累加检查过的任务数
+     * @return true 取到任务
+     * @return false 没有取到任务
+     */
+    bool popTask(size_t index, CoroutineObject& co, bool& is_tickle, size_t& scanned);
+
+    /**
+     * @brief 从队列队头取出一个可以执行的任务 调用前需持有队列锁
+     * @param[in] tasks 任务队列
+     * @param[out] co 取出的被调度对象
+     * @param[out] scanned 累加检查过的任务数
+     * @return true 取到任务
+     * @return false 没有取到任务
+     */
+    bool takeTask(std::deque<CoroutineObject>& tasks, CoroutineObject& co, size_t& scanned);
+
 
 protected:
     /// 线程ID数组
@@ -238,8 +361,14 @@ protected:
 private:    
     /// 线程池 工作队列
     std::vector<Thread::ptr> m_threads;
-    /// 任务队列
-    std::list<CoroutineObject> m_coroutines;
+    /// 每个调度线程的本地任务队列
+    std::vector<std::unique_ptr<WorkQueue> > m_queues;
+    /// 已经开始调度的子线程数 用于分配本地队列
+    std::atomic<size_t> m_registeredCount = {0};
+    /// 外部线程投递任务时的轮询下标
+    std::atomic<size_t> m_nextQueue = {0};
+    /// 所有队列中的任务总数
+    std::atomic<size_t> m_taskCount = {0};
     /// 互斥锁
     MutexType m_mutex;
     /// 主协程智能指针 
@@ -201,9 +201,11 @@ bool Socket::setOption(int level, int option, const void* result, size_t len)
 //accept API
 Socket::ptr Socket::accept()
 {
-    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
 
-    int ac_fd = ::accept(m_fd, nullptr, nullptr);
+    //accept4创建时就设置CLOEXEC hook下新句柄在内核层面已经是非阻塞的 不用再fcntl
+    int ac_fd = ::accept4(m_fd, (struct sockaddr*)&addr, &len, SOCK_CLOEXEC);
     if(ac_fd < 0)
     {
         KIT_LOG_ERROR(g_logger) << "accept errno =" << errno << ", is:" <<strerror(errno);
@@ -211,14 +213,65 @@ Socket::ptr Socket::accept()
         return nullptr;
     }
 
-    if(sock->init(ac_fd))
-        return sock;
+    return newAccepted(ac_fd, (struct sockaddr*)&addr, len);
+}
+
+//批量accept
+size_t Socket::accept(std::vector<Socket::ptr>& clients, size_t max, uint64_t recv_timeout)
+{
+    //第一个连接走hook 没有连接时让出协程等待
+    Socket::ptr sock = accept();
+    if(!sock)
+        return 0;
     
-    return nullptr;
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(m_fd);
+    //监听套接字在内核层面非阻塞时才能继续取 不然会阻塞住线程
+    bool drain = IsHookEnable() && ctx && ctx->getSysNonblock();
+    size_t count = 0;
+    while(sock)
+    {
+        if(recv_timeout != (uint64_t)-1)
+        {
+            //hook下超时只由句柄对象记录 内核上的超时对非阻塞句柄没有作用 省掉setsockopt
+            FdCtx::ptr client_ctx = drain ? FdMgr::GetInstance()->get(sock->m_fd) : nullptr;
+            if(client_ctx)
+                client_ctx->setTimeout(SO_RCVTIMEO, recv_timeout);
+            else
+                sock->setRecvTimeout(recv_timeout);
+        }
+
+        clients.push_back(sock);
+        sock.reset();
+        ++count;
+        if(!drain || count >= max)
+            break;
+        
+        struct sockaddr_storage addr;
+        socklen_t len;
+        int ac_fd;
+        do
+        {
+            len = sizeof(addr);
+            ac_fd = accept4_f(m_fd, (struct sockaddr*)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        }while(ac_fd < 0 && errno == EINTR);
+
+        if(ac_fd < 0)
+        {
+            //EAGAIN 已经取完
+            if(errno != EAGAIN)
+                KIT_LOG_ERROR(g_logger) << "accept errno =" << errno << ", is:" <<strerror(errno);
+            break;
+        }
+
+        FdMgr::GetInstance()->addSocket(ac_fd, false);
+        sock = newAccepted(ac_fd, (struct sockaddr*)&addr, len);
+    }
+
+    return count;
 }
 
 //bind API
-bool Socket::bind(const Address::ptr addr)
+bool Socket::bind(const Address::ptr addr, bool reuse_port)
 {
     //如果套接字无效
     if(KIT_UNLIKELY(!isValid()))
@@ -236,6 +289,14 @@ bool Socket::bind(const Address::ptr addr)
         return false;
     }
 
+    //SO_REUSEPORT 必须在bind之前设置
+    if(reuse_port)
+    {
+        int val = 1;
+        if(!setOption(SOL_SOCKET, SO_REUSEPORT, val))
+            return false;
+    }
+
     //bind 没有被HOOK
     int ret = ::bind(m_fd, (struct sockaddr*)addr->getAddr(), addr->getAddrLen());
     if(ret < 0)
@@ -583,6 +644,20 @@ bool Socket::cancelAll()
     return IOManager::GetThis()->cancelAll(m_fd);
 }
 
+//用accept4得到的句柄创建通信套接字
+Socket::ptr Socket::newAccepted(int fd, const struct sockaddr* addr, socklen_t len)
+{
+    //TCP_NODELAY等选项从监听套接字继承 不用再setsockopt
+    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
+    sock->m_fd = fd;
+    sock->m_isConnectd = true;
+    //Unix域的远端地址长度不固定 还是用到时再getpeername
+    if(addr->sa_family == AF_INET || addr->sa_family == AF_INET6)
+        sock->m_remoteAddr = Address::CreateFromText(addr, len);
+
+    return sock;
+}
+
 //初始化套接字
 void Socket::initSocket()
 {
@@ -4,6 +4,7 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <memory>
+#include <vector>
 
 #include "noncopyable.h"
 #include "address.h"
@@ -175,13 +176,23 @@ public:
      */
     Socket::ptr accept();
 
+    /**
+     * @brief 批量接收客户端连接 没有连接时等待 接到第一个后把已经完成握手的连接一次取完 不再等待
+     * @param[out] clients 追加新的通信套接字
+     * @param[in] max 最多接收的连接数
+     * @param[in] recv_timeout 新连接的读超时时间(ms) -1为不设置
+     * @return size_t 接收到的连接数 0表示出错
+     */
+    size_t accept(std::vector<Socket::ptr>& clients, size_t max, uint64_t recv_timeout = -1);
+
     /**
      * @brief 套接字绑定地址
      * @param[in] addr 传入的通信地址智能指针
+     * @param[in] reuse_port 是否设置SO_REUSEPORT 多个套接字绑定同一地址 由内核分配新连接
      * @return 绑定成功 
      * @return 绑定失败
      */
-    bool bind(const Address::ptr addr);
+    bool bind(const Address::ptr addr, bool reuse_port = false);
     
     /**
      * @brief 连接远端地址，带有超时功能
@@ -329,6 +340,15 @@ private:
      */
     bool init(int fd);
 
+    /**
+     * @brief 用accept4得到的句柄创建通信套接字 选项已经从监听套接字继承 远端地址直接使用accept4的结果
+     * @param[in] fd 新连接句柄
+     * @param[in] addr 远端地址
+     * @param[in] len 远端地址长度
+     * @return Socket::ptr 
+     */
+    Socket::ptr newAccepted(int fd, const struct sockaddr* addr, socklen_t len);
+
     /**
      * @brief 初始化套接字
      */
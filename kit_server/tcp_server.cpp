@@ -4,6 +4,7 @@
 
 #include <vector>
 #include <errno.h>
+#include <sys/socket.h>
 
 namespace kit_server
 {
@@ -15,6 +16,24 @@ static Logger::ptr g_logger = KIT_LOG_NAME("system");
 static ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout = 
     Config::LookUp("tcp_server.read_timeout", (uint64_t)(60 * 2 * 1000), "tcp server read timeout");
 
+//Tcp Server 默认是否使用SO_REUSEPORT多监听模式
+static ConfigVar<bool>::ptr g_tcp_server_reuse_port = 
+    Config::LookUp("tcp_server.reuse_port", false, "tcp server one SO_REUSEPORT listen socket per worker thread");
+
+//Tcp Server 每次被唤醒时最多接收的连接数
+static ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch = 
+    Config::LookUp("tcp_server.accept_batch", (uint32_t)64, "tcp server max clients accepted per wakeup");
+
+//Tcp Server 准入控制 超过限制的新连接直接关闭 0为不限制
+static ConfigVar<uint32_t>::ptr g_tcp_server_max_connections = 
+    Config::LookUp("tcp_server.max_connections", (uint32_t)0, "tcp server max concurrent connections");
+
+static ConfigVar<uint32_t>::ptr g_tcp_server_max_pending_tasks = 
+    Config::LookUp("tcp_server.max_pending_tasks", (uint32_t)0, "tcp server max tasks waiting in worker queues");
+
+static ConfigVar<uint32_t>::ptr g_tcp_server_max_connections_per_ip = 
+    Config::LookUp("tcp_server.max_connections_per_ip", (uint32_t)0, "tcp server max concurrent connections per source ip");
+
 
 TcpServer::TcpServer(IOManager* worker, IOManager* accept_worker)
     :m_worker(worker)
@@ -22,6 +41,10 @@ TcpServer::TcpServer(IOManager* worker, IOManager* accept_worker)
     ,m_recvTimeout(g_tcp_server_read_timeout->getValue())
     ,m_name("kit/1.0.0")    //服务器的版本号
     ,m_stopped(true)
+    ,m_reusePort(g_tcp_server_reuse_port->getValue())
+    ,m_maxConnections(g_tcp_server_max_connections->getValue())
+    ,m_maxPendingTasks(g_tcp_server_max_pending_tasks->getValue())
+    ,m_maxConnectionsPerIp(g_tcp_server_max_connections_per_ip->getValue())
 {
 
 }
@@ -36,6 +59,7 @@ TcpServer::~TcpServer()
     }
 
     m_listenSockets.clear();
+    m_acceptThreadIds.clear();
 }
 
 
@@ -52,41 +76,61 @@ bool TcpServer::bind(const std::vector<Address::ptr> &in_addrs, std::vector<Addr
 {
     //KIT_LOG_DEBUG(g_logger) << "TcpServer::bind";
 
-    for(auto &x : in_addrs)
+    //SO_REUSEPORT模式下 每个调度线程一个监听套接字
+    std::vector<int> thread_ids(1, -1);
+    if(m_reusePort)
     {
-        //创建协议不确定 但是传输类型是TCP的socket
-        Socket::ptr sock = Socket::CreateTCP(x);
-        //bind绑定地址
-        if(!sock->bind(x))
+        thread_ids = m_worker->getWorkerThreadIds();
+        if(thread_ids.empty())
         {
-            KIT_LOG_ERROR(g_logger) << "bind error, errno=" << errno
-                << ", is:" << strerror(errno)
-                << ", addr=[" << x->toString() << "]";
-            
-            out_addrs.push_back(x);
-            continue;
+            KIT_LOG_ERROR(g_logger) << "bind: worker has no thread, reuse_port disabled";
+            thread_ids.push_back(-1);
         }
+    }
 
-        //listen监听地址
-        if(!sock->listen())
+    for(auto &x : in_addrs)
+    {
+        Address::ptr addr = x;
+        for(size_t i = 0;i < thread_ids.size();++i)
         {
-            KIT_LOG_ERROR(g_logger) << "listen error, errno=" << errno
-                << ", is:" << strerror(errno)
-                << ", addr=[" << x->toString() << "]";
-            
-
-            out_addrs.push_back(x);
-            continue;
+            //创建协议不确定 但是传输类型是TCP的socket
+            Socket::ptr sock = Socket::CreateTCP(addr);
+            //bind绑定地址
+            if(!sock->bind(addr, m_reusePort))
+            {
+                KIT_LOG_ERROR(g_logger) << "bind error, errno=" << errno
+                    << ", is:" << strerror(errno)
+                    << ", addr=[" << x->toString() << "]";
+                
+                out_addrs.push_back(x);
+                break;
+            }
+
+            //listen监听地址
+            if(!sock->listen())
+            {
+                KIT_LOG_ERROR(g_logger) << "listen error, errno=" << errno
+                    << ", is:" << strerror(errno)
+                    << ", addr=[" << x->toString() << "]";
+                
+
+                out_addrs.push_back(x);
+                break;
+            }
+
+            //成功监听
+            m_listenSockets.push_back(sock);
+            m_acceptThreadIds.push_back(thread_ids[i]);
+            //端口为0时由内核分配 同组的其他套接字要绑定到同一个端口
+            addr = sock->getLocalAddress();
         }
-
-        //成功监听
-        m_listenSockets.push_back(sock);
     }
 
     //如果存在监听失败的套接字 要将成功监听那部分清除 
     if(out_addrs.size())
     {
         m_listenSockets.clear();
+        m_acceptThreadIds.clear();
         return false;
     }
 
@@ -111,9 +155,13 @@ bool TcpServer::start()
         
     m_stopped = false;
 
-    for(auto &x : m_listenSockets)
+    for(size_t i = 0;i < m_listenSockets.size();++i)
     {
-        m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), x));
+        //SO_REUSEPORT模式下accept固定在对应的调度线程 新连接直接放入该线程的本地队列 不用跨线程调度
+        if(m_acceptThreadIds[i] != -1)
+            m_worker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_listenSockets[i]), m_acceptThreadIds[i]);
+        else
+            m_acceptWorker->schedule(std::bind(&TcpServer::startAccept, shared_from_this(), m_listenSockets[i]));
     }
 
     return true;
@@ -130,12 +178,16 @@ bool TcpServer::stop()
     m_acceptWorker->schedule([this, self](){
         
         //唤醒所有线程 进行退出
+        //只取消事件的话hook里的accept被唤醒后会重试 读到EAGAIN又挂回去
+        //先shutdown让重试的accept直接出错 句柄留给accept协程退出时关闭 不会被别的套接字复用
         for(auto &x : self->m_listenSockets)
         {   
+            ::shutdown(x->getFd(), SHUT_RDWR);
             x->cancelAll();
         }
 
         self->m_listenSockets.clear();
+        self->m_acceptThreadIds.clear();
     });
 
     return true;
@@ -153,27 +205,122 @@ void TcpServer::startAccept(Socket::ptr sock)
 {
     KIT_LOG_DEBUG(g_logger) << "TcpServer startAccept";
 
+    auto self = shared_from_this();
+    std::vector<Socket::ptr> clients;
+    std::vector<std::function<void()> > tasks;
+
     //循环 只要不停止就要一直去accept客户端
     while(!m_stopped)
     {
-        Socket::ptr client = sock->accept();
-        if(client)
+        //每次唤醒把积压的连接一次取完 通信套接字的读超时在创建时设置好
+        clients.clear();
+        if(!sock->accept(clients, g_tcp_server_accept_batch->getValue(), m_recvTimeout))
         {
-            //给每一通信套接字设置读超时
-            client->setRecvTimeout(m_recvTimeout);
+            KIT_LOG_ERROR(g_logger) << "accept error, sock=" << *sock;
+            continue;
+        }
 
-            //将通信套接字加入线程池管理 
-            m_worker->schedule(std::bind(&TcpServer::handleClient, shared_from_this(), client));
+        //将通信套接字批量加入线程池管理 只唤醒一次
+        tasks.clear();
+        std::string ip_key;
+        for(auto &x : clients)
+        {
+            if(admit(x, ip_key))
+                tasks.push_back(std::bind(&TcpServer::runClient, self, x, ip_key));
         }
-        else 
+        m_worker->schedule(tasks.begin(), tasks.end());
+    }
+
+}
+
+
+//准入检查
+bool TcpServer::admit(Socket::ptr client, std::string& ip_key)
+{
+    ip_key.clear();
+
+    //后端处理不过来时 再接新连接只会让所有人的延迟一起变差
+    if(m_maxPendingTasks && m_worker->getTaskCount() >= m_maxPendingTasks)
+    {
+        ++m_shedByPendingTasks;
+        client->close();
+        return false;
+    }
+
+    //先占名额再检查 多个监听socket的accept协程并发准入时不会一起越过上限
+    uint32_t connections = ++m_connections;
+    if(m_maxConnections && connections > m_maxConnections)
+    {
+        --m_connections;
+        ++m_shedByConnections;
+        client->close();
+        return false;
+    }
+
+    if(m_maxConnectionsPerIp)
+    {
+        std::string key = GetIpKey(client);
+        if(!key.empty())
         {
-            KIT_LOG_ERROR(g_logger) << "accept error, client=" << client.get();
+            Mutex::Lock lock(m_ipMutex);
+            uint32_t& count = m_ipConnections[key];
+            if(count >= m_maxConnectionsPerIp)
+            {
+                lock.unlock();
+                --m_connections;
+                ++m_shedByIp;
+                client->close();
+                return false;
+            }
+            ++count;
+            lock.unlock();
+            ip_key.swap(key);
         }
     }
 
+    return true;
 }
 
+//处理连接 结束后释放名额
+void TcpServer::runClient(Socket::ptr client, const std::string& ip_key)
+{
+    handleClient(client);
 
+    --m_connections;
+    //准入时计入了才释放 运行中修改了上限也不会少减或者多减
+    if(!ip_key.empty())
+    {
+        Mutex::Lock lock(m_ipMutex);
+        auto it = m_ipConnections.find(ip_key);
+        if(it != m_ipConnections.end() && --it->second == 0)
+            m_ipConnections.erase(it);
+    }
+}
+
+//来源IP的原始字节
+std::string TcpServer::GetIpKey(Socket::ptr client)
+{
+    //accept4时已经记录了远端地址 这里不会再有系统调用
+    Address::ptr addr = client->getRemoteAddress();
+    if(!addr)
+        return "";
+
+    switch(addr->getFamily())
+    {
+        case AF_INET:
+        {
+            const struct sockaddr_in* in = (const struct sockaddr_in*)addr->getAddr();
+            return std::string((const char*)&in->sin_addr, sizeof(in->sin_addr));
+        }
+        case AF_INET6:
+        {
+            const struct sockaddr_in6* in6 = (const struct sockaddr_in6*)addr->getAddr();
+            return std::string((const char*)&in6->sin6_addr, sizeof(in6->sin6_addr));
+        }
+        default:
+            return "";
+    }
+}
 
 
-}
\ No newline at end of file
+}
@@ -5,8 +5,11 @@
 #include <memory>
 #include <functional>
 #include <vector>
+#include <atomic>
+#include <unordered_map>
 
 #include "iomanager.h"
+#include "mutex.h"
 #include "socket.h"
 #include "address.h"
 #include "noncopyable.h"
@@ -79,6 +82,64 @@ public:
      */
     uint64_t getRecvTimeout() const {return  m_recvTimeout;}
 
+    /**
+     * @brief 设置是否使用SO_REUSEPORT多监听模式 需要在bind之前设置
+     * @details 每个地址为worker的每个调度线程打开一个SO_REUSEPORT监听套接字 
+     *          各线程在自己的套接字上accept并就地处理客户端 由内核在线程之间分配新连接
+     *          worker需要已经start() 每线程epoll模式下监听套接字和客户端都固定在accept的线程上
+     * @param[in] v 是否开启
+     */
+    void setReusePort(bool v) {m_reusePort = v;}
+
+    /**
+     * @brief 是否使用SO_REUSEPORT多监听模式
+     * @return true 是
+     * @return false 否
+     */
+    bool isReusePort() const {return m_reusePort;}
+
+    /**
+     * @brief 设置最大并发连接数 超过时新连接直接关闭
+     * @param[in] v 最大连接数 0为不限制
+     */
+    void setMaxConnections(uint32_t v) {m_maxConnections = v;}
+
+    /**
+     * @brief 设置worker队列中最多等待调度的任务数 超过时说明后端处理不过来 新连接直接关闭
+     * @param[in] v 最大等待任务数 0为不限制
+     */
+    void setMaxPendingTasks(uint32_t v) {m_maxPendingTasks = v;}
+
+    /**
+     * @brief 设置同一个来源IP的最大并发连接数 超过时新连接直接关闭
+     * @param[in] v 最大连接数 0为不限制
+     */
+    void setMaxConnectionsPerIp(uint32_t v) {m_maxConnectionsPerIp = v;}
+
+    /**
+     * @brief 获取当前并发连接数
+     * @return uint32_t 
+     */
+    uint32_t getConnectionCount() const {return m_connections;}
+
+    /**
+     * @brief 获取因为超过最大并发连接数被拒绝的连接数
+     * @return uint64_t 
+     */
+    uint64_t getShedByConnections() const {return m_shedByConnections;}
+
+    /**
+     * @brief 获取因为等待任务过多被拒绝的连接数
+     * @return uint64_t 
+     */
+    uint64_t getShedByPendingTasks() const {return m_shedByPendingTasks;}
+
+    /**
+     * @brief 获取因为超过来源IP并发连接数被拒绝的连接数
+     * @return uint64_t 
+     */
+    uint64_t getShedByIp() const {return m_shedByIp;}
+
     /**
      * @brief 设置服务器名称
      * @param[in] v 具体名称
@@ -111,9 +172,36 @@ protected:
      */
     virtual void startAccept(Socket::ptr sock);
 
+private:
+    /**
+     * @brief 准入检查 通过的连接计入并发连接数 拒绝的连接直接关闭并计数
+     * @param[in] client 新连接
+     * @param[out] ip_key 计入了来源IP连接数时为来源IP的键 否则为空
+     * @return true 允许处理
+     * @return false 已经拒绝
+     */
+    bool admit(Socket::ptr client, std::string& ip_key);
+
+    /**
+     * @brief 执行handleClient 返回后释放连接占用的名额
+     * @details handleClient返回就认为连接结束 子类如果把连接交给其他协程处理 并发连接数会少算
+     * @param[in] client 
+     * @param[in] ip_key 准入时计入的来源IP的键 为空时没有计入 按准入时的结果释放 不受之后修改上限的影响
+     */
+    void runClient(Socket::ptr client, const std::string& ip_key);
+
+    /**
+     * @brief 取出来源IP的原始字节作为统计的键
+     * @param[in] client 
+     * @return std::string 不是IP地址时返回空
+     */
+    static std::string GetIpKey(Socket::ptr client);
+
 private:
     //存储多个监听socket 可能支持多协议 可能存在多个网卡  可能监听多个地址  
     std::vector<Socket::ptr> m_listenSockets;
+    //每个监听socket负责accept的线程ID 和m_listenSockets一一对应 -1表示交给m_acceptWorker调度
+    std::vector<int> m_acceptThreadIds;
     //作为一个线程池  专门负责已经接收连接的客户端的调度
     IOManager* m_worker;
     //作为一个线程池  专门负责服务器监听套接字执行accept的调度
@@ -124,6 +212,24 @@ private:
     std::string m_name;
     //服务器当前的工作状态
     bool m_stopped;
+    //SO_REUSEPORT多监听模式
+    bool m_reusePort;
+    //最大并发连接数 0为不限制
+    uint32_t m_maxConnections;
+    //worker最多等待调度的任务数 0为不限制
+    uint32_t m_maxPendingTasks;
+    //同一来源IP最大并发连接数 0为不限制
+    uint32_t m_maxConnectionsPerIp;
+    //当前并发连接数
+    std::atomic<uint32_t> m_connections = {0};
+    //各个来源IP的并发连接数 只在限制来源IP时使用
+    std::unordered_map<std::string, uint32_t> m_ipConnections;
+    //保护m_ipConnections
+    Mutex m_ipMutex;
+    //被拒绝的连接数
+    std::atomic<uint64_t> m_shedByConnections = {0};
+    std::atomic<uint64_t> m_shedByPendingTasks = {0};
+    std::atomic<uint64_t> m_shedByIp = {0};
 
 
 };
@@ -1,6 +1,7 @@
 #include "Log.h"
 #include "timer.h"
 #include "util.h"
+#include "macro.h"
 
 #include <vector>
 
@@ -9,151 +10,130 @@ namespace kit_server
 
 static Logger::ptr g_logger  = KIT_LOG_NAME("system");
 
-/*********************************Timer********************************/
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager)
-    :m_ms(ms), m_cb(cb), m_recurring(recurring), m_manager(manager)
-{
-    //计算到期时间点
-    m_next = GetCurrentMs() + m_ms;
-}
-
-Timer::Timer(uint64_t next)
-    :m_next(next)
+/**
+ * @brief 某一层的移位数 第0层槽位为1ms 第n层槽位跨度为2^(8+6(n-1))ms
+ */
+static inline int LevelShift(int level)
 {
-
+    return level == 0 ? 0 : 8 + (level - 1) * 6;
 }
 
-//取消定时器任务
-bool Timer::cancel()
+/**
+ * @brief 在位图[from, to)范围内找第一个置位的下标
+ * @return int 没有返回-1
+ */
+static inline int FindBit(const uint64_t* bitmap, int from, int to)
 {
-    TimerManager::MutexType::WriteLock lock(m_manager->m_mutex);
-    if(m_cb)
+    while(from < to)
     {
-        m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        if(it == m_manager->m_timers.end())
+        uint64_t word = bitmap[from / 64] >> (from % 64);
+        if(word)
         {
-            KIT_LOG_ERROR(g_logger) << "Timer::cancel get timer error";
-            return false;
+            int index = from + __builtin_ctzll(word);
+            return index < to ? index : -1;
         }
-        m_manager->m_timers.erase(it);
-
-        return true;
+        from = (from / 64 + 1) * 64;
     }
 
-    return false;
-
+    return -1;
 }
 
-//刷新定时器时间
-bool Timer::refresh()
+/*********************************Timer********************************/
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager, uint64_t slack)
+    :m_ms(ms), m_cb(cb), m_recurring(recurring), m_slack(slack), m_manager(manager)
 {
-    TimerManager::MutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb)
-        return false;
+    //计算到期时间点 缓存的时间可能已经落后 用它计算会让定时器提前触发 粗粒度时钟补过精度 读起来也便宜
+    m_next = m_manager->getCurrentMs() + m_ms;
+}
 
-    auto it = m_manager->m_timers.find(shared_from_this());
+//挂到时间轮上的触发时间点
+uint64_t Timer::getExpireTime() const
+{
+    if(!m_slack)
+        return m_next;
+
+    //取窗口上界 抹掉和下界不同的最高位以下的所有位 得到窗口内末尾0最多的时间点
+    uint64_t limit = m_next + m_slack;
+    uint64_t diff = m_next ^ limit;
+    int bit = 63 - __builtin_clzll(diff);
+    return limit & ~((1ull << bit) - 1);
+}
 
-    if(it == m_manager->m_timers.end())
-    {
+//取消定时器任务
+bool Timer::cancel()
+{
+    //已经到期或者已经取消 只有一个线程能取消成功
+    int expected = PENDING;
+    if(!m_state.compare_exchange_strong(expected, CANCELLED))
         return false;
-    }
-
-    //注意：由于使用的set 要先移除再进行重置加入 不能直接在原来的定时器上直接修改时间
-    m_manager->m_timers.erase(it);
-    m_next = GetCurrentMs() + m_ms;
-    m_manager->m_timers.insert(shared_from_this());
 
+    m_manager->modify(this, TimerManager::TimerOp::CANCEL);
     return true;
+}
 
+//刷新定时器时间
+bool Timer::refresh()
+{
+    return m_manager->modify(this, TimerManager::TimerOp::REFRESH);
 }
 
 //重新设定定时器到期时间
 bool Timer::reset(uint64_t ms, bool from_now)
 {
-    if(m_ms == ms && !from_now)
-        return true;
-
-    TimerManager::MutexType::WriteLock lock(m_manager->m_mutex);
-
-    if(!m_cb)   //没有任务就要返回
-        return false;
-
-
-    auto it = m_manager->m_timers.find(shared_from_this());
-
-    if(it == m_manager->m_timers.end())
-    {
-        return false;
-    }
-    //注意：由于使用的set 要先移除再进行重置加入
-    m_manager->m_timers.erase(it);
-
-    uint64_t start = 0;
-    //重新从现在开始计时
-    if(from_now)
-        start = GetCurrentMs();
-    else //继续上一次的计时
-        start = m_next - m_ms;
-    
-    m_ms = ms;
-    m_next = start + m_ms;
-
-    //写锁解锁
-    lock.unlock();
-
-    //因为reset可能出现执行时间变成最小的可能(放在队头) 会有一次唤醒
-    m_manager->addTimer(shared_from_this());
-
-    return true;
+    return m_manager->modify(this, TimerManager::TimerOp::RESET, ms, from_now);
 }
 
 
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const
-{
-    /*判断地址*/
-    if(!lhs && !rhs)
-        return false;
-    
-    if(!lhs)
-        return true;
-    
-    if(!rhs)
-        return false;
-    
-    /*都有值 判断到期时间*/
-    if(lhs->m_next < rhs->m_next)
-        return true;
 
-    if(lhs->m_next > rhs->m_next)
-        return false;
-        
-    //到期时间相等的话 地址小的优先调度
-    return lhs.get() < rhs.get();
-    
+/*********************************TimerManager********************************/
+TimerManager::TimerWheel::TimerWheel(uint64_t now_ms)
+{
+    //从当前时间点开始转动
+    current = now_ms;
 }
 
-
-
-
-/*********************************TimerManager********************************/
+//构造时还不能调用派生类的时钟 直接读缓存的单调时间
 TimerManager::TimerManager()
 {
-    //初始化时候 获取一次服务器时间
-    m_previousTime = GetCurrentMs();
+    m_wheels.emplace_back(new TimerWheel(GetCoarseMs()));
 }
 
 TimerManager::~TimerManager()
 {
+    //打断时间轮持有的自身引用 避免定时器泄漏
+    std::vector<Timer::ptr> timers;
+    MutexType::WriteLock lock(m_mutex);
+    for(auto& wheel : m_wheels)
+    {
+        TimerOp* op = wheel->mailbox.exchange(nullptr);
+        while(op)
+        {
+            TimerOp* next = op->next;
+            delete op;
+            op = next;
+        }
+        wheel->takeAll(timers);
+    }
+}
+
+//切换时间轮数量
+void TimerManager::setTimerWheels(size_t count)
+{
+    MutexType::WriteLock lock(m_mutex);
+    KIT_ASSERT2(m_wheels.empty() || m_wheels[0]->count == 0, "set timer wheels after timers added");
 
+    m_wheels.clear();
+    for(size_t i = 0;i < count;++i)
+        m_wheels.emplace_back(new TimerWheel(getCoarseMs()));
+    m_perWorker = true;
 }
 
 //创建并添加定时器
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring)
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool recurring, uint64_t slack)
 {
     //在TimerManager 中构造Timer
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+    Timer::ptr timer(new Timer(ms, cb, recurring, this, slack));
 
     // MutexType::WriteLock lock(m_mutex);
     addTimer(timer);
@@ -164,23 +144,36 @@ Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb, bool re
 //添加定时器
 void TimerManager::addTimer(Timer::ptr p)
 {
-    MutexType::WriteLock lock(m_mutex);
-    //insert返回两个值 插入后的迭代器位置/插入是否成功
-    //判断插入后是否是在队头
-    auto it = m_timers.insert(p).first;
-    bool is_front = (it == m_timers.begin()) && !m_tickled;
-    //没有唤醒过 就把标志m_tickled置为true
-    //否则上一次已经唤醒过且没有把队头的定时器取走就不能去唤醒
-    if(is_front)
-        m_tickled = true;
+    if(!m_perWorker)
+    {
+        MutexType::WriteLock lock(m_mutex);
+        linkTimer(*m_wheels[0], p);
+        bool is_front = insertedAtFront(*m_wheels[0], p->getExpireTime());
+        lock.unlock();
 
-    lock.unlock();
+        //当有比之前更小的 定时器任务插入  就要通知epoll_wait那边去修改为更小的等待时间
+        //实际上：将挂起的协程唤醒，重新走一遍流程idle()---->run()--->idle()
+        if(is_front)
+            onTimerInsertedAtFront();
 
-    //当有比之前更小的 定时器任务插入  就要通知epoll_wait那边去修改为更小的等待时间
-    //实际上：将挂起的协程唤醒，重新走一遍流程idle()---->run()--->idle()
-    if(is_front)
-        onTimerInsertedAtFront();
-    
+        return;
+    }
+
+    //挂到自己的时间轮上不用加锁 也不用唤醒 本线程回到idle()时会重新计算超时时间
+    int owner = getTimerWheelIndex();
+    if(owner >= 0)
+    {
+        p->m_wheel = owner;
+        linkTimer(*m_wheels[owner], p);
+        return;
+    }
+
+    //外部线程投递给选中的时间轮
+    p->m_wheel = selectTimerWheel();
+    TimerOp* op = new TimerOp;
+    op->type = TimerOp::ADD;
+    op->timer = p;
+    post(p->m_wheel, op);
 }
 
 /**
@@ -200,102 +193,519 @@ static void OnTimer(std::weak_ptr<void> weak_cond, std::function<void()> cb)
 }
 
 //添加条件定时器
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring)
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring, uint64_t slack)
 {
-    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
+    return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring, slack);
 }
 
 //获取队头定时器的到期时间
 uint64_t TimerManager::getNextTime()
 {
-    MutexType::ReadLock lock(m_mutex);
-    m_tickled = false;
+    if(!m_perWorker)
+    {
+        //要更新缓存的时间点 使用写锁
+        MutexType::WriteLock lock(m_mutex);
+        return nextTimeout(*m_wheels[0]);
+    }
 
-    if(!m_timers.size())    //没有任务执行返回最大值
-        return ~0ull; 
+    //只计算本线程时间轮的超时时间
+    int owner = getTimerWheelIndex();
+    if(owner < 0)
+        return ~0ull;
 
-    const Timer::ptr& next = *m_timers.begin();
-    uint64_t now_ms = GetCurrentMs();
-    if(now_ms >= next->m_next)  //现在获取的时间 已经晚于预计要触发的时间点 马上执行
-        return 0;
-    else    //还没到触发时间点就返回剩余时间间隔
-        return next->m_next - now_ms;
+    TimerWheel& wheel = *m_wheels[owner];
+    drain(wheel);
+    return nextTimeout(wheel);
 }
 
 //已经到期的定时任务集合
 void TimerManager::listExpiredCb(std::vector<std::function<void()> >& cbs)
 {
-    uint64_t now_ms = GetCurrentMs();
-    std::vector<std::shared_ptr<Timer> > expired;
-
+    if(!m_perWorker)
     {
-        MutexType::ReadLock lock(m_mutex);
-        if(!m_timers.size())
+        TimerWheel& wheel = *m_wheels[0];
+        if(!wheel.count)
             return;
+
+        MutexType::WriteLock lock(m_mutex);
+        expire(wheel, cbs);
+        return;
     }
 
-    MutexType::WriteLock lock(m_mutex);
-    if(!m_timers.size())
+    int owner = getTimerWheelIndex();
+    if(owner < 0)
         return;
 
-    bool changed = checkClockChange(now_ms);
-    //服务器时间没有发生改变 且不存在超时定时器 就退出函数
-    if(!changed && (*m_timers.begin())->m_next < now_ms)
+    TimerWheel& wheel = *m_wheels[owner];
+    drain(wheel);
+    expire(wheel, cbs);
+}
+
+//定时器队列是否为空
+bool TimerManager::isTimersEmpty()
+{
+    for(auto& wheel : m_wheels)
+    {
+        if(wheel->count || wheel->pending)
+            return false;
+    }
+
+    return true;
+}
+
+//取消/刷新/重置定时器
+bool TimerManager::modify(Timer* timer, TimerOp::Type type, uint64_t ms, bool from_now)
+{
+    //时间轮持有的引用要在锁外释放
+    Timer::ptr released;
+
+    if(!m_perWorker)
+    {
+        MutexType::WriteLock lock(m_mutex);
+        TimerWheel& wheel = *m_wheels[0];
+        if(!apply(wheel, timer, type, ms, from_now, released))
+            return false;
+
+        //重置可能让定时器变成最早到期的 要唤醒一次
+        bool is_front = type == TimerOp::RESET && insertedAtFront(wheel, timer->getExpireTime());
+        lock.unlock();
+
+        if(is_front)
+            onTimerInsertedAtFront();
+
+        return true;
+    }
+
+    //拥有者直接操作 先执行收件箱里更早投递的操作 保证顺序
+    if(getTimerWheelIndex() == (int)timer->m_wheel)
+    {
+        TimerWheel& wheel = *m_wheels[timer->m_wheel];
+        drain(wheel);
+        return apply(wheel, timer, type, ms, from_now, released);
+    }
+
+    //其他线程只能投递 结果以投递时的状态为准
+    if(type != TimerOp::CANCEL && timer->m_state != Timer::PENDING)
+        return false;
+
+    TimerOp* op = new TimerOp;
+    op->type = type;
+    op->timer = timer->shared_from_this();
+    op->ms = ms;
+    op->fromNow = from_now;
+    post(timer->m_wheel, op);
+
+    return true;
+}
+
+//在时间轮上执行操作
+bool TimerManager::apply(TimerWheel& wheel, Timer* timer, TimerOp::Type type, uint64_t ms, bool from_now, Timer::ptr& released)
+{
+    switch(type)
+    {
+        case TimerOp::CANCEL:
+            //取消的状态已经由Timer::cancel设置 这里只负责摘下并释放回调
+            timer->m_cb = nullptr;
+            if(timer->m_level >= 0)
+                released = wheel.unlink(timer);
+            return true;
+
+        case TimerOp::REFRESH:
+            if(timer->m_state != Timer::PENDING || timer->m_level < 0)
+                return false;
+
+            //时间轮上直接换槽位 O(1)
+            released = wheel.unlink(timer);
+            timer->m_next = getCurrentMs() + timer->m_ms;
+            linkTimer(wheel, released);
+            return true;
+
+        case TimerOp::RESET:
+        {
+            if(timer->m_state != Timer::PENDING || timer->m_level < 0)   //没有任务就要返回
+                return false;
+
+            if(timer->m_ms == ms && !from_now)
+                return true;
+
+            uint64_t start = 0;
+            //重新从现在开始计时
+            if(from_now)
+                start = getCurrentMs();
+            else //继续上一次的计时
+                start = timer->m_next - timer->m_ms;
+
+            released = wheel.unlink(timer);
+            timer->m_ms = ms;
+            timer->m_next = start + timer->m_ms;
+            linkTimer(wheel, released);
+            return true;
+        }
+
+        default:
+            break;
+    }
+
+    return false;
+}
+
+//挂到时间轮上 空的时间轮先把游标对齐到当前时间
+void TimerManager::linkTimer(TimerWheel& wheel, const Timer::ptr& timer)
+{
+    if(!wheel.count)
+    {
+        uint64_t now_ms = getCoarseMs();
+        if(now_ms > wheel.current)
+            wheel.current = now_ms;
+    }
+    wheel.link(timer);
+}
+
+//计算到期时间点用的当前时间
+uint64_t TimerManager::getCurrentMs()
+{
+    return kit_server::GetTickMs();
+}
+
+//推进时间轮用的当前时间
+uint64_t TimerManager::getCoarseMs()
+{
+    return kit_server::GetCoarseMs();
+}
+
+//投递到收件箱
+void TimerManager::post(size_t index, TimerOp* op)
+{
+    TimerWheel& wheel = *m_wheels[index];
+
+    //先计数再投递 拥有者挂上之后才减 期间isTimersEmpty()不会误判为空
+    if(op->type == TimerOp::ADD)
+        ++wheel.pending;
+
+    op->next = wheel.mailbox.load();
+    while(!wheel.mailbox.compare_exchange_weak(op->next, op));
+
+    //取消不会让定时器提前到期 不必唤醒拥有者 它下一次处理收件箱时摘下
+    //来不及处理时 转到该槽位也会因为状态不是PENDING而丢弃
+    onTimerPosted(index, op->type == TimerOp::CANCEL);
+}
+
+//执行收件箱中的操作
+void TimerManager::drain(TimerWheel& wheel)
+{
+    if(!wheel.mailbox.load(std::memory_order_relaxed))
         return;
 
-    //构造一个装有当前时间的Timer为了应用lower_bound算法函数
-    Timer::ptr now_timer(new Timer(now_ms));
+    //无锁栈是后进先出 反转成投递顺序
+    TimerOp* op = wheel.mailbox.exchange(nullptr);
+    TimerOp* ordered = nullptr;
+    while(op)
+    {
+        TimerOp* next = op->next;
+        op->next = ordered;
+        ordered = op;
+        op = next;
+    }
 
-    //如果服务器时间发生了变动 就返回end() 会将整个m_timers全部清理 重新加入队列
-    //否则 将找出大于等于当前时间的第一个Timer
-    auto it = changed ? m_timers.end() : m_timers.lower_bound(now_timer);
+    while(ordered)
+    {
+        TimerOp* next = ordered->next;
+        Timer* timer = ordered->timer.get();
+        if(ordered->type == TimerOp::ADD)
+        {
+            //投递之后被取消的定时器不再挂上
+            if(timer->m_state == Timer::CANCELLED)
+                timer->m_cb = nullptr;
+            else
+                linkTimer(wheel, ordered->timer);
+            --wheel.pending;
+        }
+        else
+        {
+            Timer::ptr released;
+            apply(wheel, timer, ordered->type, ordered->ms, ordered->fromNow, released);
+        }
 
-    //找到还没到时的第一个定时器的位置后 停下
-    while(it != m_timers.end() && (*it)->m_next == now_ms)
-        ++it;
-    
-    //将队头~当前位置之前 所有已经到时的定时器全部拿出 到expired队列中
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    //将原队列前部到期的定时器全部移除
-    m_timers.erase(m_timers.begin(), it);
+        delete ordered;
+        ordered = next;
+    }
+}
+
+//是否插在了队头
+bool TimerManager::insertedAtFront(TimerWheel& wheel, uint64_t next)
+{
+    //比上一次算出的等待时间点还早 说明插在了队头
+    bool is_front = next < wheel.nextTickCache && !wheel.tickled;
+    //没有唤醒过 就把标志tickled置为true
+    //否则上一次已经唤醒过且没有把队头的定时器取走就不能去唤醒
+    if(is_front)
+    {
+        wheel.tickled = true;
+        wheel.nextTickCache = next;
+    }
+
+    return is_front;
+}
+
+//收集到期定时器
+void TimerManager::expire(TimerWheel& wheel, std::vector<std::function<void()> >& cbs)
+{
+    if(!wheel.count)
+        return;
+
+    //单调时钟不会回退 只需推进时间轮 取出到期的定时器
+    uint64_t now_ms = getCoarseMs();
+    std::vector<Timer::ptr> expired;
+    wheel.advance(now_ms, expired);
+    //循环定时器的下一次到期时间按真实时间计算 有循环定时器时才读时钟
+    uint64_t real_ms = 0;
 
     //扩充可执行任务队列空间
-    cbs.reserve(expired.size());
+    cbs.reserve(cbs.size() + expired.size());
     for(auto &x : expired)
     {
-        cbs.emplace_back(x->m_cb);
-        //循环定时器就放回 set中
         if(x->m_recurring)
         {
-            x->m_next = now_ms + x->m_ms;
-            m_timers.insert(x);
+            //已经被其他线程取消 等待收件箱里的取消操作
+            if(x->m_state != Timer::PENDING)
+                continue;
+
+            //循环定时器就放回时间轮中
+            cbs.emplace_back(x->m_cb);
+            if(!real_ms)
+                real_ms = getCurrentMs();
+            x->m_next = real_ms + x->m_ms;
+            wheel.link(x);
         }
         else
-            x->m_cb = nullptr;
+        {
+            //和跨线程的取消竞争 只有一方成功
+            int expected = Timer::PENDING;
+            if(!x->m_state.compare_exchange_strong(expected, Timer::EXPIRED))
+                continue;
+
+            cbs.emplace_back();
+            cbs.back().swap(x->m_cb);
+        }
         
     }
+}
+
+//计算超时时间
+uint64_t TimerManager::nextTimeout(TimerWheel& wheel)
+{
+    wheel.tickled = false;
 
+    wheel.nextTickCache = wheel.nextTick();
+    if(wheel.nextTickCache == ~0ull)    //没有任务执行返回最大值
+        return ~0ull; 
+
+    uint64_t now_ms = getCoarseMs();
+    if(now_ms >= wheel.nextTickCache)  //现在获取的时间 已经晚于预计要触发的时间点 马上执行
+        return 0;
+    else    //还没到触发时间点就返回剩余时间间隔
+        return wheel.nextTickCache - now_ms;
 }
 
+//挂到时间轮上
+void TimerManager::TimerWheel::link(const Timer::ptr& timer)
+{
+    //已经过期的定时器放在下一个要处理的槽位
+    uint64_t expires = timer->getExpireTime();
+    expires = expires > current ? expires : current;
+    uint64_t delta = expires - current;
 
-//探测当前服务器时间是否改变  策略有 往前调/往后调
-bool TimerManager::checkClockChange(uint64_t now_ms)
+    int level = 0;
+    if(delta >= (1ull << 32))
+    {
+        //超出时间轮范围 先放在最高层的最远处 降级时会按真实到期时间重新分配
+        expires = current + (1ull << 32) - 1;
+        level = WHEEL_LEVELS - 1;
+    }
+    else
+    {
+        while(level < WHEEL_LEVELS - 1 && delta >= (1ull << LevelShift(level + 1)))
+            ++level;
+    }
+
+    int mask = level == 0 ? WHEEL0_SIZE - 1 : WHEELN_SIZE - 1;
+    int slot = (expires >> LevelShift(level)) & mask;
+
+    //头插到槽位链表
+    Timer* t = timer.get();
+    Timer*& head = slots[level][slot];
+    t->m_prevNode = nullptr;
+    t->m_nextNode = head;
+    if(head)
+        head->m_prevNode = t;
+    head = t;
+
+    t->m_level = level;
+    t->m_slot = slot;
+    t->m_self = timer;
+    bitmap[level][slot / 64] |= (1ull << (slot % 64));
+    ++count;
+}
+
+//从时间轮摘下
+Timer::ptr TimerManager::TimerWheel::unlink(Timer* timer)
 {
-    bool changed = false;
-    //当前时间小于上一次时间且比上一次时间一小时前还要小 就认为服务器时间被修改
-    if(now_ms < m_previousTime && now_ms < (m_previousTime - 60 * 60 * 1000))
-        changed = true;
-    
-    m_previousTime = now_ms;
-    return changed;
+    Timer*& head = slots[timer->m_level][timer->m_slot];
+    if(timer->m_prevNode)
+        timer->m_prevNode->m_nextNode = timer->m_nextNode;
+    else
+        head = timer->m_nextNode;
+    if(timer->m_nextNode)
+        timer->m_nextNode->m_prevNode = timer->m_prevNode;
+
+    if(!head)
+        bitmap[timer->m_level][timer->m_slot / 64] &= ~(1ull << (timer->m_slot % 64));
+
+    timer->m_prevNode = timer->m_nextNode = nullptr;
+    timer->m_level = -1;
+    --count;
+
+    Timer::ptr self;
+    self.swap(timer->m_self);
+    return self;
 }
 
-//定时器队列是否为空
-bool TimerManager::isTimersEmpty()
+//高层槽位降级
+int TimerManager::TimerWheel::cascade(int level, int slot)
+{
+    Timer* t = slots[level][slot];
+    slots[level][slot] = nullptr;
+    bitmap[level][slot / 64] &= ~(1ull << (slot % 64));
+
+    //按照到期时间重新挂到更低的层级
+    while(t)
+    {
+        Timer* next = t->m_nextNode;
+        Timer::ptr self;
+        self.swap(t->m_self);
+        --count;
+        link(self);
+        t = next;
+    }
+
+    return slot;
+}
+
+//推进时间轮
+void TimerManager::TimerWheel::advance(uint64_t now_ms, std::vector<Timer::ptr>& expired)
+{
+    while(current <= now_ms)
+    {
+        int index = current & (WHEEL0_SIZE - 1);
+
+        //第0层转完一圈 依次把更高层当前槽位的定时器降级
+        if(index == 0)
+        {
+            for(int level = 1;level < WHEEL_LEVELS;++level)
+            {
+                int slot = (current >> LevelShift(level)) & (WHEELN_SIZE - 1);
+                if(cascade(level, slot) != 0)
+                    break;
+            }
+        }
+
+        //跳过空槽位 直接到下一个非空槽位或者下一圈开始
+        int next = FindBit(bitmap[0], index, WHEEL0_SIZE);
+        if(next != index)
+        {
+            uint64_t tick = (current & ~(uint64_t)(WHEEL0_SIZE - 1)) + (next < 0 ? WHEEL0_SIZE : next);
+            current = tick < now_ms + 1 ? tick : now_ms + 1;
+            continue;
+        }
+
+        //该槽位上的定时器全部到期
+        Timer* t = slots[0][index];
+        slots[0][index] = nullptr;
+        bitmap[0][index / 64] &= ~(1ull << (index % 64));
+        while(t)
+        {
+            Timer* next_node = t->m_nextNode;
+            t->m_prevNode = t->m_nextNode = nullptr;
+            t->m_level = -1;
+            --count;
+            expired.emplace_back();
+            expired.back().swap(t->m_self);
+            t = next_node;
+        }
+
+        ++current;
+    }
+}
+
+//取出所有定时器
+void TimerManager::TimerWheel::takeAll(std::vector<Timer::ptr>& expired)
 {
-    MutexType::ReadLock lock(m_mutex);
-    return m_timers.empty();
+    for(int level = 0;level < WHEEL_LEVELS;++level)
+    {
+        int size = level == 0 ? WHEEL0_SIZE : WHEELN_SIZE;
+        for(int slot = 0;slot < size;++slot)
+        {
+            while(slots[level][slot])
+                expired.push_back(unlink(slots[level][slot]));
+        }
+    }
 }
 
+//下一次需要处理时间轮的时间点
+uint64_t TimerManager::TimerWheel::nextTick() const
+{
+    if(!count)
+        return ~0ull;
+
+    //第0层本圈内的槽位 就是精确的到期时间点
+    //正好在一圈开始且还没处理时 更高层的降级还没做 不能直接返回
+    int index = current & (WHEEL0_SIZE - 1);
+    uint64_t round = current & ~(uint64_t)(WHEEL0_SIZE - 1);
+    int slot = FindBit(bitmap[0], index, WHEEL0_SIZE);
+    if(slot >= 0 && index != 0)
+        return round + slot;
+
+    uint64_t next = ~0ull;
+    if(slot >= 0)
+    {
+        next = round + slot;
+    }
+    else
+    {
+        //本圈之前的槽位属于下一圈
+        slot = FindBit(bitmap[0], 0, index);
+        if(slot >= 0)
+            next = round + WHEEL0_SIZE + slot;
+    }
+
+    //更高层的槽位 取最早的降级时间点 定时器不会早于它到期
+    for(int level = 1;level < WHEEL_LEVELS;++level)
+    {
+        uint64_t bits = bitmap[level][0];
+        if(!bits)
+            continue;
+
+        int shift = LevelShift(level);
+        uint64_t span = 1ull << shift;
+        uint64_t base = current & ~(span - 1);
+        int cur = (current >> shift) & (WHEELN_SIZE - 1);
+
+        //当前槽位: 本时间点正好是降级时刻且还没处理 否则要再转一整圈
+        uint64_t rotated = cur ? ((bits >> cur) | (bits << (WHEELN_SIZE - cur))) : bits;
+        uint64_t tick;
+        if((rotated & 1) && current == base)
+            tick = base;
+        else if(rotated & ~1ull)
+            tick = base + (uint64_t)__builtin_ctzll(rotated & ~1ull) * span;
+        else
+            tick = base + WHEELN_SIZE * span;
+
+        if(tick < next)
+            next = tick;
+    }
 
-}
\ No newline at end of file
+    return next;
+}
+
+
+}
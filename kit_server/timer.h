@@ -4,8 +4,9 @@
 
 #include <memory>
 #include <functional>
-#include <set>
 #include <vector>
+#include <atomic>
+#include <stdint.h>
 
 #include "mutex.h"
 
@@ -49,6 +50,15 @@ public:
     bool reset(uint64_t ms, bool from_now = true);
 
 private:
+    /**
+     * @brief 定时器状态 跨线程取消时用它判断定时器是否还能取消
+     */
+    enum State{
+        PENDING = 0,    //等待到期
+        CANCELLED,      //已经取消
+        EXPIRED         //一次性定时器已经到期
+    };
+
     //Timer的构造函数为私有意味着不能显式创建对象  必须由TimerManager来创建
     /**
      * @brief 定时器类构造函数 不能显式创建对象
@@ -56,22 +66,16 @@ private:
      * @param[in] cb 执行的回调函数
      * @param[in] recurring 是否是循环定时器
      * @param[in] manager 哪一个定时器管理类
+     * @param[in] slack 允许推迟触发的时长
      */
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager);
+    Timer(uint64_t ms, std::function<void()> cb, bool recurring, TimerManager *manager, uint64_t slack);
 
     /**
-     * @brief 定时器类构造函数 不能显式创建对象
-     * @param[in] next 到期时间点
-     */
-    Timer(uint64_t next);
-
-    /**
-     * @brief 构建仿函数 用于set比较
+     * @brief 计算挂到时间轮上的触发时间点 在[m_next, m_next + m_slack]内取尽量整的时间点
+     * @details 容差窗口重叠的定时器会落到同一个时间点 合并成一次唤醒
+     * @return uint64_t 
      */
-    struct Comparator
-    {
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    uint64_t getExpireTime() const;
 
 private:
     /// 定时器间隔时长
@@ -82,8 +86,25 @@ private:
     bool m_recurring = false;
     /// 精确的定时器超时时间点
     uint64_t m_next = 0;
+    /// 允许推迟触发的时长 0为准时触发
+    uint64_t m_slack = 0;
     /// 定时器管理类指针
     TimerManager* m_manager = nullptr;
+    /// 定时器状态
+    std::atomic<int> m_state = {PENDING};
+    /// 所属时间轮下标
+    size_t m_wheel = 0;
+
+    /// 时间轮槽位链表 前一个定时器
+    Timer* m_prevNode = nullptr;
+    /// 时间轮槽位链表 后一个定时器
+    Timer* m_nextNode = nullptr;
+    /// 所在时间轮层级 -1为不在时间轮中
+    int m_level = -1;
+    /// 所在槽位下标
+    int m_slot = 0;
+    /// 在时间轮中时持有自身 槽位链表只存裸指针
+    Timer::ptr m_self;
 
 };
 
@@ -111,9 +132,10 @@ public:
      * @param[in] ms 间隔时长
      * @param[in] cb 执行的回调函数
      * @param[in] recurring 是否是循环定时器 默认不是 
+     * @param[in] slack 允许推迟触发的时长 低优先级的定时器设置后可以和其他定时器合并唤醒 默认准时触发
      * @return Timer::ptr 添加完成后会将创建的定时器返回
      */
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false);
+    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb, bool recurring = false, uint64_t slack = 0);
 
     /**
      * @brief 添加条件定时器
@@ -121,9 +143,10 @@ public:
      * @param[in] cb 执行的回调函数
      * @param[in] weak_cond 判断条件是否还存在的弱指针
      * @param[in] recurring 是否是循环定时器 默认不是 
+     * @param[in] slack 允许推迟触发的时长 默认准时触发
      * @return Timer::ptr 添加完成后会将创建的定时器返回
      */
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false);
+    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb, std::weak_ptr<void> weak_cond, bool recurring = false, uint64_t slack = 0);
 
     /**
      * @brief 获取队头定时器的到期时间点
@@ -150,30 +173,233 @@ protected:
      */
     virtual void onTimerInsertedAtFront() = 0;
 
+    /**
+     * @brief 每线程时间轮模式下 获取当前线程拥有的时间轮下标
+     * @return int 当前线程不拥有时间轮返回-1
+     */
+    virtual int getTimerWheelIndex() = 0;
+
+    /**
+     * @brief 每线程时间轮模式下 为外部线程添加的定时器选择时间轮
+     * @return size_t 时间轮下标
+     */
+    virtual size_t selectTimerWheel() = 0;
+
+    /**
+     * @brief 每线程时间轮模式下 向时间轮的收件箱投递了操作 要唤醒拥有它的线程
+     * @param[in] index 时间轮下标
+     * @param[in] lazy 操作不急于执行(取消) 拥有者下一次处理收件箱或转到该槽位时再执行即可
+     */
+    virtual void onTimerPosted(size_t index, bool lazy) = 0;
+
+    /**
+     * @brief 计算定时器到期时间点用的当前时间 默认读取GetTickMs() 不会早于真实的单调时间
+     * @details 测试可以重写 用虚拟时钟确定性地驱动时间轮
+     * @return uint64_t 
+     */
+    virtual uint64_t getCurrentMs();
+
+    /**
+     * @brief 推进时间轮和计算等待时长用的当前时间 默认读取线程缓存的单调时间
+     * @return uint64_t 
+     */
+    virtual uint64_t getCoarseMs();
+
     /**
      * @brief 以智能指针形式 添加条件定时器
      * @param[in] p 定时器智能指针
      */
     void addTimer(Timer::ptr p);
 
+    /**
+     * @brief 切换为每线程时间轮模式 每个线程拥有一个时间轮 只能在添加定时器之前调用
+     * @details 线程操作自己的时间轮不加锁 其他线程的添加/取消/刷新/重置通过无锁收件箱投递给拥有者
+     * @param[in] count 时间轮数量
+     */
+    void setTimerWheels(size_t count);
+
 private:
+    /// 第0层槽位数 每个槽位1ms
+    static const int WHEEL0_BITS = 8;
+    static const int WHEEL0_SIZE = 1 << WHEEL0_BITS;
+    /// 第1~4层槽位数 每层槽位跨度是下一层整圈的长度
+    static const int WHEELN_BITS = 6;
+    static const int WHEELN_SIZE = 1 << WHEELN_BITS;
+    /// 层数 总共覆盖2^32ms
+    static const int WHEEL_LEVELS = 5;
+
+    /**
+     * @brief 投递到时间轮收件箱的定时器操作
+     */
+    struct TimerOp
+    {
+        /**
+         * @brief 操作类型
+         */
+        enum Type{
+            ADD = 0,    //添加
+            CANCEL,     //取消
+            REFRESH,    //刷新
+            RESET       //重置
+        };
+
+        /// 操作类型
+        Type type = ADD;
+        /// 操作的定时器
+        Timer::ptr timer;
+        /// 重置的间隔时长
+        uint64_t ms = 0;
+        /// 重置是否从当前时间点开始计时
+        bool fromNow = false;
+        /// 收件箱链表的下一个操作
+        TimerOp* next = nullptr;
+    };
+
+    /**
+     * @brief 分层时间轮结构体
+     */
+    struct TimerWheel
+    {
+        /// 分层时间轮 每个槽位是定时器双向链表的头 第1~4层只用前WHEELN_SIZE个槽位
+        Timer* slots[WHEEL_LEVELS][WHEEL0_SIZE] = {};
+        /// 每层槽位是否非空的位图 用于跳过空槽位
+        uint64_t bitmap[WHEEL_LEVELS][WHEEL0_SIZE / 64] = {};
+        /// 下一个还没处理的时间点 之前到期的定时器都已经取出
+        uint64_t current = 0;
+        /// 时间轮中的定时器数量 供其他线程无锁查看
+        std::atomic<size_t> count = {0};
+        /// 最近一次计算出的下一次处理时间点 插入更早的定时器时才需要唤醒
+        uint64_t nextTickCache = ~0ull;
+        /// 避免频繁唤醒的一个标识
+        bool tickled = false;
+        /// 其他线程投递的操作 无锁栈 拥有者一次全部取走
+        std::atomic<TimerOp*> mailbox = {nullptr};
+        /// 收件箱中还没挂到时间轮上的定时器数量
+        std::atomic<size_t> pending = {0};
+
+        /**
+         * @brief 时间轮构造函数 从当前时间点开始转动
+         * @param[in] now_ms 当前时间点
+         */
+        TimerWheel(uint64_t now_ms);
+
+        /**
+         * @brief 把定时器挂到对应槽位
+         * @param[in] timer 定时器
+         */
+        void link(const Timer::ptr& timer);
+
+        /**
+         * @brief 把定时器从时间轮摘下
+         * @param[in] timer 定时器
+         * @return Timer::ptr 时间轮持有的定时器引用 在锁外释放
+         */
+        Timer::ptr unlink(Timer* timer);
+
+        /**
+         * @brief 把某一层槽位的定时器重新分配到更低的层级
+         * @param[in] level 层级
+         * @param[in] slot 槽位下标
+         * @return int 槽位下标 为0时需要继续降级更高一层
+         */
+        int cascade(int level, int slot);
+
+        /**
+         * @brief 时间轮推进到now_ms 取出所有到期的定时器
+         * @param[in] now_ms 当前时间点
+         * @param[out] expired 到期的定时器
+         */
+        void advance(uint64_t now_ms, std::vector<Timer::ptr>& expired);
+
+        /**
+         * @brief 取出时间轮中所有的定时器
+         * @param[out] expired 所有定时器
+         */
+        void takeAll(std::vector<Timer::ptr>& expired);
+
+        /**
+         * @brief 计算下一次需要处理时间轮的时间点 不晚于最早到期的定时器
+         * @return uint64_t 没有定时器返回~0ull
+         */
+        uint64_t nextTick() const;
+    };
+
+    /**
+     * @brief 对定时器执行取消/刷新/重置 按模式加锁、直接操作或者投递给拥有者
+     * @param[in] timer 定时器
+     * @param[in] type 操作类型
+     * @param[in] ms 重置的间隔时长
+     * @param[in] from_now 重置是否从当前时间点开始计时
+     * @return true 成功
+     * @return false 失败
+     */
+    bool modify(Timer* timer, TimerOp::Type type, uint64_t ms = 0, bool from_now = false);
+
+    /**
+     * @brief 在时间轮上执行一个操作 调用前需持有写锁或者是时间轮的拥有者
+     * @param[in] wheel 时间轮
+     * @param[in] timer 定时器
+     * @param[in] type 操作类型
+     * @param[in] ms 重置的间隔时长
+     * @param[in] from_now 重置是否从当前时间点开始计时
+     * @param[out] released 从时间轮摘下的定时器引用 在锁外释放
+     * @return true 成功
+     * @return false 失败
+     */
+    bool apply(TimerWheel& wheel, Timer* timer, TimerOp::Type type, uint64_t ms, bool from_now, Timer::ptr& released);
+
+    /**
+     * @brief 把操作投递到时间轮的收件箱 除取消外都唤醒拥有者
+     * @param[in] index 时间轮下标
+     * @param[in] op 操作
+     */
+    void post(size_t index, TimerOp* op);
+
+    /**
+     * @brief 拥有者取出收件箱中全部操作 按投递顺序执行
+     * @param[in] wheel 时间轮
+     */
+    void drain(TimerWheel& wheel);
+
+    /**
+     * @brief 单一时间轮模式下 判断刚挂上的定时器是否插在了队头 调用前需持有写锁
+     * @param[in] wheel 时间轮
+     * @param[in] next 定时器到期时间点
+     * @return true 插在了队头 需要唤醒
+     * @return false 不需要唤醒
+     */
+    bool insertedAtFront(TimerWheel& wheel, uint64_t next);
+
+    /**
+     * @brief 把定时器挂到时间轮上 调用前需持有写锁或者是时间轮的拥有者
+     * @details 空的时间轮不会被推进 游标可能已经落后很久 先对齐到当前时间 
+     *          否则新定时器会按落后的游标放到高层 第一次计算等待时长时多唤醒一次
+     * @param[in] wheel 时间轮
+     * @param[in] timer 定时器
+     */
+    void linkTimer(TimerWheel& wheel, const Timer::ptr& timer);
+
+    /**
+     * @brief 推进时间轮 收集到期定时器的回调 循环定时器重新挂上 调用前需持有写锁或者是时间轮的拥有者
+     * @param[in] wheel 时间轮
+     * @param[out] cbs 到期的回调函数
+     */
+    void expire(TimerWheel& wheel, std::vector<std::function<void()> >& cbs);
+
     /**
-     * @brief 探测当前服务器时间是否改变 
-     * @param[in] now_ms 当前的时间点 
-     * @return true 已经被修改
-     * @return false 没有被修改
+     * @brief 计算距离时间轮下一次处理的时间间隔 调用前需持有写锁或者是时间轮的拥有者
+     * @param[in] wheel 时间轮
+     * @return uint64_t 没有定时器返回~0ull
      */
-    bool checkClockChange(uint64_t now_ms);
+    uint64_t nextTimeout(TimerWheel& wheel);
 
 private:
-    /// 读写锁
+    /// 读写锁 单一时间轮模式下保护时间轮
     MutexType m_mutex;
-    /// 定时器队列
-    std::set<Timer::ptr, Timer::Comparator> m_timers; 
-    /// 避免频繁唤醒的一个标识
-    bool m_tickled = false;
-    /// 上一次修改前的服务器的时间
-    uint64_t m_previousTime = 0;
+    /// 时间轮 单一时间轮模式下只有一个 所有线程共用
+    std::vector<std::unique_ptr<TimerWheel> > m_wheels;
+    /// 是否每个线程拥有一个时间轮
+    bool m_perWorker = false;
 
 };
 
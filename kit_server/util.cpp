@@ -84,17 +84,61 @@ std::string BackTraceToString(int size, const std::string &prefix, int skip)
 //获取ms级时间
 uint64_t GetCurrentMs()
 {
-    struct timeval tv;
-    gettimeofday(&tv, nullptr);
-    return tv.tv_sec * 1000ul + tv.tv_usec / 1000;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
 }
 
 //获取us级时间
 uint64_t GetCurrentUs()
 {
-    struct timeval tv;
-    gettimeofday(&tv, nullptr);
-    return tv.tv_sec * 1000 * 1000ul + tv.tv_usec;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+/// 线程缓存的单调时间 0为还没有刷新过
+static thread_local uint64_t t_coarse_ms = 0;
+
+//获取缓存的ms级时间
+uint64_t GetCoarseMs()
+{
+    return t_coarse_ms ? t_coarse_ms : GetCurrentMs();
+}
+
+//刷新缓存的ms级时间
+uint64_t UpdateCoarseMs()
+{
+    t_coarse_ms = GetCurrentMs();
+    return t_coarse_ms;
+}
+
+//停止使用缓存的时间
+void ResetCoarseMs()
+{
+    t_coarse_ms = 0;
+}
+
+//粗粒度单调时钟的精度 单位ns
+static uint64_t GetTickResNs()
+{
+    struct timespec ts;
+    if(clock_getres(CLOCK_MONOTONIC_COARSE, &ts))
+        return 0;
+    return ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec;
+}
+
+//获取计算定时器到期时间用的ms级单调时间
+uint64_t GetTickMs()
+{
+    static const uint64_t s_res_ns = GetTickResNs();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    uint64_t ns = ts.tv_sec * 1000 * 1000 * 1000ul + ts.tv_nsec + s_res_ns;
+    uint64_t ms = (ns + 999999) / 1000000;
+    //粗粒度时钟偶尔会落后不止一个tick 本轮调度开始时读过的真实时间是可靠的下界
+    return ms > t_coarse_ms ? ms : t_coarse_ms;
 }
 
 std::string Timer2Str(time_t ts, const std::string& format)
@@ -53,18 +53,46 @@ std::string BackTraceToString(int size = 64, const std::string &prefix = "", int
 
 
 /**
- * @brief 获取ms级精度时间
+ * @brief 获取ms级精度时间 单调时钟 不受系统时间修改影响 只用于计算时间间隔
  * @return 返回时间值
  */
 uint64_t GetCurrentMs();
 
 
 /**
- * @brief 获取us级时间
+ * @brief 获取us级时间 单调时钟 不受系统时间修改影响 只用于计算时间间隔
  * @return 返回时间值
  */
 uint64_t GetCurrentUs();
 
+/**
+ * @brief 获取当前线程缓存的ms级单调时间 
+ * @details 调度线程每次调度和每次epoll_wait返回时刷新一次 同一轮调度内的定时器计算不再重复读时钟
+ *          没有刷新过的线程直接读取单调时钟
+ * @return 返回时间值
+ */
+uint64_t GetCoarseMs();
+
+/**
+ * @brief 刷新当前线程缓存的ms级单调时间
+ * @return 返回刷新后的时间值
+ */
+uint64_t UpdateCoarseMs();
+
+/**
+ * @brief 当前线程停止使用缓存的单调时间 之后GetCoarseMs()直接读取单调时钟
+ */
+void ResetCoarseMs();
+
+/**
+ * @brief 获取ms级单调时间 用于计算定时器到期时间点
+ * @details 读取内核每个tick更新一次的CLOCK_MONOTONIC_COARSE 走vDSO不读硬件计时器 比GetCurrentMs()便宜
+ *          结果补上一个tick的精度 并且不早于线程缓存的单调时间
+ *          粗粒度时钟的更新有抖动 任务运行很久之后算出的到期时间最多提前几ms 不会提前整个运行时长
+ * @return 返回时间值
+ */
+uint64_t GetTickMs();
+
 /**
  * @brief 将时间戳转换为字符串形式
  * @param ts  时间戳数值
@@ -0,0 +1,97 @@
+#include "../kit_server/Log.h"
+#include "../kit_server/context.h"
+#include "../kit_server/coroutine.h"
+#include "../kit_server/macro.h"
+#include "../kit_server/util.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+using namespace std;
+using namespace kit_server;
+
+static Logger::ptr g_logger = KIT_LOG_ROOT();
+
+//切换往返次数
+static const uint64_t LOOP = 10000000;
+
+/**
+ * @brief 两个上下文之间来回切换 入口函数没有参数 用静态成员传递状态
+ */
+template<class Ctx>
+struct PingPong
+{
+    static Ctx main_ctx;
+    static Ctx co_ctx;
+    static uint64_t count;
+
+    static void Entry()
+    {
+        while(1)
+        {
+            ++count;
+            co_ctx.swapTo(main_ctx);
+        }
+    }
+};
+
+template<class Ctx> Ctx PingPong<Ctx>::main_ctx;
+template<class Ctx> Ctx PingPong<Ctx>::co_ctx;
+template<class Ctx> uint64_t PingPong<Ctx>::count = 0;
+
+template<class Ctx>
+void bench_context(const char *name)
+{
+    typedef PingPong<Ctx> PP;
+    const size_t stack_size = 128 * 1024;
+    void *stack = malloc(stack_size);
+
+    KIT_ASSERT(PP::co_ctx.make(stack, stack_size, &PP::Entry));
+
+    uint64_t begin = GetCurrentUs();
+    for(uint64_t i = 0;i < LOOP;++i)
+        PP::main_ctx.swapTo(PP::co_ctx);
+    uint64_t used = GetCurrentUs() - begin;
+
+    KIT_ASSERT(PP::count == LOOP);
+    //协程停在Entry里不会再被切回 直接释放栈
+    free(stack);
+
+    KIT_LOG_INFO(g_logger) << name << ": " << LOOP * 2 << " switches, used " << used << "us, "
+        << (uint64_t)(LOOP * 2 * 1000000.0 / (used ? used : 1)) << " switches/s";
+}
+
+//通过Coroutine的call/back测试 包含状态维护等开销
+void bench_coroutine()
+{
+    Coroutine::GetThis();
+    uint64_t count = 0;
+    Coroutine::ptr cor(new Coroutine([&count](){
+        while(1)
+        {
+            ++count;
+            Coroutine::GetThis()->back();
+        }
+    }, 128 * 1024, true));
+
+    uint64_t begin = GetCurrentUs();
+    for(uint64_t i = 0;i < LOOP;++i)
+        cor->call();
+    uint64_t used = GetCurrentUs() - begin;
+
+    KIT_ASSERT(count == LOOP);
+
+    KIT_LOG_INFO(g_logger) << "Coroutine call/back: " << LOOP * 2 << " switches, used " << used << "us, "
+        << (uint64_t)(LOOP * 2 * 1000000.0 / (used ? used : 1)) << " switches/s";
+}
+
+int main()
+{
+    bench_context<UContext>("ucontext");
+#if KIT_CONTEXT_HAS_ASM
+    bench_context<AsmContext>("asm");
+#endif
+    bench_coroutine();
+
+    return 0;
+}
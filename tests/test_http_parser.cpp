@@ -11,6 +11,9 @@
 #include "../kit_server/http/http.h"
 #include "../kit_server/http/http_parser.h"
 
+#include <string.h>
+#include <algorithm>
+
 using namespace std;
 using namespace kit_server;
 
@@ -81,6 +84,121 @@ void test_response()
 
 }
 
+char test_view_data[] =
+"GET /a/b?x=1&y=2#frag HTTP/1.1\r\n"
+"Host: www.baidu.com\r\n"
+"X-Dup: one\r\n"
+"Content-Type: text/plain\r\n"
+"x-dup: two\r\n"
+"Content-Length: 0\r\n"
+"X-DUP: three\r\n"
+"\r\n";
+
+/**
+ * @brief 零拷贝解析出一个请求 字段都指向data
+ * @param[in] data 请求报文 要比请求活得久
+ * @param[in] parser 解析器
+ * @return http::HttpRequest::ptr
+ */
+static http::HttpRequest::ptr ParseView(std::string& data, http::HttpRequestParser& parser)
+{
+    size_t ret = parser.parse(data.c_str(), data.size());
+    KIT_ASSERT(!parser.hasError() && parser.isFinished());
+    KIT_ASSERT(ret == data.size());
+
+    http::HttpRequest::ptr req = parser.getData();
+    KIT_ASSERT(req->isView());
+    return req;
+}
+
+static bool Equal(const http::StringView& v, const char* s)
+{
+    return v.valid() && v.len == strlen(s) && strncmp(v.data, s, v.len) == 0;
+}
+
+/**
+ * @brief 首部字段视图 不区分大小写按哈希查找 重复的字段以最后一个为准
+ */
+void test_header_view()
+{
+    http::HttpRequestParser parser;
+    std::string data = test_view_data;
+    http::HttpRequest::ptr req = ParseView(data, parser);
+
+    KIT_ASSERT(Equal(req->getPathView(), "/a/b"));
+    KIT_ASSERT(Equal(req->getQueryView(), "x=1&y=2"));
+
+    KIT_ASSERT(Equal(req->getHeaderView("content-type"), "text/plain"));
+    KIT_ASSERT(Equal(req->getHeaderView("CONTENT-TYPE"), "text/plain"));
+    KIT_ASSERT(Equal(req->getHeaderView("Content-Type"), "text/plain"));
+    KIT_ASSERT(req->getHeadr("HOST") == "www.baidu.com");
+    KIT_ASSERT(req->GetHeaderAs<int>("content-length", -1) == 0);
+
+    //前缀相同或者不存在的字段查不到
+    KIT_ASSERT(!req->getHeaderView("content").valid());
+    KIT_ASSERT(!req->getHeaderView("content-type2").valid());
+    KIT_ASSERT(!req->getHeaderView("x-missing").valid());
+    KIT_ASSERT(req->getHeadr("x-missing", "def") == "def");
+    KIT_ASSERT(!req->hasHeader("x-missing"));
+
+    //重复的字段以最后一个为准
+    std::string val;
+    KIT_ASSERT(Equal(req->getHeaderView("x-dup"), "three"));
+    KIT_ASSERT(req->hasHeader("X-Dup", &val) && val == "three");
+
+    //只读不会把首部字段拷贝出来
+    KIT_ASSERT(req->isView());
+
+    KIT_LOG_INFO(g_logger) << "test_header_view ok";
+}
+
+/**
+ * @brief getHeaders()/setHeader()/detach()把视图拷贝出来 之后不再依赖接收缓冲区
+ */
+void test_detach()
+{
+    //getHeaders()把首部字段拷贝到字段组中 重复的字段以最后一个为准
+    http::HttpRequestParser parser;
+    std::string data = test_view_data;
+    http::HttpRequest::ptr req = ParseView(data, parser);
+
+    const http::HttpRequest::MapType& headers = req->getHeaders();
+    std::fill(data.begin(), data.end(), 'z');
+    KIT_ASSERT(headers.size() == 4);
+    KIT_ASSERT(headers.at("x-dup") == "three");
+    KIT_ASSERT(headers.at("HOST") == "www.baidu.com");
+    KIT_ASSERT(Equal(req->getHeaderView("X-DUP"), "three"));
+    KIT_ASSERT(req->getHeadr("content-type") == "text/plain");
+    //路径还是视图
+    KIT_ASSERT(req->isView());
+
+    //setHeader()先拷贝原来的首部字段再修改
+    data = test_view_data;
+    req = ParseView(data, parser);
+    req->setHeader("X-New", "1");
+    req->setHeader("x-dup", "four");
+    std::fill(data.begin(), data.end(), 'z');
+    KIT_ASSERT(req->getHeadr("x-new") == "1");
+    KIT_ASSERT(req->getHeadr("X-DUP") == "four");
+    KIT_ASSERT(req->getHeadr("host") == "www.baidu.com");
+    KIT_ASSERT(req->getHeaders().size() == 5);
+
+    //detach()之后所有字段都是自己的
+    data = test_view_data;
+    req = ParseView(data, parser);
+    req->detach();
+    std::fill(data.begin(), data.end(), 'z');
+    KIT_ASSERT(!req->isView());
+    KIT_ASSERT(req->getPath() == "/a/b");
+    KIT_ASSERT(req->getQuery() == "x=1&y=2");
+    KIT_ASSERT(req->getFragment() == "frag");
+    KIT_ASSERT(Equal(req->getPathView(), "/a/b"));
+    KIT_ASSERT(req->getHeadr("x-dup") == "three");
+    KIT_ASSERT(req->getHeaders().size() == 4);
+
+    KIT_LOG_INFO(g_logger) << "test_detach ok";
+}
+
 
 int main()
 {
@@ -89,6 +207,9 @@ int main()
     test_request();
     std::cout << "---------------\n";
     test_response();
+    std::cout << "---------------\n";
+    test_header_view();
+    test_detach();
 
     KIT_LOG_INFO(g_logger) << "test end";
 
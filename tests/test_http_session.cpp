@@ -0,0 +1,403 @@
+#include "../kit_server/address.h"
+#include "../kit_server/Log.h"
+#include "../kit_server/config.h"
+#include "../kit_server/iomanager.h"
+#include "../kit_server/hook.h"
+#include "../kit_server/socket.h"
+#include "../kit_server/macro.h"
+#include "../kit_server/http/http.h"
+#include "../kit_server/http/http_parser.h"
+#include "../kit_server/http/http_session.h"
+
+#include <stdio.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace kit_server;
+
+static Logger::ptr g_logger = KIT_LOG_ROOT();
+
+//监听套接字和它的地址 每个用例用一条新连接
+static Socket::ptr s_listen;
+static IPAddress::ptr s_addr;
+
+static const char* CHUNKED_HEADER = "POST /chunked HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+static const char* NEXT_REQUEST = "GET /next HTTP/1.1\r\n\r\n";
+
+
+/**
+ * @brief 把每一块编码成chunked格式 不含最后的0长度块
+ * @param[in] chunks 每一块数据
+ * @return std::string
+ */
+static std::string EncodeChunks(const std::vector<std::string>& chunks)
+{
+    std::string out;
+    for(auto& x : chunks)
+    {
+        char size[32];
+        snprintf(size, sizeof(size), "%zx\r\n", x.size());
+        out += size + x + "\r\n";
+    }
+    return out;
+}
+
+/**
+ * @brief 客户端 每次发送piece个字节 中间让出一会儿 让服务端分多次读到
+ * @param[in] data 要发送的数据
+ * @param[in] piece 每次发送的字节数
+ */
+static void SendPieces(const std::string& data, size_t piece)
+{
+    Socket::ptr sock = Socket::CreateTCP(s_addr);
+    KIT_ASSERT(sock->connect(s_addr));
+    for(size_t i = 0;i < data.size();i += piece)
+    {
+        KIT_ASSERT(sock->send(&data[i], std::min(piece, data.size() - i)) > 0);
+        usleep(1000);
+    }
+
+    //等服务端关闭连接
+    char c;
+    sock->recv(&c, 1);
+    sock->close();
+}
+
+/**
+ * @brief 起一个客户端发送data 返回服务端的会话
+ * @param[in] data 要发送的数据
+ * @param[in] piece 每次发送的字节数
+ * @return http::HttpSession::ptr
+ */
+static http::HttpSession::ptr Connect(const std::string& data, size_t piece)
+{
+    IOManager::GetThis()->schedule(std::bind(&SendPieces, data, piece));
+    Socket::ptr client = s_listen->accept();
+    KIT_ASSERT(client);
+    return http::HttpSession::ptr(new http::HttpSession(client));
+}
+
+/**
+ * @brief 用很小的缓冲区读完报文主体 一块数据要分多次才能读完
+ * @param[in] session 会话
+ * @param[out] body 读到的主体
+ * @return int 0读完 <0出错
+ */
+static int ReadAll(http::HttpSession::ptr session, std::string& body)
+{
+    char buffer[7];
+    while(1)
+    {
+        int n = session->readBody(buffer, sizeof(buffer));
+        if(n <= 0)
+            return n;
+        body.append(buffer, n);
+    }
+}
+
+/**
+ * @brief 读一个chunked请求的主体 主体必须是expect 后面的流水线请求还能正常解析
+ * @param[in] encoded 编码后的主体 包含最后一块和trailer
+ * @param[in] expect 解码后的主体
+ * @param[in] piece 每次发送的字节数
+ */
+static void CheckChunked(const std::string& encoded, const std::string& expect, size_t piece)
+{
+    http::HttpSession::ptr session = Connect(CHUNKED_HEADER + encoded + NEXT_REQUEST, piece);
+
+    http::HttpRequest::ptr req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/chunked");
+    KIT_ASSERT(session->hasPendingBody());
+
+    std::string body;
+    KIT_ASSERT(ReadAll(session, body) == 0);
+    KIT_ASSERT(body == expect);
+    KIT_ASSERT(!session->hasPendingBody());
+
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/next");
+}
+
+/**
+ * @brief 读一个格式错误的chunked请求 readBody()要报错
+ * @param[in] encoded 编码后的主体
+ */
+static void CheckInvalid(const std::string& encoded)
+{
+    http::HttpSession::ptr session = Connect(CHUNKED_HEADER + encoded + NEXT_REQUEST, 4096);
+
+    http::HttpRequest::ptr req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/chunked");
+
+    std::string body;
+    KIT_ASSERT(ReadAll(session, body) < 0);
+}
+
+
+/**
+ * @brief 分多次读到的chunked主体 块长度行、块数据、CRLF都可能被拆开
+ */
+void test_chunked_split()
+{
+    std::vector<std::string> chunks = {"hello", std::string(300, 'a'), "x", std::string(700, 'b')};
+    std::string expect;
+    for(auto& x : chunks)
+        expect += x;
+    std::string encoded = EncodeChunks(chunks) + "0\r\n\r\n";
+
+    for(size_t piece : {2, 5, 17, 4096})
+        CheckChunked(encoded, expect, piece);
+
+    KIT_LOG_INFO(g_logger) << "test_chunked_split ok";
+}
+
+/**
+ * @brief 块扩展、大写和带前导0的块长度、trailer
+ */
+void test_chunked_ext_trailer()
+{
+    std::string encoded =
+        "5;name=value\r\nhello\r\n"
+        "00A ; a=1;b=\"x y\"\r\n0123456789\r\n"
+        "0;last\r\n"
+        "X-Sum: 15\r\n"
+        "X-Other: abc\r\n"
+        "\r\n";
+
+    CheckChunked(encoded, "hello0123456789", 3);
+    CheckChunked(encoded, "hello0123456789", 4096);
+
+    KIT_LOG_INFO(g_logger) << "test_chunked_ext_trailer ok";
+}
+
+/**
+ * @brief 不读的主体在下一次recvRequest()时丢掉 也可以显式丢掉
+ */
+void test_discard()
+{
+    std::string encoded = EncodeChunks({"abc", std::string(5000, 'z')}) + "0\r\nX-T: 1\r\n\r\n";
+
+    //下一次收请求时自动丢掉
+    http::HttpSession::ptr session = Connect(CHUNKED_HEADER + encoded + NEXT_REQUEST, 1000);
+    http::HttpRequest::ptr req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/chunked");
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/next");
+
+    //读了一部分之后显式丢掉
+    session = Connect(CHUNKED_HEADER + encoded + NEXT_REQUEST, 1000);
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/chunked");
+    char buffer[10];
+    KIT_ASSERT(session->readBody(buffer, sizeof(buffer)) > 0);
+    KIT_ASSERT(session->discardBody());
+    KIT_ASSERT(!session->hasPendingBody());
+    KIT_ASSERT(session->readBody(buffer, sizeof(buffer)) == 0);
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/next");
+
+    KIT_LOG_INFO(g_logger) << "test_discard ok";
+}
+
+/**
+ * @brief 格式错误的chunked主体
+ */
+void test_chunked_invalid()
+{
+    //块长度行没有十六进制数字
+    CheckInvalid("\r\nhello\r\n0\r\n\r\n");
+    CheckInvalid(";ext\r\nhello\r\n0\r\n\r\n");
+    CheckInvalid("zz\r\nhello\r\n0\r\n\r\n");
+    //行尾只有LF
+    CheckInvalid("5\nhello\r\n0\r\n\r\n");
+    CheckInvalid("5;ext\nhello\r\n0\r\n\r\n");
+    CheckInvalid("5\rhello\r\n0\r\n\r\n");
+    //块数据后面不是CRLF
+    CheckInvalid("5\r\nhello\n0\r\n\r\n");
+    CheckInvalid("5\r\nhelloX\r\n0\r\n\r\n");
+    //trailer行尾只有LF
+    CheckInvalid("5\r\nhello\r\n0\r\nX-T: 1\n\r\n");
+    CheckInvalid("5\r\nhello\r\n0\r\n\n");
+
+    KIT_LOG_INFO(g_logger) << "test_chunked_invalid ok";
+}
+
+/**
+ * @brief chunked主体超过http.request.max_body_size
+ */
+void test_max_body()
+{
+    auto max_body = Config::LookUp<uint64_t>("http.request.max_body_size");
+    uint64_t old_value = max_body->getValue();
+    max_body->setValue(1024);
+
+    std::string encoded = EncodeChunks({std::string(600, 'a'), std::string(600, 'b')}) + "0\r\n\r\n";
+
+    //正好不超过上限的可以读完
+    CheckChunked(EncodeChunks({std::string(600, 'a'), std::string(424, 'b')}) + "0\r\n\r\n",
+        std::string(600, 'a') + std::string(424, 'b'), 4096);
+
+    http::HttpSession::ptr session = Connect(CHUNKED_HEADER + encoded, 4096);
+    http::HttpRequest::ptr req = session->recvRequest();
+    KIT_ASSERT(req);
+    std::string body;
+    KIT_ASSERT(ReadAll(session, body) < 0);
+    KIT_ASSERT(body.size() <= 1024);
+
+    session = Connect(CHUNKED_HEADER + encoded, 4096);
+    req = session->recvRequest();
+    KIT_ASSERT(req);
+    KIT_ASSERT(!session->discardBody());
+
+    max_body->setValue(old_value);
+
+    KIT_LOG_INFO(g_logger) << "test_max_body ok";
+}
+
+/**
+ * @brief 读一个响应的首部
+ * @param[in] sock 客户端套接字
+ * @return std::string 读到\r\n\r\n为止 超时或者连接关闭返回空
+ */
+static std::string RecvHeader(Socket::ptr sock)
+{
+    std::string out;
+    char c;
+    while(out.size() < 4 || out.compare(out.size() - 4, 4, "\r\n\r\n") != 0)
+    {
+        if(sock->recv(&c, 1) <= 0)
+            return "";
+        out.push_back(c);
+    }
+    return out;
+}
+
+/**
+ * @brief 长连接客户端 每个响应只读首部 主体长度必须能从首部确定
+ */
+static void KeepAliveClient()
+{
+    Socket::ptr sock = Socket::CreateTCP(s_addr);
+    KIT_ASSERT(sock->connect(s_addr));
+    sock->setRecvTimeout(3000);
+
+    std::string req = "GET /found HTTP/1.1\r\nHost: x\r\n\r\n";
+    KIT_ASSERT(sock->send(req.c_str(), req.size()) > 0);
+    std::string rsp = RecvHeader(sock);
+    KIT_ASSERT2(rsp.find("HTTP/1.1 302") == 0, rsp);
+    KIT_ASSERT2(rsp.find("connection: keep-alive\r\n") != std::string::npos, rsp);
+    KIT_ASSERT2(rsp.find("content-length: 0\r\n") != std::string::npos, rsp);
+
+    //204不能带content-length
+    req = "GET /empty HTTP/1.1\r\nHost: x\r\n\r\n";
+    KIT_ASSERT(sock->send(req.c_str(), req.size()) > 0);
+    rsp = RecvHeader(sock);
+    KIT_ASSERT2(rsp.find("HTTP/1.1 204") == 0, rsp);
+    KIT_ASSERT2(rsp.find("content-length") == std::string::npos, rsp);
+
+    //服务自己设置了长度的不重复写
+    req = "HEAD /head HTTP/1.1\r\nHost: x\r\n\r\n";
+    KIT_ASSERT(sock->send(req.c_str(), req.size()) > 0);
+    rsp = RecvHeader(sock);
+    KIT_ASSERT2(rsp.find("HTTP/1.1 200") == 0, rsp);
+    KIT_ASSERT2(rsp.find("Content-Length:42\r\n") != std::string::npos, rsp);
+    KIT_ASSERT2(rsp.find("content-length") == std::string::npos, rsp);
+
+    sock->close();
+}
+
+/**
+ * @brief 长连接上没有主体的响应 要带content-length: 0
+ */
+void test_empty_body()
+{
+    IOManager::GetThis()->schedule(&KeepAliveClient);
+    Socket::ptr client = s_listen->accept();
+    KIT_ASSERT(client);
+    http::HttpSession::ptr session(new http::HttpSession(client));
+
+    http::HttpRequest::ptr req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/found" && !req->isClose());
+    http::HttpResponse::ptr rsp(new http::HttpResponse(req->getVersion(), req->isClose()));
+    rsp->setStatus(http::HttpStatus::FOUND);
+    rsp->setHeader("Location", "/other");
+    KIT_ASSERT(session->sendResponse(rsp) > 0);
+
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/empty");
+    rsp.reset(new http::HttpResponse(req->getVersion(), req->isClose()));
+    rsp->setStatus(http::HttpStatus::NO_CONTENT);
+    KIT_ASSERT(session->sendResponse(rsp) > 0);
+
+    req = session->recvRequest();
+    KIT_ASSERT(req && req->getPath() == "/head");
+    rsp.reset(new http::HttpResponse(req->getVersion(), req->isClose()));
+    rsp->setHeader("Content-Length", "42");
+    KIT_ASSERT(session->sendResponse(rsp) > 0);
+
+    //客户端读完三个响应之后关闭连接
+    KIT_ASSERT(!session->recvRequest());
+
+    KIT_LOG_INFO(g_logger) << "test_empty_body ok";
+}
+
+/**
+ * @brief detach()之后的请求 下一次recvRequest()复用接收缓冲区也不受影响
+ */
+void test_detach()
+{
+    std::string data =
+        "GET /first?a=1#f HTTP/1.1\r\nX-Keep: one\r\nx-keep: last\r\n\r\n"
+        "GET /second-request-overwrites-the-first?bbbbbbbbbbbbbbbb HTTP/1.1\r\n"
+        "X-Other: zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz\r\n\r\n";
+    http::HttpSession::ptr session = Connect(data, 4096);
+
+    http::HttpRequest::ptr first = session->recvRequest();
+    KIT_ASSERT(first && first->isView());
+    first->detach();
+    KIT_ASSERT(!first->isView());
+
+    //第二个请求挪到缓冲区开头 覆盖第一个请求
+    http::HttpRequest::ptr second = session->recvRequest();
+    KIT_ASSERT(second && second->getPath() == "/second-request-overwrites-the-first");
+
+    KIT_ASSERT(first->getPath() == "/first");
+    KIT_ASSERT(first->getQuery() == "a=1");
+    KIT_ASSERT(first->getFragment() == "f");
+    KIT_ASSERT(first->getHeadr("X-KEEP") == "last");
+    KIT_ASSERT(first->getHeaders().size() == 1);
+    KIT_ASSERT(!first->hasHeader("x-other"));
+
+    KIT_LOG_INFO(g_logger) << "test_detach ok";
+}
+
+
+void run()
+{
+    s_addr = Address::LookUpAnyIPAddress("127.0.0.1:0");
+    s_listen = Socket::CreateTCP(s_addr);
+    KIT_ASSERT(s_listen->bind(s_addr));
+    KIT_ASSERT(s_listen->listen());
+    s_addr = std::dynamic_pointer_cast<IPAddress>(s_listen->getLocalAddress());
+    KIT_ASSERT(s_addr);
+
+    test_chunked_split();
+    test_chunked_ext_trailer();
+    test_discard();
+    test_chunked_invalid();
+    test_max_body();
+    test_empty_body();
+    test_detach();
+
+    s_listen->close();
+    KIT_LOG_INFO(g_logger) << "test_http_session ok";
+}
+
+int main(int argc, char *argv[])
+{
+    IOManager iom("test", 2);
+    iom.schedule(&run);
+
+    return 0;
+}
@@ -3,6 +3,12 @@
 #include "../kit_server/config.h"
 #include "../kit_server/thread.h"
 #include "../kit_server/scheduler.h"
+#include "../kit_server/util.h"
+#include "../kit_server/macro.h"
+
+#include <atomic>
+#include <vector>
+#include <sched.h>
 
 
 using namespace std;
@@ -39,8 +45,137 @@ void func3()
 }
 
 
+/**
+ * @brief 指定线程任务测试
+ * @details 线程A上先压入pinned_size个只能由A执行的任务 A处于忙碌状态时
+ *          其他线程去执行普通任务 取任务时不应去检查指定给A的任务
+ * @param[in] pinned_size 指定给线程A的任务数量
+ */
+void test_pinned(int pinned_size)
+{
+    static const int FREE_SIZE = 10000;
+    static std::atomic<int> s_free_done(0);
+    static std::atomic<int> s_pinned_done(0);
+    static std::atomic<int> s_pinned_wrong(0);
+    static std::atomic<int> s_free_on_a(0);
+    s_free_done = 0;
+    s_pinned_done = 0;
+    s_pinned_wrong = 0;
+    s_free_on_a = 0;
+
+    Scheduler sc("pinned", 2, false);
+    sc.start();
+
+    sc.schedule([&sc, pinned_size](){
+        pid_t tid = GetThreadId();
+        for(int i = 0;i < pinned_size;++i)
+        {
+            sc.schedule([tid](){
+                if(GetThreadId() != tid)
+                    ++s_pinned_wrong;
+                ++s_pinned_done;
+            }, tid);
+        }
+
+        for(int i = 0;i < FREE_SIZE;++i)
+        {
+            sc.schedule([tid](){
+                if(GetThreadId() == tid)
+                    ++s_free_on_a;
+                ++s_free_done;
+            });
+        }
+
+        //A线程一直忙碌 普通任务只能被其他线程窃取执行
+        while(s_free_done < FREE_SIZE)
+            sched_yield();
+    });
+
+    sc.stop();
+
+    //指定的任务全部在A线程上执行 A忙碌期间普通任务都由另一个线程执行
+    KIT_ASSERT(s_pinned_done == pinned_size);
+    KIT_ASSERT(s_pinned_wrong == 0);
+    KIT_ASSERT(s_free_on_a == 0);
+
+    //每个任务只在被取走时检查一次 其他线程取任务时不扫描指定给A的任务
+    //如果指定任务和普通任务混在一个队列里 每次取任务都要跳过它们 检查数会多出几个数量级
+    uint64_t scanned = sc.getScannedCount();
+    KIT_LOG_INFO(g_logger) << "pinned size=" << pinned_size 
+        << ", free tasks=" << FREE_SIZE << ", scanned " << scanned;
+    KIT_ASSERT(scanned == (uint64_t)pinned_size + FREE_SIZE + 1);
+}
+
+/**
+ * @brief 共享栈协程测试
+ * @details 大量共享栈协程挂起后 每个只保留用到的栈内容 重新调度后栈上数据不变且回到原线程执行
+ * @param[in] size 协程数量
+ */
+void test_shared_stack(int size)
+{
+    static Mutex s_mutex;
+    static std::vector<Coroutine::ptr> s_parked;
+    static std::atomic<int> s_done(0);
+    s_done = 0;
+
+    Scheduler sc("shared", 2, false);
+    sc.start();
+
+    for(int i = 0;i < size;++i)
+    {
+        sc.schedule([i](){
+            volatile char buf[1024];
+            for(int k = 0;k < 1024;++k)
+                buf[k] = (char)(i + k);
+
+            pid_t tid = GetThreadId();
+            {
+                Mutex::Lock lock(s_mutex);
+                s_parked.push_back(Coroutine::GetThis());
+            }
+            Coroutine::YieldToHold();
+
+            KIT_ASSERT(GetThreadId() == tid);
+            for(int k = 0;k < 1024;++k)
+                KIT_ASSERT(buf[k] == (char)(i + k));
+            ++s_done;
+        }, -1, true);
+    }
+
+    while(1)
+    {
+        {
+            Mutex::Lock lock(s_mutex);
+            if((int)s_parked.size() == size)
+                break;
+        }
+        sched_yield();
+    }
+
+    uint64_t resident = 0;
+    Coroutine::TotalCoroutines(resident);
+    KIT_LOG_INFO(g_logger) << "shared stack coroutines=" << size 
+        << ", stack resident=" << resident << " bytes";
+
+    std::vector<Coroutine::ptr> parked;
+    {
+        Mutex::Lock lock(s_mutex);
+        parked.swap(s_parked);
+    }
+    sc.schedule(parked.begin(), parked.end());
+
+    sc.stop();
+
+    KIT_ASSERT(s_done == size);
+}
+
 int main()
 {
+    test_pinned(0);
+    test_pinned(100000);
+
+    test_shared_stack(10000);
+
     g_logger->addAppender(LogAppender::ptr(new FileLogAppender("schudeler.txt")));
 
     Scheduler sc("test", 3, false);
@@ -0,0 +1,187 @@
+#include "../kit_server/Log.h"
+#include "../kit_server/macro.h"
+#include "../kit_server/http/http.h"
+#include "../kit_server/http/servlet.h"
+
+#include <string.h>
+
+using namespace std;
+using namespace kit_server;
+using namespace kit_server::http;
+
+static Logger::ptr g_logger = KIT_LOG_ROOT();
+
+static StringView View(const char* s)
+{
+    return StringView(s, strlen(s));
+}
+
+/**
+ * @brief 解析Range 检查返回值和区间
+ * @param[in] v Range首部的值
+ * @param[in] size 文件大小
+ * @param[in] rt 期望的返回值
+ * @param[in] first 期望的第一个字节 rt不是1时不检查
+ * @param[in] last 期望的最后一个字节 rt不是1时不检查
+ */
+static void CheckRange(const char* v, uint64_t size, int rt, uint64_t first = 0, uint64_t last = 0)
+{
+    uint64_t f = 0, l = 0;
+    int r = StaticFileServlet::ParseRange(View(v), size, f, l);
+    KIT_ASSERT2(r == rt, v);
+    if(rt == 1)
+        KIT_ASSERT2(f == first && l == last, v);
+}
+
+/**
+ * @brief 解码路径 检查是否成功和解码结果
+ */
+static void CheckDecode(const char* s, bool ok, const std::string& expect = "")
+{
+    std::string out;
+    KIT_ASSERT2(StaticFileServlet::DecodePath(s, strlen(s), out) == ok, s);
+    if(ok)
+        KIT_ASSERT2(out == expect, s);
+}
+
+/**
+ * @brief 解码后的路径是否能跑到根目录外面
+ */
+static bool Escapes(const char* s)
+{
+    std::string out;
+    return !StaticFileServlet::DecodePath(s, strlen(s), out) || StaticFileServlet::HasDotDot(out);
+}
+
+
+/**
+ * @brief 单个区间 开区间 后缀区间
+ */
+void test_range()
+{
+    CheckRange("bytes=0-9", 100, 1, 0, 9);
+    CheckRange("bytes=10-10", 100, 1, 10, 10);
+    CheckRange("BYTES= 1-2", 100, 1, 1, 2);
+    //超过文件末尾的截掉
+    CheckRange("bytes=90-200", 100, 1, 90, 99);
+    //开区间到文件末尾
+    CheckRange("bytes=5-", 100, 1, 5, 99);
+    CheckRange("bytes=99-", 100, 1, 99, 99);
+    //最后n个字节
+    CheckRange("bytes=-3", 100, 1, 97, 99);
+    CheckRange("bytes=-100", 100, 1, 0, 99);
+    CheckRange("bytes=-500", 100, 1, 0, 99);
+
+    //不能满足的区间
+    CheckRange("bytes=-0", 100, -1);
+    CheckRange("bytes=100-", 100, -1);
+    CheckRange("bytes=100-200", 100, -1);
+    CheckRange("bytes=0-", 0, -1);
+    CheckRange("bytes=-5", 0, -1);
+
+    //格式不对的忽略
+    CheckRange("bytes=5-3", 100, 0);
+    CheckRange("bytes=", 100, 0);
+    CheckRange("bytes=-", 100, 0);
+    CheckRange("bytes=a-3", 100, 0);
+    CheckRange("bytes=1-3x", 100, 0);
+    CheckRange("bytes=--3", 100, 0);
+    CheckRange("items=0-9", 100, 0);
+    CheckRange("bytes=99999999999999999999-", 100, 0);
+
+    //多个区间 回整个文件
+    CheckRange("bytes=0-1,5-6", 100, 0);
+    CheckRange("bytes=0-1, -3", 100, 0);
+    CheckRange("bytes=-0,-0", 100, 0);
+
+    KIT_LOG_INFO(g_logger) << "test_range ok";
+}
+
+/**
+ * @brief 路径解码和..段
+ */
+void test_path()
+{
+    CheckDecode("a/b.html", true, "a/b.html");
+    CheckDecode("a%20b%2Fc", true, "a b/c");
+    CheckDecode("%2e%2E/x", true, "../x");
+    CheckDecode("%", false);
+    CheckDecode("a%2", false);
+    CheckDecode("a%zz", false);
+    CheckDecode("a%00b", false);
+
+    KIT_ASSERT(!Escapes("index.html"));
+    KIT_ASSERT(!Escapes("a/b/c"));
+    KIT_ASSERT(!Escapes("..a/b.."));
+    KIT_ASSERT(!Escapes("a/.../b"));
+    KIT_ASSERT(!Escapes("%2e/a"));
+    KIT_ASSERT(Escapes(".."));
+    KIT_ASSERT(Escapes("/../etc/passwd"));
+    KIT_ASSERT(Escapes("a/.."));
+    KIT_ASSERT(Escapes("a/../../b"));
+    KIT_ASSERT(Escapes("%2e%2e/etc/passwd"));
+    KIT_ASSERT(Escapes("a/%2E%2e"));
+    KIT_ASSERT(Escapes("a/.%2e/b"));
+    KIT_ASSERT(Escapes("a%2f..%2fb"));
+
+    KIT_LOG_INFO(g_logger) << "test_path ok";
+}
+
+/**
+ * @brief If-None-Match 弱比较 *和多个标签
+ */
+void test_etag()
+{
+    std::string etag = "\"5f-10\"";
+
+    KIT_ASSERT(StaticFileServlet::MatchETag(View("\"5f-10\""), etag));
+    KIT_ASSERT(StaticFileServlet::MatchETag(View("W/\"5f-10\""), etag));
+    KIT_ASSERT(StaticFileServlet::MatchETag(View("*"), etag));
+    KIT_ASSERT(StaticFileServlet::MatchETag(View(" * "), etag));
+    KIT_ASSERT(StaticFileServlet::MatchETag(View("\"a\", W/\"5f-10\""), etag));
+    KIT_ASSERT(StaticFileServlet::MatchETag(View("\"a\",\t\"5f-10\" ,\"b\""), etag));
+
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View(""), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("\"5f-11\""), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("5f-10"), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("w/\"5f-10\""), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("\"5f-10\"x"), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("\"a\", \"b\""), etag));
+    KIT_ASSERT(!StaticFileServlet::MatchETag(View("\"a\", **"), etag));
+
+    KIT_LOG_INFO(g_logger) << "test_etag ok";
+}
+
+/**
+ * @brief If-Range 对不上的时候要回整个文件
+ */
+void test_if_range()
+{
+    std::string etag = "\"5f-10\"";
+    std::string lm = "Thu, 01 Jan 1970 00:01:35 GMT";
+
+    KIT_ASSERT(StaticFileServlet::MatchIfRange(View("\"5f-10\""), etag, lm));
+    KIT_ASSERT(StaticFileServlet::MatchIfRange(View("Thu, 01 Jan 1970 00:01:35 GMT"), etag, lm));
+
+    //弱标签不能用来比较
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View("W/\"5f-10\""), etag, lm));
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View("\"5f-11\""), etag, lm));
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View("*"), etag, lm));
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View("\"a\", \"5f-10\""), etag, lm));
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View("Thu, 01 Jan 1970 00:01:36 GMT"), etag, lm));
+    KIT_ASSERT(!StaticFileServlet::MatchIfRange(View(""), etag, lm));
+
+    KIT_LOG_INFO(g_logger) << "test_if_range ok";
+}
+
+
+int main(int argc, char *argv[])
+{
+    test_range();
+    test_path();
+    test_etag();
+    test_if_range();
+
+    KIT_LOG_INFO(g_logger) << "test_servlet ok";
+    return 0;
+}
@@ -8,6 +8,17 @@
 #include "../kit_server/hook.h"
 #include "../kit_server/socket.h"
 #include "../kit_server/tcp_server.h"
+#include "../kit_server/util.h"
+#include "../kit_server/macro.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
 
 using namespace std;
 using namespace kit_server;
@@ -15,6 +26,231 @@ using namespace kit_server;
 
 static Logger::ptr g_logger = KIT_LOG_ROOT();
 
+/**
+ * @brief 测试用服务器 客户端关闭之前一直占着连接
+ */
+class HoldServer: public TcpServer
+{
+public:
+    HoldServer(IOManager* worker, IOManager* accept_worker)
+        :TcpServer(worker, accept_worker)
+    {
+    }
+
+protected:
+    void handleClient(Socket::ptr client) override
+    {
+        char c;
+        client->recv(&c, 1);
+        client->close();
+    }
+};
+
+/**
+ * @brief 启动服务器 监听127.0.0.1:port
+ * @details 监听套接字要在调度线程里创建 主线程没有开hook 建出来的是阻塞套接字
+ *          accept会把调度线程卡在内核里 stop也叫不醒
+ */
+static void StartServer(IOManager* iom, TcpServer::ptr server, int port)
+{
+    std::atomic<bool> done = {false};
+    iom->schedule([server, port, &done](){
+        Address::ptr addr = Address::LookUpAnyIPAddress("127.0.0.1:" + std::to_string(port));
+        KIT_ASSERT(server->bind(addr));
+        KIT_ASSERT(server->start());
+        done = true;
+    });
+    while(!done)
+        usleep(1000);
+}
+
+/**
+ * @brief 普通线程里的阻塞客户端
+ * @param[in] port 服务器端口
+ * @param[in] from 本地地址 不同的回环地址算不同的来源IP
+ * @return int 套接字 连接失败返回-1
+ */
+static int Connect(int port, const char* from = "127.0.0.1")
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    KIT_ASSERT(fd >= 0);
+
+    sockaddr_in local;
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    inet_pton(AF_INET, from, &local.sin_addr);
+    KIT_ASSERT(::bind(fd, (sockaddr*)&local, sizeof(local)) == 0);
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(::connect(fd, (sockaddr*)&addr, sizeof(addr)))
+    {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void CloseAll(std::vector<int>& fds)
+{
+    for(int fd : fds)
+        ::close(fd);
+    fds.clear();
+}
+
+/**
+ * @brief 等待条件成立 最多等3秒
+ */
+static bool WaitFor(std::function<bool()> cond)
+{
+    uint64_t start = GetCurrentMs();
+    while(!cond())
+    {
+        if(GetCurrentMs() - start > 3000)
+            return false;
+        usleep(1000);
+    }
+    return true;
+}
+
+/**
+ * @brief 被服务器关闭的连接 读到EOF
+ */
+static bool IsShed(int fd)
+{
+    char c;
+    struct timeval tv = {3, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return ::recv(fd, &c, 1, 0) == 0;
+}
+
+
+/**
+ * @brief 最大并发连接数 超过的连接直接关闭 客户端断开后名额全部释放
+ */
+void test_max_connections(IOManager* iom)
+{
+    TcpServer::ptr server(new HoldServer(iom, iom));
+    server->setMaxConnections(5);
+    StartServer(iom, server, 18131);
+
+    std::vector<int> fds;
+    for(int i = 0;i < 20;++i)
+        fds.push_back(Connect(18131));
+
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() + server->getShedByConnections() == 20; }));
+    KIT_ASSERT(server->getConnectionCount() == 5);
+    KIT_ASSERT(server->getShedByConnections() == 15);
+    KIT_ASSERT(server->getShedByIp() == 0 && server->getShedByPendingTasks() == 0);
+
+    //先连上的占着名额 后面的被关闭
+    for(int i = 5;i < 20;++i)
+        KIT_ASSERT(IsShed(fds[i]));
+
+    CloseAll(fds);
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 0; }));
+
+    //名额释放后又能连上
+    fds.push_back(Connect(18131));
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 1; }));
+    KIT_ASSERT(server->getShedByConnections() == 15);
+    CloseAll(fds);
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 0; }));
+
+    server->stop();
+    KIT_LOG_INFO(g_logger) << "test_max_connections ok";
+}
+
+/**
+ * @brief 同一个来源IP的最大并发连接数 不同来源IP分别计数 断开后释放本IP的名额
+ */
+void test_max_per_ip(IOManager* iom)
+{
+    TcpServer::ptr server(new HoldServer(iom, iom));
+    server->setMaxConnectionsPerIp(3);
+    StartServer(iom, server, 18132);
+
+    std::vector<int> a, b;
+    for(int i = 0;i < 5;++i)
+        a.push_back(Connect(18132, "127.0.0.1"));
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() + server->getShedByIp() == 5; }));
+    KIT_ASSERT(server->getConnectionCount() == 3);
+    KIT_ASSERT(server->getShedByIp() == 2);
+    KIT_ASSERT(IsShed(a[3]) && IsShed(a[4]));
+
+    //另一个来源IP不受影响
+    for(int i = 0;i < 4;++i)
+        b.push_back(Connect(18132, "127.0.0.2"));
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() + server->getShedByIp() == 9; }));
+    KIT_ASSERT(server->getConnectionCount() == 6);
+    KIT_ASSERT(server->getShedByIp() == 3);
+    KIT_ASSERT(server->getShedByConnections() == 0);
+
+    //第一个IP断开后可以重新连满
+    CloseAll(a);
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 3; }));
+    for(int i = 0;i < 3;++i)
+        a.push_back(Connect(18132, "127.0.0.1"));
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 6; }));
+    KIT_ASSERT(server->getShedByIp() == 3);
+
+    CloseAll(a);
+    CloseAll(b);
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 0; }));
+
+    server->stop();
+    KIT_LOG_INFO(g_logger) << "test_max_per_ip ok";
+}
+
+/**
+ * @brief worker队列中等待的任务超过上限时 新连接直接关闭 队列排空后恢复
+ */
+void test_max_pending_tasks(IOManager* iom)
+{
+    //只有一个线程的worker 被一个不让出的任务卡住 后面的任务都在队列里等
+    IOManager worker("worker", 1, false);
+    static std::atomic<bool> s_release = {false};
+    worker.schedule([](){
+        while(!s_release)
+            sched_yield();
+    });
+    KIT_ASSERT(WaitFor([&worker](){ return worker.getTaskCount() == 0; }));
+    for(int i = 0;i < 3;++i)
+        worker.schedule([](){});
+
+    TcpServer::ptr server(new HoldServer(&worker, iom));
+    server->setMaxPendingTasks(3);
+    StartServer(iom, server, 18133);
+
+    std::vector<int> fds;
+    for(int i = 0;i < 4;++i)
+        fds.push_back(Connect(18133));
+    KIT_ASSERT(WaitFor([&server](){ return server->getShedByPendingTasks() == 4; }));
+    KIT_ASSERT(server->getConnectionCount() == 0);
+    for(int fd : fds)
+        KIT_ASSERT(IsShed(fd));
+    CloseAll(fds);
+
+    //后端恢复之后接受新连接
+    s_release = true;
+    KIT_ASSERT(WaitFor([&worker](){ return worker.getTaskCount() == 0; }));
+    fds.push_back(Connect(18133));
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 1; }));
+    KIT_ASSERT(server->getShedByPendingTasks() == 4);
+    CloseAll(fds);
+    KIT_ASSERT(WaitFor([&server](){ return server->getConnectionCount() == 0; }));
+
+    server->stop();
+    KIT_LOG_INFO(g_logger) << "test_max_pending_tasks ok";
+}
+
+
+/**
+ * @brief 监听8888端口的演示服务器 不会自己退出 带任意参数运行时才执行
+ */
 void run()
 {
     auto addr = Address::LookUpAny("0.0.0.0:8888");
@@ -29,17 +265,25 @@ void run()
     TcpServer::ptr server(new TcpServer);
     while(!server->bind(in_addrs, out_addrs))
         sleep(2);
-   
+
     server->start();
 }
 
 
-int main()
+int main(int argc, char** argv)
 {
-    IOManager iom("tcp_server");
-
-    iom.schedule(&run);
+    if(argc > 1)
+    {
+        IOManager iom("tcp_server");
+        iom.schedule(&run);
+        return 0;
+    }
 
+    IOManager iom("tcp_server", 2, false);
+    test_max_connections(&iom);
+    test_max_per_ip(&iom);
+    test_max_pending_tasks(&iom);
 
+    KIT_LOG_INFO(g_logger) << "test_tcp_server ok";
     return 0;
-}
\ No newline at end of file
+}
@@ -4,6 +4,9 @@
 #include "../kit_server/thread.h"
 #include "../kit_server/scheduler.h"
 #include "../kit_server/iomanager.h"
+#include "../kit_server/timer.h"
+#include "../kit_server/util.h"
+#include "../kit_server/macro.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -13,6 +16,7 @@
 #include <fcntl.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <vector>
 
 
 using namespace std;
@@ -21,36 +25,457 @@ using namespace kit_server;
 static Logger::ptr g_logger = KIT_LOG_NAME("root");
 
 
+/**
+ * @brief 用虚拟时钟驱动的定时器管理类 时间只在测试推进时变化 结果是确定的
+ */
+class TestTimerManager: public TimerManager
+{
+public:
+    /**
+     * @brief 构造函数 时间轮从构造时缓存的单调时间开始转动 虚拟时钟要和它对齐
+     * @param[in] now 起始时间点
+     */
+    TestTimerManager(uint64_t now)
+        :m_now(now)
+    {
+    }
+
+    /**
+     * @brief 执行当前时间点已经到期的定时器
+     * @return size_t 执行的回调数量
+     */
+    size_t run()
+    {
+        std::vector<std::function<void()> > cbs;
+        listExpiredCb(cbs);
+        for(auto& cb : cbs)
+            cb();
+        return cbs.size();
+    }
+
+    /**
+     * @brief 时钟每次走1ms 直到end 每一步都处理到期的定时器
+     * @param[in] end 结束时间点
+     */
+    void stepTo(uint64_t end)
+    {
+        while(m_now < end)
+        {
+            ++m_now;
+            run();
+        }
+    }
+
+public:
+    /// 虚拟时钟
+    uint64_t m_now = 0;
+    /// 插到队头的通知次数
+    int m_frontCount = 0;
+
+protected:
+    void onTimerInsertedAtFront() override { ++m_frontCount; }
+    int getTimerWheelIndex() override { return -1; }
+    size_t selectTimerWheel() override { return 0; }
+    void onTimerPosted(size_t index, bool lazy) override {}
+    uint64_t getCurrentMs() override { return m_now; }
+    uint64_t getCoarseMs() override { return m_now; }
+};
 
 
-int main()
+/**
+ * @brief 层级边界测试 第0层256ms 第1层2^14ms 以及更高层的定时器都要在到期时间点准时触发
+ * @details 一部分定时器在整圈开始时添加 一部分在圈中间添加 覆盖不同的降级路径
+ */
+void test_boundaries()
 {
-    KIT_LOG_DEBUG(g_logger) << "test begin";
-    IOManager iom("test", 2);
+    static const uint64_t delays[] = {1, 255, 256, 257, 511, 512, 16383, 16384, 16385, 16384 + 300, (1 << 20) + 5};
+    static const size_t size = sizeof(delays) / sizeof(delays[0]);
+
+    TestTimerManager mgr(UpdateCoarseMs());
+    uint64_t start = mgr.m_now;
+
+    std::vector<uint64_t> fired(size * 2, 0);
+    std::vector<uint64_t> expect(size * 2, 0);
+    for(size_t i = 0;i < size;++i)
+    {
+        expect[i] = start + delays[i];
+        mgr.addTimer(delays[i], [&mgr, &fired, i](){ fired[i] = mgr.m_now; });
+    }
+
+    //转到圈中间再添加一批
+    mgr.stepTo(start + 100);
+    for(size_t i = 0;i < size;++i)
+    {
+        expect[size + i] = mgr.m_now + delays[i];
+        mgr.addTimer(delays[i], [&mgr, &fired, i](){ fired[size + i] = mgr.m_now; });
+    }
+
+    mgr.stepTo(start + 100 + delays[size - 1]);
+    for(size_t i = 0;i < size * 2;++i)
+    {
+        if(fired[i] != expect[i])
+            KIT_LOG_ERROR(g_logger) << "timer " << i << " delay=" << delays[i % size]
+                << " expect=" << expect[i] - start << " fired=" << (fired[i] ? fired[i] - start : 0);
+        KIT_ASSERT(fired[i] == expect[i]);
+    }
+    KIT_ASSERT(mgr.isTimersEmpty());
+
+    KIT_LOG_INFO(g_logger) << "test_boundaries ok";
+}
+
+/**
+ * @brief 按getNextTime()返回的时长跳着推进时钟 和idle()的用法一致 定时器不能晚于到期时间点触发
+ */
+void test_next_time_jump()
+{
+    static const uint64_t delays[] = {3, 256, 700, 16384, 16385, 40000, (1 << 22) + 17};
+    static const size_t size = sizeof(delays) / sizeof(delays[0]);
+
+    TestTimerManager mgr(UpdateCoarseMs());
+    uint64_t start = mgr.m_now;
+
+    //空的时间轮没有超时时间
+    KIT_ASSERT(mgr.getNextTime() == ~0ull);
+
+    std::vector<uint64_t> fired(size, 0);
+    for(size_t i = 0;i < size;++i)
+        mgr.addTimer(delays[i], [&mgr, &fired, i](){ fired[i] = mgr.m_now; });
+
+    int wakeups = 0;
+    while(!mgr.isTimersEmpty())
+    {
+        uint64_t next = mgr.getNextTime();
+        KIT_ASSERT(next != ~0ull);
+        mgr.m_now += next;
+        mgr.run();
+        ++wakeups;
+    }
+
+    for(size_t i = 0;i < size;++i)
+        KIT_ASSERT(fired[i] == start + delays[i]);
 
-    // auto f1 = [=](){
-    //     KIT_LOG_INFO(g_logger) << "hello timer!!";
-    // };
+    //空槽位和降级都是跳过的 唤醒次数只和层数相关 不和时长相关
+    KIT_ASSERT(wakeups < 200);
 
-    // auto f2 = [=](){
-    //     KIT_LOG_INFO(g_logger) << "hello recurring timer!!";
-    // };
+    //时钟一次跳过很远 所有到期的定时器一起取出
+    size_t count = 0;
+    for(size_t i = 0;i < size;++i)
+        mgr.addTimer(delays[i], [&count](){ ++count; });
+    mgr.m_now += delays[size - 1];
+    KIT_ASSERT(mgr.run() == size);
+    KIT_ASSERT(count == size);
+
+    KIT_LOG_INFO(g_logger) << "test_next_time_jump ok, wakeups=" << wakeups;
+}
+
+/**
+ * @brief getNextTime()语义测试
+ * @details 第0层本圈内的定时器返回精确的剩余时长 更高层的返回值不晚于到期时间
+ *          已经过期返回0 只有插到上一次算出的队头之前才通知一次
+ */
+void test_next_time()
+{
+    TestTimerManager mgr(UpdateCoarseMs());
+
+    //空的时间轮插入第一个定时器 一定在队头
+    Timer::ptr t1 = mgr.addTimer(100, [](){});
+    KIT_ASSERT(mgr.m_frontCount == 1);
+    KIT_ASSERT(mgr.getNextTime() == 100);
+
+    mgr.m_now += 40;
+    KIT_ASSERT(mgr.getNextTime() == 60);
+
+    //更晚的定时器不改变队头 不通知
+    mgr.addTimer(150, [](){});
+    KIT_ASSERT(mgr.m_frontCount == 1);
+    KIT_ASSERT(mgr.getNextTime() == 60);
+
+    //更早的定时器插到队头 通知一次 再插更早的不重复通知 直到下一次getNextTime()
+    mgr.addTimer(30, [](){});
+    KIT_ASSERT(mgr.m_frontCount == 2);
+    mgr.addTimer(10, [](){});
+    KIT_ASSERT(mgr.m_frontCount == 2);
+    KIT_ASSERT(mgr.getNextTime() == 10);
+    mgr.addTimer(5, [](){});
+    KIT_ASSERT(mgr.m_frontCount == 3);
+
+    //时钟已经过了到期时间点还没处理 立即返回0
+    mgr.m_now += 50;
+    KIT_ASSERT(mgr.getNextTime() == 0);
+    KIT_ASSERT(mgr.run() == 3);
+    KIT_ASSERT(mgr.getNextTime() == 10);
+    KIT_ASSERT(t1->cancel());
+    KIT_ASSERT(mgr.getNextTime() == 100);
+
+    //高层的定时器 返回值不晚于它的到期时间 降级时可能提前唤醒
+    TestTimerManager mgr2(UpdateCoarseMs());
+    mgr2.addTimer(20000, [](){});
+    uint64_t next = mgr2.getNextTime();
+    KIT_ASSERT(next > 0 && next <= 20000);
+
+    KIT_LOG_INFO(g_logger) << "test_next_time ok";
+}
+
+/**
+ * @brief 循环定时器测试 每个周期触发一次 下一次从触发时开始计时 取消后不再触发
+ */
+void test_recurring()
+{
+    TestTimerManager mgr(UpdateCoarseMs());
+    uint64_t start = mgr.m_now;
+
+    std::vector<uint64_t> fired;
+    Timer::ptr t = mgr.addTimer(100, [&mgr, &fired](){ fired.push_back(mgr.m_now); }, true);
+
+    mgr.stepTo(start + 350);
+    KIT_ASSERT(fired.size() == 3);
+    for(size_t i = 0;i < fired.size();++i)
+        KIT_ASSERT(fired[i] == start + 100 * (i + 1));
+
+    //处理晚了只补一次 从处理时重新计时
+    mgr.m_now = start + 1000;
+    mgr.run();
+    KIT_ASSERT(fired.size() == 4 && fired[3] == start + 1000);
+    mgr.stepTo(start + 1100);
+    KIT_ASSERT(fired.size() == 5 && fired[4] == start + 1100);
+
+    //跨越第0层一整圈的循环定时器
+    std::vector<uint64_t> long_fired;
+    Timer::ptr t2 = mgr.addTimer(300, [&mgr, &long_fired](){ long_fired.push_back(mgr.m_now); }, true);
+    uint64_t base = mgr.m_now;
+    mgr.stepTo(base + 900);
+    KIT_ASSERT(long_fired.size() == 3 && long_fired[2] == base + 900);
+
+    KIT_ASSERT(t->cancel());
+    KIT_ASSERT(t2->cancel());
+    size_t count = fired.size();
+    mgr.stepTo(mgr.m_now + 1000);
+    KIT_ASSERT(fired.size() == count);
+    KIT_ASSERT(long_fired.size() == 3);
+    KIT_ASSERT(mgr.isTimersEmpty());
+
+    KIT_LOG_INFO(g_logger) << "test_recurring ok";
+}
+
+/**
+ * @brief 取消/刷新/重置测试
+ */
+void test_modify()
+{
+    TestTimerManager mgr(UpdateCoarseMs());
+    uint64_t start = mgr.m_now;
+
+    //取消 只有第一次成功 取消后不再触发
+    bool cancelled_fired = false;
+    Timer::ptr t = mgr.addTimer(50, [&cancelled_fired](){ cancelled_fired = true; });
+    KIT_ASSERT(t->cancel());
+    KIT_ASSERT(!t->cancel());
+    KIT_ASSERT(!t->refresh());
+    KIT_ASSERT(!t->reset(10));
+    mgr.stepTo(start + 100);
+    KIT_ASSERT(!cancelled_fired);
+    KIT_ASSERT(mgr.isTimersEmpty());
+
+    //刷新 从刷新时重新计时 间隔不变
+    start = mgr.m_now;
+    uint64_t fired = 0;
+    t = mgr.addTimer(100, [&mgr, &fired](){ fired = mgr.m_now; });
+    mgr.stepTo(start + 60);
+    KIT_ASSERT(t->refresh());
+    mgr.stepTo(start + 159);
+    KIT_ASSERT(!fired);
+    mgr.stepTo(start + 160);
+    KIT_ASSERT(fired == start + 160);
+
+    //已经触发的一次性定时器不能再刷新/重置/取消
+    KIT_ASSERT(!t->refresh());
+    KIT_ASSERT(!t->reset(10));
+    KIT_ASSERT(!t->cancel());
+
+    //从现在开始重置 可以跨层级
+    start = mgr.m_now;
+    fired = 0;
+    t = mgr.addTimer(100, [&mgr, &fired](){ fired = mgr.m_now; });
+    mgr.stepTo(start + 30);
+    KIT_ASSERT(t->reset(20000, true));
+    mgr.stepTo(start + 30 + 19999);
+    KIT_ASSERT(!fired);
+    mgr.stepTo(start + 30 + 20000);
+    KIT_ASSERT(fired == start + 30 + 20000);
+
+    //继续上一次的计时重置 从高层降到第0层
+    start = mgr.m_now;
+    fired = 0;
+    t = mgr.addTimer(20000, [&mgr, &fired](){ fired = mgr.m_now; });
+    mgr.stepTo(start + 30);
+    KIT_ASSERT(t->reset(200, false));
+    mgr.stepTo(start + 199);
+    KIT_ASSERT(!fired);
+    mgr.stepTo(start + 200);
+    KIT_ASSERT(fired == start + 200);
+
+    //重置到已经过去的时间点 下一次处理时立即触发
+    start = mgr.m_now;
+    fired = 0;
+    t = mgr.addTimer(100, [&mgr, &fired](){ fired = mgr.m_now; });
+    mgr.stepTo(start + 50);
+    KIT_ASSERT(t->reset(10, false));
+    mgr.stepTo(start + 51);
+    KIT_ASSERT(fired == start + 51);
+    KIT_ASSERT(mgr.isTimersEmpty());
+
+    KIT_LOG_INFO(g_logger) << "test_modify ok";
+}
+
+/**
+ * @brief 允许推迟的定时器 在[到期时间点, 到期时间点 + slack]内取末尾0最多的时间点触发
+ */
+void test_slack()
+{
+    TestTimerManager mgr(UpdateCoarseMs());
+
+    //对齐到1024的整数倍 下面的时间点都相对它计算
+    uint64_t base = (mgr.m_now / 1024 + 2) * 1024;
+    mgr.stepTo(base - 20);
+
+    //slack为0 准时触发
+    uint64_t fired0 = 0;
+    mgr.addTimer(7, [&mgr, &fired0](){ fired0 = mgr.m_now; }, false, 0);
+
+    //窗口[base - 5, base + 15]跨过1024的整数倍 落在base上
+    uint64_t fired1 = 0;
+    mgr.addTimer(15, [&mgr, &fired1](){ fired1 = mgr.m_now; }, false, 20);
+
+    //两个窗口[base - 3, base + 7]和[base - 8, base + 4]重叠 落在同一个时间点
+    uint64_t fired2 = 0, fired3 = 0;
+    mgr.addTimer(17, [&mgr, &fired2](){ fired2 = mgr.m_now; }, false, 10);
+    mgr.addTimer(12, [&mgr, &fired3](){ fired3 = mgr.m_now; }, false, 12);
+
+    //按getNextTime()跳着推进 四个定时器只唤醒两次
+    int wakeups = 0;
+    while(!mgr.isTimersEmpty())
+    {
+        mgr.m_now += mgr.getNextTime();
+        mgr.run();
+        ++wakeups;
+    }
+    KIT_ASSERT(fired0 == base - 13);
+    KIT_ASSERT(fired1 == base);
+    KIT_ASSERT(fired2 == base && fired3 == base);
+    KIT_ASSERT(wakeups == 2);
+
+    //窗口[base + 9, base + 15]不跨2的幂 抹掉低2位落在base + 12
+    mgr.stepTo(base + 1);
+    uint64_t fired4 = 0;
+    mgr.addTimer(8, [&mgr, &fired4](){ fired4 = mgr.m_now; }, false, 6);
+    mgr.stepTo(base + 20);
+    KIT_ASSERT(fired4 == base + 12);
+
+    //随机的定时器都在自己的窗口内触发 触发的时间点比定时器少
+    static const size_t size = 1000;
+    std::vector<uint64_t> expect(size, 0), limit(size, 0), fired(size, 0);
+    srand(12345);
+    for(size_t i = 0;i < size;++i)
+    {
+        uint64_t ms = rand() % 3000 + 1;
+        uint64_t slack = rand() % 500;
+        expect[i] = mgr.m_now + ms;
+        limit[i] = expect[i] + slack;
+        mgr.addTimer(ms, [&mgr, &fired, i](){ fired[i] = mgr.m_now; }, false, slack);
+    }
+
+    wakeups = 0;
+    while(!mgr.isTimersEmpty())
+    {
+        mgr.m_now += mgr.getNextTime();
+        if(mgr.run())
+            ++wakeups;
+    }
+    for(size_t i = 0;i < size;++i)
+        KIT_ASSERT(fired[i] >= expect[i] && fired[i] <= limit[i]);
+    KIT_ASSERT(wakeups < (int)size / 4);
+
+    KIT_LOG_INFO(g_logger) << "test_slack ok, wakeups=" << wakeups;
+}
+
+/**
+ * @brief 唤醒次数统计 错开的循环定时器设置slack之后唤醒次数要明显减少
+ * @details 一个调度线程 只有定时器会唤醒它 用唤醒总次数的差值算出每秒唤醒次数 和统计窗口的结果对照
+ */
+void test_wakeups()
+{
+    static const int count = 8;
+    IOManager iom("wakeup", 1, false);
+
+    auto measure = [&iom](uint64_t slack) {
+        std::vector<Timer::ptr> timers;
+        for(int i = 0;i < count;++i)
+        {
+            timers.push_back(iom.addTimer(100, [](){}, true, slack));
+            usleep(7 * 1000);
+        }
+
+        //跳过第一个统计窗口 整个第二个窗口都在这一轮里
+        usleep(1100 * 1000);
+        uint64_t begin = iom.getWakeupCount();
+        uint64_t begin_ms = GetCurrentMs();
+        usleep(1100 * 1000);
+        uint64_t rate = (iom.getWakeupCount() - begin) * 1000 / (GetCurrentMs() - begin_ms);
+        uint64_t window = iom.getWakeupsPerSecond();
+
+        for(auto& t : timers)
+            t->cancel();
+        KIT_LOG_INFO(g_logger) << "slack=" << slack << " wakeups/s=" << rate << " window=" << window;
+        KIT_ASSERT(window * 2 >= rate && window <= rate * 2);
+        return rate;
+    };
+
+    uint64_t exact = measure(0);
+    uint64_t coalesced = measure(100);
+    //8个错开的定时器每100ms各唤醒一次
+    KIT_ASSERT(exact >= count * 10 / 2 && exact <= count * 10 * 2);
+    KIT_ASSERT(coalesced * 2 < exact);
+
+    KIT_LOG_INFO(g_logger) << "test_wakeups ok";
+}
+
+/**
+ * @brief IOManager上的循环定时器演示 不会自己退出 带任意参数运行时才执行
+ */
+void test_iomanager_timer()
+{
+    IOManager iom("test", 2);
 
     //创建一个循环定时器
     static Timer::ptr t = iom.addTimer(1000, [](){
         static int i = 0;
         KIT_LOG_INFO(g_logger) << "hello timer!!, i = " << i;
-        
+
         if(++i == 3)
             t->refresh();
             //t->reset(3000, true);
             //t->cancel();
- 
+
     }, true);
+}
 
-    KIT_LOG_DEBUG(g_logger) << "test end";
 
+int main(int argc, char** argv)
+{
+    KIT_LOG_DEBUG(g_logger) << "test begin";
+
+    test_boundaries();
+    test_next_time_jump();
+    test_next_time();
+    test_recurring();
+    test_modify();
+    test_slack();
+    test_wakeups();
 
+    if(argc > 1)
+        test_iomanager_timer();
+
+    KIT_LOG_DEBUG(g_logger) << "test end";
 
     return 0;
-}
\ No newline at end of file
+}